@@ -0,0 +1,293 @@
+// benchmarks for statement_vtab, linked against the static SQLITE_CORE build. run with make bench
+#define _POSIX_C_SOURCE 199309L
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../statement_vtab.h"
+
+#define OUTER_ROWS 1000000
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check(sqlite3* db, int ret, const char* what) {
+	if(ret != SQLITE_OK && ret != SQLITE_ROW && ret != SQLITE_DONE) {
+		fprintf(stderr,"%s: %s\n",what,sqlite3_errmsg(db));
+		exit(1);
+	}
+}
+
+static void exec(sqlite3* db, const char* sql) {
+	char* err = NULL;
+	if(sqlite3_exec(db,sql,NULL,NULL,&err) != SQLITE_OK) {
+		fprintf(stderr,"%s: %s\n",sql,err);
+		exit(1);
+	}
+}
+
+// count every allocation sqlite makes by wrapping its default allocator
+static sqlite3_mem_methods default_mem;
+static sqlite3_int64 num_allocs;
+
+static void* counting_malloc(int size) {
+	num_allocs++;
+	return default_mem.xMalloc(size);
+}
+
+static void* counting_realloc(void* p, int size) {
+	num_allocs++;
+	return default_mem.xRealloc(p,size);
+}
+
+static void count_allocs(void) {
+	sqlite3_mem_methods mem;
+	sqlite3_config(SQLITE_CONFIG_GETMALLOC,&default_mem);
+	mem = default_mem;
+	mem.xMalloc = counting_malloc;
+	mem.xRealloc = counting_realloc;
+	sqlite3_config(SQLITE_CONFIG_MALLOC,&mem);
+}
+
+static sqlite3_int64 query_int(sqlite3* db, const char* sql) {
+	sqlite3_stmt* stmt;
+	check(db,sqlite3_prepare_v2(db,sql,-1,&stmt,NULL),sql);
+	check(db,sqlite3_step(stmt),sql);
+	sqlite3_int64 result = sqlite3_column_int64(stmt,0);
+	sqlite3_finalize(stmt);
+	return result;
+}
+
+static sqlite3_int64 num_filters(sqlite3* db) {
+	return query_int(db,"SELECT total(filters) FROM statement_vtab_stats");
+}
+
+// run sql reps times, where each run does the work of rows rows (e.g. outer rows of a join), and check that it produces expected.
+// ns/xFilter is left blank for baselines not involving a statement vtab
+static void bench(sqlite3* db, const char* label, const char* sql, int reps, sqlite3_int64 rows, sqlite3_int64 expected) {
+	sqlite3_stmt* stmt;
+	check(db,sqlite3_prepare_v2(db,sql,-1,&stmt,NULL),sql);
+
+	sqlite3_int64 filters = num_filters(db), allocs = num_allocs;
+	double start = now();
+	for(int i = 0; i < reps; i++) {
+		int ret;
+		while((ret = sqlite3_step(stmt)) == SQLITE_ROW)
+			if(sqlite3_column_int64(stmt,0) != expected)
+				fprintf(stderr,"%s: unexpected result %lld\n",label,sqlite3_column_int64(stmt,0));
+		check(db,ret,sql);
+		sqlite3_reset(stmt);
+	}
+	double elapsed = now() - start;
+	allocs = num_allocs - allocs;
+	filters = num_filters(db) - filters;
+	sqlite3_finalize(stmt);
+
+	double total = (double)rows*reps;
+	printf("%-28s %12.0f rows/s",label,total/elapsed);
+	if(filters)
+		printf(" %10.0f ns/xFilter",elapsed*1e9/filters);
+	else printf(" %21s","");
+	printf(" %8.2f allocs/row\n",allocs/total);
+}
+
+static void setup(sqlite3* db) {
+	char sql[256];
+	snprintf(sql,sizeof(sql),
+		"CREATE TABLE outer_t(x INTEGER PRIMARY KEY);"
+		"INSERT INTO outer_t WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x < %d) SELECT x FROM c;",OUTER_ROWS);
+	exec(db,sql);
+	exec(db,
+		"CREATE TABLE lookup(k INTEGER PRIMARY KEY, v INTEGER);"
+		"INSERT INTO lookup SELECT x, x % 7 FROM outer_t;"
+		"CREATE VIRTUAL TABLE lut USING statement((SELECT v FROM lookup WHERE k = :k));"
+		"CREATE VIEW lut_view AS SELECT k, v FROM lookup;");
+}
+
+// a statement vtab used as a table-valued function on the inner side of a join, once per outer row
+static void bench_join(sqlite3* db) {
+	sqlite3_int64 expected = query_int(db,"SELECT sum(v) FROM lookup");
+	bench(db,"join tvf (1M)","SELECT sum(v) FROM outer_t, lut(outer_t.x)",1,OUTER_ROWS,expected);
+	bench(db,"join view (1M)","SELECT sum(v) FROM outer_t JOIN lut_view ON lut_view.k = outer_t.x",1,OUTER_ROWS,expected);
+	bench(db,"join cte (1M)","WITH lut_cte AS (SELECT k, v FROM lookup) SELECT sum(v) FROM outer_t JOIN lut_cte ON lut_cte.k = outer_t.x",1,OUTER_ROWS,expected);
+}
+
+// IN lists on a parameter, which are processed all at once where supported
+static void bench_in(sqlite3* db) {
+	const int sizes[] = {10, 1000, 100000};
+	for(int i = 0; i < 3; i++) {
+		int n = sizes[i], reps = 1000000 / n;
+		char label[64], sql[256];
+		snprintf(sql,sizeof(sql),"SELECT sum(v) FROM lookup WHERE k <= %d",n);
+		sqlite3_int64 expected = query_int(db,sql);
+
+		snprintf(label,sizeof(label),"in tvf (%d)",n);
+		snprintf(sql,sizeof(sql),"SELECT sum(v) FROM lut WHERE k IN (SELECT x FROM outer_t WHERE x <= %d)",n);
+		bench(db,label,sql,reps,n,expected);
+
+		snprintf(label,sizeof(label),"in view (%d)",n);
+		snprintf(sql,sizeof(sql),"SELECT sum(v) FROM lut_view WHERE k IN (SELECT x FROM outer_t WHERE x <= %d)",n);
+		bench(db,label,sql,reps,n,expected);
+
+		snprintf(label,sizeof(label),"in cte (%d)",n);
+		snprintf(sql,sizeof(sql),"WITH lut_cte AS (SELECT k, v FROM lookup) SELECT sum(v) FROM lut_cte WHERE k IN (SELECT x FROM outer_t WHERE x <= %d)",n);
+		bench(db,label,sql,reps,n,expected);
+	}
+}
+
+// constraints on parameters 1 and 2 are passed straight through, while 1 and 3 need mapping through a param map
+static void bench_constraints(sqlite3* db) {
+	exec(db,"CREATE VIRTUAL TABLE args3 USING statement((SELECT coalesce(:a,0) + coalesce(:b,0) + coalesce(:c,0) AS s), cache=0)");
+	sqlite3_int64 expected = query_int(db,"SELECT sum(x+x) FROM outer_t WHERE x <= 100000");
+	bench(db,"contiguous (a, b)","SELECT sum(s) FROM outer_t, args3 WHERE a = outer_t.x AND b = outer_t.x AND outer_t.x <= 100000",1,100000,expected);
+	bench(db,"non-contiguous (a, c)","SELECT sum(s) FROM outer_t, args3 WHERE a = outer_t.x AND c = outer_t.x AND outer_t.x <= 100000",1,100000,expected);
+}
+
+// statements wider than the 64 columns colUsed can tell apart
+static void bench_wide(sqlite3* db) {
+	const int cols = 120;
+	sqlite3_str* vtab = sqlite3_str_new(db);
+	sqlite3_str* view = sqlite3_str_new(db);
+	sqlite3_str_appendf(vtab,"CREATE VIRTUAL TABLE wide USING statement((SELECT ");
+	sqlite3_str_appendf(view,"CREATE VIEW wide_view AS SELECT x");
+	for(int i = 0; i < cols; i++) {
+		sqlite3_str_appendf(vtab,"%s:x + %d AS c%d",i ? ", " : "",i,i);
+		sqlite3_str_appendf(view,", x + %d AS c%d",i,i);
+	}
+	sqlite3_str_appendf(vtab,"), cache=0)");
+	sqlite3_str_appendf(view," FROM outer_t");
+	char* sql = sqlite3_str_finish(vtab);
+	exec(db,sql);
+	sqlite3_free(sql);
+	sql = sqlite3_str_finish(view);
+	exec(db,sql);
+	sqlite3_free(sql);
+
+	sqlite3_int64 expected = query_int(db,"SELECT sum(x+1) FROM outer_t WHERE x <= 100000");
+	bench(db,"wide tvf (c1)","SELECT sum(c1) FROM outer_t, wide(outer_t.x) WHERE outer_t.x <= 100000",1,100000,expected);
+	bench(db,"wide view (c1)","SELECT sum(c1) FROM wide_view WHERE x <= 100000",1,100000,expected);
+	expected = query_int(db,"SELECT sum(x+100) FROM outer_t WHERE x <= 100000");
+	bench(db,"wide tvf (c100)","SELECT sum(c100) FROM outer_t, wide(outer_t.x) WHERE outer_t.x <= 100000",1,100000,expected);
+	bench(db,"wide view (c100)","SELECT sum(c100) FROM wide_view WHERE x <= 100000",1,100000,expected);
+}
+
+// large blobs produced by the statement and passed through to the outer query
+static void bench_blob_result(sqlite3* db) {
+	exec(db,
+		"CREATE TABLE blobs(id INTEGER PRIMARY KEY, b BLOB);"
+		"INSERT INTO blobs SELECT x, zeroblob(65536) || x FROM outer_t WHERE x <= 256;"
+		"CREATE VIRTUAL TABLE blob_get USING statement((SELECT b FROM blobs WHERE id = :id));");
+	sqlite3_int64 expected = query_int(db,"SELECT sum(length(b)) FROM blobs");
+	bench(db,"blob result tvf (64K)","SELECT sum(length(blob_get.b)) FROM blobs, blob_get(blobs.id)",20,256,expected);
+	bench(db,"blob result table (64K)","SELECT sum(length(b)) FROM blobs",20,256,expected);
+}
+
+// large blobs passed to a statement vtab as an argument, as when wrapping JSON documents or images
+static void bench_blob_bind(sqlite3* db) {
+	const int size = 512 << 10, calls = 4000;
+	exec(db,"CREATE VIRTUAL TABLE blob_len USING statement((SELECT length(:doc) AS n))");
+
+	sqlite3_stmt* stmt;
+	check(db,sqlite3_prepare_v2(db,"SELECT n FROM blob_len(?1)",-1,&stmt,NULL),"prepare");
+	void* blob = malloc(size);
+	memset(blob,'x',size);
+	check(db,sqlite3_bind_blob(stmt,1,blob,size,SQLITE_STATIC),"bind");
+
+	double start = now();
+	sqlite3_int64 total = 0;
+	for(int i = 0; i < calls; i++) {
+		check(db,sqlite3_step(stmt),"step");
+		total += sqlite3_column_int64(stmt,0);
+		sqlite3_reset(stmt);
+	}
+	double elapsed = now() - start;
+	if(total != (sqlite3_int64)size*calls)
+		fprintf(stderr,"blob_bind: unexpected result %lld\n",total);
+
+	printf("%-28s %10d calls %12.0f ns/call %10.0f MB/s\n","blob bind (512K)",calls,elapsed*1e9/calls,(double)size*calls/elapsed/(1<<20));
+	sqlite3_finalize(stmt);
+	free(blob);
+}
+
+// preparing the same query shape repeatedly, as ORMs and query builders do, reuses the memoized plan
+static void bench_plan(sqlite3* db) {
+	const int prepares = 20000;
+	exec(db,"CREATE VIRTUAL TABLE args6 USING statement((SELECT :a + :b + :c + :d + :e + :f AS s WHERE :a IS NOT NULL))");
+
+	double start = now();
+	for(int i = 0; i < prepares; i++) {
+		sqlite3_stmt* stmt;
+		check(db,sqlite3_prepare_v2(db,"SELECT s FROM args6 WHERE f = 6 AND a = 1 AND d = 4 AND b = 2 AND e = 5 AND c = 3 AND s > 0",-1,&stmt,NULL),"prepare");
+		sqlite3_finalize(stmt);
+	}
+	double elapsed = now() - start;
+
+	printf("%-28s %10d prepares %9.0f ns/prepare\n","plan (6 constraints)",prepares,elapsed*1e9/prepares);
+}
+
+// setting up a fresh connection and running a query on it, with the statement defined in the connection's schema or registered
+static void bench_register(sqlite3* unused) {
+	const int connections = 2000;
+	const char* sql = "SELECT strftime('%Y', :date) AS year, strftime('%m', :date) AS month, strftime('%d', :date) AS day";
+	for(int registered = 0; registered < 2; registered++) {
+		double start = now();
+		for(int i = 0; i < connections; i++) {
+			sqlite3* db;
+			if(sqlite3_open(":memory:",&db) != SQLITE_OK)
+				exit(1);
+			if(registered)
+				check(db,sqlite3_statementvtab_register(db,"split_date",sql,0,NULL,NULL),"register");
+			else {
+				check(db,sqlite3_statementvtab_init(db,NULL,NULL),"init");
+				char* create = sqlite3_mprintf("CREATE VIRTUAL TABLE split_date USING statement((%s))",sql);
+				exec(db,create);
+				sqlite3_free(create);
+			}
+			if(query_int(db,"SELECT year FROM split_date('2019-11-13')") != 2019)
+				fprintf(stderr,"register: unexpected result\n");
+			sqlite3_close(db);
+		}
+		double elapsed = now() - start;
+		printf("%-28s %10d connections %6.0f ns/connection\n",registered ? "register (registered)" : "register (create table)",connections,elapsed*1e9/connections);
+	}
+}
+
+static const struct {
+	const char* name;
+	void (*run)(sqlite3*);
+} benchmarks[] = {
+	{"join", bench_join},
+	{"in", bench_in},
+	{"constraints", bench_constraints},
+	{"wide", bench_wide},
+	{"blob_result", bench_blob_result},
+	{"blob_bind", bench_blob_bind},
+	{"plan", bench_plan},
+	{"register", bench_register},
+};
+
+// runs every benchmark, or just those named as arguments
+int main(int argc, char** argv) {
+	count_allocs();
+	sqlite3* db;
+	if(sqlite3_open(":memory:",&db) != SQLITE_OK)
+		return 1;
+	check(db,sqlite3_statementvtab_init(db,NULL,NULL),"init");
+
+	setup(db);
+	for(size_t i = 0; i < sizeof(benchmarks)/sizeof(*benchmarks); i++) {
+		int selected = argc < 2;
+		for(int j = 1; j < argc; j++)
+			selected |= !strcmp(argv[j],benchmarks[i].name);
+		if(selected)
+			benchmarks[i].run(db);
+	}
+
+	sqlite3_close(db);
+	return 0;
+}
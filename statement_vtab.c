@@ -4,33 +4,562 @@
  * the author disclaims copyright to this source code.
  */
 
+// statistics exposed through statement_vtab_stats time each step of the inner statements with a monotonic clock,
+// and the workers option runs statements on POSIX threads
+#if (!defined(STATEMENT_VTAB_OMIT_STATS) || !defined(STATEMENT_VTAB_OMIT_WORKERS)) && !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include "sqlite3ext.h"
 SQLITE_EXTENSION_INIT1
+#include "statement_vtab.h"
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
 #include <assert.h>
 #include <stdint.h>
 #include <limits.h>
+#ifndef STATEMENT_VTAB_OMIT_STATS
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#endif
+
+// worker threads are only available where there are POSIX threads. they can read tables only when handed the caller's snapshot,
+// which needs sqlite built with SQLITE_ENABLE_SNAPSHOT and isn't available to loadable extensions
+#if !defined(STATEMENT_VTAB_OMIT_WORKERS) && !defined(_WIN32)
+#define STATEMENT_VTAB_WORKERS
+#include <pthread.h>
+#if defined(SQLITE_CORE) && defined(SQLITE_ENABLE_SNAPSHOT)
+#define STATEMENT_VTAB_SNAPSHOTS
+#endif
+#endif
+
+// the profile option counts each loop of the inner statements through sqlite3_stmt_scanstatus,
+// which needs sqlite built with SQLITE_ENABLE_STMT_SCANSTATUS and likewise isn't available to loadable extensions
+#if defined(SQLITE_CORE) && defined(SQLITE_ENABLE_STMT_SCANSTATUS)
+#define STATEMENT_VTAB_SCANSTATUS
+#endif
+
+// maximum number of idle prepared statements kept per vtab for reuse by later cursors
+#ifndef STATEMENT_VTAB_POOL_SIZE
+#define STATEMENT_VTAB_POOL_SIZE 4
+#endif
+
+// default memory limit for per-vtab result caches enabled with a bare "cache" option
+#ifndef STATEMENT_VTAB_CACHE_DEFAULT_SIZE
+#define STATEMENT_VTAB_CACHE_DEFAULT_SIZE (8 << 20)
+#endif
+
+// memory limit for the cache enabled by default on statements whose results depend only on their parameters
+#ifndef STATEMENT_VTAB_CACHE_AUTO_SIZE
+#define STATEMENT_VTAB_CACHE_AUTO_SIZE (1 << 20)
+#endif
+
+// maximum number of statement declarations remembered across connections, see struct statement_decl
+#ifndef STATEMENT_VTAB_DECL_CACHE_SIZE
+#define STATEMENT_VTAB_DECL_CACHE_SIZE 1024
+#endif
+
+// planner estimates. tables without statistics are assumed to be as large as sqlite itself assumes,
+// and index lookups without statistics to yield about as many rows as sqlite assumes for an equality constraint
+#define STATEMENT_VTAB_DEFAULT_TABLE_ROWS 1048576.0
+#define STATEMENT_VTAB_DEFAULT_EQ_ROWS 10.0
+// each parameter a plan leaves unbound is assumed to make the statement this much less selective
+#define STATEMENT_VTAB_UNBOUND_FACTOR 10.0
+// fraction of rows assumed to pass an equality or other predicate on an output column pushed into the statement
+#define STATEMENT_VTAB_EQ_SELECTIVITY 0.1
+#define STATEMENT_VTAB_RANGE_SELECTIVITY 0.25
+// fixed overhead of an xFilter call relative to stepping one row
+#define STATEMENT_VTAB_FILTER_COST 10.0
+// observed row counts per invocation are tracked separately by number of bound parameters
+// and averaged over a sliding window so that estimates follow changes in the data
+#define STATEMENT_VTAB_OBSERVED_BUCKETS 8
+#define STATEMENT_VTAB_OBSERVED_WINDOW 1024
+
+// number of tuples a batch is assumed to hold when planning
+#define STATEMENT_VTAB_BATCH_TUPLES 100.0
+
+// most worker threads the workers option may ask for, and fewest bindings an invocation must have before they're used
+#define STATEMENT_VTAB_MAX_WORKERS 64
+#ifndef STATEMENT_VTAB_WORKER_MIN_JOBS
+#define STATEMENT_VTAB_WORKER_MIN_JOBS 4
+#endif
+
+// rows a worker steps ahead of the cursor with a bare prefetch option
+#ifndef STATEMENT_VTAB_PREFETCH_ROWS
+#define STATEMENT_VTAB_PREFETCH_ROWS 256
+#endif
+
+// most options read from a vtab's CREATE VIRTUAL TABLE statement in the schema when looking for the scalar option
+#define STATEMENT_VTAB_MAX_OPTIONS 64
+
+// plans remembered per vtab for the index_infos sqlite asks about, replaced round robin once full
+#ifndef STATEMENT_VTAB_MEMO_SIZE
+#define STATEMENT_VTAB_MEMO_SIZE 32
+#endif
+
+// variants written with the constant arguments a plan was made for, beyond which constants are bound like any other value,
+// and the largest text or blob written into a statement that way
+#ifndef STATEMENT_VTAB_MAX_CONSTANT_VARIANTS
+#define STATEMENT_VTAB_MAX_CONSTANT_VARIANTS 32
+#endif
+#define STATEMENT_VTAB_MAX_CONSTANT_SIZE 1024
+
+// IN constraints are only processed all at once for parameters whose position in xFilter's argv fits in a plan's in_mask
+#define STATEMENT_VTAB_MAX_IN 64
+
+// text and blob arguments at least this large are bound without copying them, as sqlite keeps xFilter's args alive for the whole scan.
+// 0 always copies
+#ifndef STATEMENT_VTAB_STATIC_BIND_SIZE
+#define STATEMENT_VTAB_STATIC_BIND_SIZE 4096
+#endif
+
+// invocations are counted in power of two buckets of their latency in microseconds and of the rows they produce,
+// and the slow option keeps this many of the most recent ones taking longer than it allows
+#define STATEMENT_VTAB_HISTOGRAM_BUCKETS 32
+#ifndef STATEMENT_VTAB_SLOW_LOG_SIZE
+#define STATEMENT_VTAB_SLOW_LOG_SIZE 16
+#endif
+
+// a vtab whose invocations with bound parameters build an automatic index or scan a table in full this many times
+// is warned about, along with an index that would avoid it. scans of fewer rows than this aren't counted
+#ifndef STATEMENT_VTAB_CHURN_INVOCATIONS
+#define STATEMENT_VTAB_CHURN_INVOCATIONS 16
+#endif
+#define STATEMENT_VTAB_CHURN_SCAN_STEPS 64
+
+// with a max_steps or max_ms budget, invocations stepping their statements are checked on every this many instructions
+#define STATEMENT_VTAB_BUDGET_OPS 1000
+
+// approximate bookkeeping cost charged against the cache limit for each value held, in addition to its payload
+#define STATEMENT_VALUE_OVERHEAD 64
+
+#ifdef STATEMENT_VTAB_SCANSTATUS
+// a loop of a variant's query plan, totalled over every run of the variant since the vtab was set up
+struct statement_profile {
+	char* detail; // as in EXPLAIN QUERY PLAN
+	sqlite3_int64 loops;
+	sqlite3_int64 rows;
+	sqlite3_int64 cycles; // or -1 where they aren't counted
+};
+#endif
+
+// a rewritten form of the statement used to push work from the outer query into the inner one,
+// along with the idle handles prepared for it. variant 0 is always the statement as given.
+struct statement_variant {
+	char* sql;
+	int index;
+	int exact;     // produces the same rows as the statement as written, so results depend only on its parameters
+	int num_sorts; // sorts set up by the variant's bytecode, or -1 if unknown
+	int pool_size;
+	sqlite3_stmt* pool[STATEMENT_VTAB_POOL_SIZE];
+#ifdef STATEMENT_VTAB_SCANSTATUS
+	int num_profiled;
+	struct statement_profile* profiled;
+#endif
+};
+
+// everything xFilter needs to know about a plan chosen by xBestIndex, which refers to it by index in idxNum.
+// plans are compared bytewise so must be zeroed before filling.
+struct statement_plan {
+	int variant;
+	int mat_column;         // 1 + the output looked up by equality in materialized results by argv[0], or 0 to scan them
+	int num_bound;          // number of leading xFilter args bound to parameters
+	int param_map;          // 1 + index of the parameter each of those is bound to in the vtab's param_maps, or 0 if they're in order
+	sqlite3_uint64 in_mask; // which of those are IN lists to be processed all at once
+	int num_preds;          // number of following args bound to predicates on outputs, as parameters after the statement's own
+	int limit_argv;         // position of a LIMIT value in xFilter's args and the variant parameter it's bound to, if any
+	int limit_param;
+	int offset_argv;
+	int offset_param;
+	int batch;              // argv[0] is a JSON array of parameter tuples to run the statement for in turn
+};
+
+// how the estimates for a plan were arrived at, so that they can be worked out again for a memoized plan
+// and keep up with the observed row counts and LIMIT values as fresh plans would
+struct statement_estimate {
+	int num_bound;
+	double tuples;      // invocations per xFilter call
+	double selectivity; // of the predicates pushed into the statement
+	int sorts;          // whether the variant sorts to consume the ORDER BY where the statement itself wouldn't
+	int limit;          // constraint holding a LIMIT pushed into the statement, or -1
+	int unique;         // whether the plan yields at most one row
+};
+
+// the outcome of planning for one shape of sqlite3_index_info: its constraints, ORDER BY, and columns used, serialized as key.
+// variants are never dropped and plans never change, so memoized plans stay valid for the life of the vtab
+struct statement_memo {
+	sqlite3_uint64 hash;
+	char* key;
+	int key_len;
+	int ret; // SQLITE_OK, or SQLITE_CONSTRAINT if no plan was possible
+	int idx_num;
+	int order_by_consumed;
+	int idx_flags;
+	struct statement_estimate estimate;
+	int num_constraints;
+	struct {
+		int argv_index;
+		unsigned char omit;
+		unsigned char in; // processed all at once
+	} usage[];
+};
+
+// parameters named <name>_gt, _ge, _lt, or _le take the value of range constraints on a hidden column <name>,
+// which is the column of a parameter of that name if there is one, or otherwise declared after the parameters
+// (unless an output already has that name, in which case column is negative).
+enum { STATEMENT_RANGE_GT, STATEMENT_RANGE_GE, STATEMENT_RANGE_LT, STATEMENT_RANGE_LE, STATEMENT_RANGE_OPS };
+struct statement_range {
+	char* name;
+	int column;
+	int params[STATEMENT_RANGE_OPS]; // 1-based parameter index for each kind of constraint, or 0
+};
+
+// counters reported by statement_vtab_stats. a connection is only used by one thread at a time so plain increments suffice
+#ifndef STATEMENT_VTAB_OMIT_STATS
+struct statement_stats {
+	sqlite3_int64 prepares;
+	sqlite3_int64 opens;
+	sqlite3_int64 filters;
+	sqlite3_int64 rows;
+	sqlite3_int64 step_ns;
+	sqlite3_int64 cache_hits;
+	sqlite3_int64 cache_misses;
+	// sqlite3_stmt_status counters, collected from inner statements when they're returned to the pool
+	sqlite3_int64 fullscan_steps;
+	sqlite3_int64 sorts;
+	sqlite3_int64 autoindexes;
+	sqlite3_int64 vm_steps;
+	// an invocation runs from xFilter until the cursor reaches EOF or is abandoned, and takes the time spent in xFilter and xNext
+	sqlite3_int64 latency_histogram[STATEMENT_VTAB_HISTOGRAM_BUCKETS];
+	sqlite3_int64 rows_histogram[STATEMENT_VTAB_HISTOGRAM_BUCKETS];
+	sqlite3_int64 num_slow; // invocations logged, the latest of which are kept round robin
+	struct {
+		sqlite3_int64 elapsed_ns;
+		sqlite3_int64 rows;
+		char* args;
+	} slow[STATEMENT_VTAB_SLOW_LOG_SIZE];
+	// invocations with bound parameters that built an automatic index or scanned a table in full, and the index
+	// recommended once either happens often enough (or NULL if none could be worked out)
+	sqlite3_int64 autoindex_invocations;
+	sqlite3_int64 fullscan_invocations;
+	int churned;
+	char* recommendation;
+	sqlite3_int64 over_budget; // invocations that ran out of a budget
+};
+#define STATEMENT_STAT(vtab,counter,n) ((vtab)->stats.counter += (n))
+
+static void statement_stats_clear(struct statement_stats* stats) {
+	for(int i = 0; i < STATEMENT_VTAB_SLOW_LOG_SIZE; i++)
+		sqlite3_free(stats->slow[i].args);
+	sqlite3_free(stats->recommendation);
+	memset(stats,0,sizeof(*stats));
+}
+#else
+#define STATEMENT_STAT(vtab,counter,n) ((void)0)
+#endif
+
+// statement vtabs on a connection, shared by the statement and statement_vtab_stats modules
+struct statement_registry {
+	struct statement_vtab* head;
+	// rows written to persistent caches, which aren't counted as changes the other vtabs' results could depend on
+	sqlite3_int64 persist_changes;
+	// registries are listed by connection while it has the statement module, so that statements registered
+	// through the C API can join them. each of those holds a reference, as modules are destroyed in no particular order
+	sqlite3* db;
+	struct statement_registry* next;
+	int refs;
+	struct statement_scalar* scalars;
+	// cursors with a max_steps or max_ms budget that are stepping their statements, innermost first. while there are any, the
+	// progress handler checking on them is installed, calling through to the one set by sqlite3_statementvtab_progress_handler
+	struct statement_cursor* budgeted;
+	int (*progress)(void*);
+	void* progress_arg;
+	int progress_ops;
+	int progress_count; // instructions since progress was last called
+	int budget_ops; // instructions between calls to the progress handler checking on budgets
+};
+
+// an SQL function defined by the scalar option. sqlite won't redefine or delete functions while statements are running
+// (as they are in xCreate, xConnect and xDestroy), so each name is defined once per connection, taking any number of
+// arguments, and outlives its vtabs. calls look up the vtab by name, connecting it if need be, and fail if there's none.
+// they run the vtab's statement themselves, as the vtab may be disconnected in the middle of a call (when a statement it
+// steps finds the schema changed)
+struct statement_scalar {
+	struct statement_registry* registry;
+	struct statement_scalar* next;
+	char* name;
+	sqlite3_stmt* stmt; // prepared for calls as they come
+	int busy;           // a call is using stmt, so a recursive one prepares its own
+	int stale;          // stmt is for a vtab that's gone, to be finalized once it's done
+	struct statement_vtab* vtab; // what stmt was prepared for, which counts the calls
+};
+
+// everything a cached result may depend on: the schema, commits from other connections, and writes from this one
+struct statement_generation {
+	sqlite3_int64 schema_version;
+	sqlite3_int64 data_version;
+	sqlite3_int64 total_changes;
+};
+
+// a fully materialized result set, num_rows*num_cols values in row major order
+struct statement_rows {
+	int num_cols;
+	sqlite3_int64 num_rows;
+	sqlite3_int64 alloc_rows;
+	sqlite3_value** values;
+	sqlite3_uint64 size;
+};
+
+struct statement_cache_entry {
+	struct statement_cache_entry* hash_next;
+	struct statement_cache_entry* lru_prev;
+	struct statement_cache_entry* lru_next;
+	sqlite3_uint64 hash;
+	int variant;
+	// entries evicted while a cursor is still replaying them are freed when the last such cursor lets go
+	int refs;
+	int evicted;
+	sqlite3_value** key;
+	struct statement_rows rows;
+};
+
+struct statement_cache {
+	sqlite3_uint64 limit;
+	sqlite3_uint64 size;
+	struct statement_generation generation;
+	size_t num_buckets;
+	size_t num_entries;
+	struct statement_cache_entry** buckets;
+	struct statement_cache_entry lru; // list sentinel, most recently used first
+};
+
+// results of a parameterless statement spooled by the materialize option, with hash indexes built on first use for outputs
+// looked up by equality. cursors hold references so that rebuilding after the data changes doesn't free rows they're reading
+struct statement_mat_index {
+	size_t num_buckets;
+	sqlite3_int64* heads;   // first row in each bucket, or -1
+	sqlite3_int64* next;    // next row in the same bucket, or -1
+	sqlite3_uint64* hashes; // of each row's value, with 0 for those that can't compare equal to anything
+};
+
+struct statement_materialized {
+	int refs;
+	int stale; // superseded by a rebuild, so freed when the last reference is released
+	struct statement_generation generation;
+	struct statement_rows rows;
+	struct statement_mat_index** indexes; // per output, NULL until first needed
+};
+
+#ifdef STATEMENT_VTAB_WORKERS
+// one binding of an invocation run to completion ahead of the cursor reaching it, along with the rows it produced
+struct statement_job {
+	sqlite3_value** params; // a value (or NULL) for each of the statement's own parameters
+	struct statement_rows rows;
+	int done;
+	int ret; // SQLITE_DONE, or the error it failed with
+	char* err;
+};
+
+struct statement_worker {
+	struct statement_workers* pool;
+	pthread_t thread;
+	sqlite3* db;
+	sqlite3_stmt* stmt;
+	sqlite3_uint64 seen; // the last dispatch looked at
+};
+
+// threads of the workers option, each with a connection of its own: to the vtab's database file at the caller's snapshot for statements
+// reading tables, or to an empty in-memory database for those that don't. the jobs of one cursor at a time are dispatched to them,
+// which they claim in order, so that the cursor can take whichever one it needs next itself rather than wait for a busy worker to get to it.
+// everything from owner on is guarded by mutex
+struct statement_workers {
+	pthread_mutex_t mutex;
+	pthread_cond_t work; // signalled when jobs are dispatched, or the workers are to exit
+	pthread_cond_t done; // signalled when a job completes or a worker leaves a dispatch
+	char* filename; // NULL for in-memory
+	int num_workers;
+	struct statement_cursor* owner;
+	int shutdown;
+	sqlite3_uint64 seq;
+	int open;      // whether workers may still join the dispatch and claim its jobs
+	int active;    // workers that joined it and have yet to leave
+	int responded; // workers that have either joined it or found they can't
+	const char* sql;
+	int num_params; // bound to each job's values
+	int num_cols;
+	int num_extra;  // values bound the same way for every job: predicates, limit and offset
+	int* extra_params;
+	sqlite3_value** extra_values;
+#ifdef STATEMENT_VTAB_SNAPSHOTS
+	sqlite3_snapshot* snapshot;
+#endif
+	struct statement_worker workers[];
+};
+#endif
 
 struct statement_vtab {
 	sqlite3_vtab base;
 	sqlite3* db;
+	struct statement_registry* registry;
+	struct statement_vtab* registry_prev;
+	struct statement_vtab* registry_next;
+	char* schema;
+	char* name;
 	char* sql;
 	size_t sql_len;
+	// the statement as written, where sql has other statement vtabs spliced into it, and the schema versions they were spliced from
+	char* written;
+	sqlite3_uint64 written_schemas;
 	int num_inputs;
 	int num_outputs;
+	unsigned char* output_typed; // whether each output has a declared type, and so the same affinity inside the statement as outside
+	int num_ranges;
+	int num_range_columns; // ranges without a parameter of their own name, which are declared as extra hidden columns
+	int batched; // whether the __batch and __batch_index columns follow them
+	struct statement_range* ranges;
+	sqlite3_stmt* generation_stmt;
+	int num_variants;
+	struct statement_variant** variants;
+	int num_constant_variants;
+	int num_plans;
+	struct statement_plan** plans;
+	int num_param_maps;
+	int** param_maps;
+	int next_memo;
+	struct statement_memo* memos[STATEMENT_VTAB_MEMO_SIZE];
+	int cache_set; // whether the cache option was given, overriding the default
+	sqlite3_uint64 cache_size;
+	struct statement_cache* cache;
+	int materialize;
+	struct statement_materialized* mat;
+	int persist;
+	int profile;
+	int scalar;
+	struct statement_scalar* function; // bound to the vtab by the scalar option
+	int latency;           // whether invocations are timed into the latency histogram, as they also are for slow
+	sqlite3_int64 slow_ns; // invocations taking at least this long are logged by the slow option, or -1
+	// limits on what each invocation may take (0 for none), and whether one running out ends early with a row flagged
+	// in the __truncated column rather than failing
+	sqlite3_int64 max_rows;
+	sqlite3_int64 max_steps;
+	sqlite3_int64 max_ns;
+	int truncate;
+	int truncated_column; // or -1
+	sqlite3_stmt* persist_lookup;
+	sqlite3_stmt* persist_insert;
+	sqlite3_stmt* persist_row; // selects its parameters, to turn stored values back into sqlite3_values
+	int workers;
+	int prefetch; // rows a worker may run ahead of the cursor, or 0
+#ifdef STATEMENT_VTAB_WORKERS
+	struct statement_workers* pool;
+#endif
+	double est_rows;
+	double rows_hint;   // rows per invocation given by the rows option in place of est_rows and what's observed, or -1
+	double filter_cost; // cost of an invocation on top of its rows
+	int unique_hint;    // the unique option, or -1
+	int unique;        // produces at most one row per invocation
+	int deterministic; // results depend on nothing but the parameters
+	struct {
+		double rows;
+		sqlite3_int64 count;
+	} observed[STATEMENT_VTAB_OBSERVED_BUCKETS];
+#ifndef STATEMENT_VTAB_OMIT_STATS
+	struct statement_stats stats;
+#endif
 };
 
 struct statement_cursor {
 	sqlite3_vtab_cursor base;
 	sqlite3_stmt* stmt;
+	struct statement_variant* variant;
 	int rowid;
 	int param_argc;
 	sqlite3_value** param_argv;
+	struct statement_cache_entry* replay;
+	sqlite3_int64 replay_row;
+	struct statement_materialized* mat;
+	struct statement_mat_index* mat_index;
+	sqlite3_int64 mat_row;
+	sqlite3_uint64 mat_hash;
+	int recording;
+	struct statement_rows recorded;
+	struct statement_generation recorded_generation;
+	int num_bound;
+	int observing;
+	// the budget of the invocation begun at budget_start_ns: the rows it produced, the VM steps its statement was at to begin with,
+	// and the budget it ran out of if it has
+	sqlite3_int64 budget_rows;
+	sqlite3_int64 budget_start_ns;
+	int budget_steps_base;
+	int budget_steps_stepping; // counted by the progress handler during a step, as the statement's own count is only updated once it returns
+	int budget_spent;
+	int truncated; // 1 on the row marking the invocation as cut short, 2 once past it
+	struct statement_cursor* budget_next;
+	sqlite3_int64 num_rows;
+	// IN lists processed all at once, copied out of the lists while filtering as they can only be iterated during xFilter
+	int num_in;
+	struct {
+		sqlite3_value** values;
+		int num_values;
+		int pos;
+		int param_idx;
+	} in_args[STATEMENT_VTAB_MAX_IN];
+	// while iterating a batch, values from the current tuple are owned by the cursor
+	int batching;
+	sqlite3_stmt* batch;
+	int batch_ret; // result of the last step of batch, which is left on the first value of the next tuple
+	sqlite3_int64 batch_index;
+#ifdef STATEMENT_VTAB_WORKERS
+	// with the workers option, bindings are all run to completion up front (on worker threads if there are enough of them)
+	// and the cursor replays their results in order. param_argv then points at the values of the job being replayed
+	struct statement_job* jobs;
+	int num_jobs;
+	int next_job; // first job not yet claimed by a worker or the cursor
+	int job;
+	sqlite3_int64 job_row;
+	struct statement_workers* dispatched;
+	// with the prefetch option, a single job's rows are passed over as they're produced through a ring buffer of prefetch rows,
+	// starting at ring_head. the worker fills the slots after the ring_count rows ready, and the cursor frees rows once past them
+	sqlite3_value** ring;
+	int ring_head;
+	int ring_count;
+	int prefetch_eof;
+#endif
+#ifndef STATEMENT_VTAB_OMIT_STATS
+	int timing; // the invocation begun by the last xFilter hasn't been counted yet
+	sqlite3_int64 elapsed_ns;
+	sqlite3_int64 produced;
+	char* slow_args; // its arguments written out for the slow log, if it's enabled
+#endif
+	sqlite3_value* param_buf[];
 };
 
-static char* build_create_statement(sqlite3_stmt* stmt) {
+// statements with parameters get the __batch and __batch_index columns, unless they'd clash with a column the statement already has
+static int statement_vtab_batchable(struct statement_vtab* vtab, sqlite3_stmt* stmt) {
+	static const char* const names[] = {"__batch","__batch_index"};
+	if(!vtab->num_inputs)
+		return 0;
+	for(size_t n = 0; n < sizeof(names)/sizeof(*names); n++) {
+		for(int i = 0; i < vtab->num_outputs; i++)
+			if(!sqlite3_stricmp(sqlite3_column_name(stmt,i),names[n]))
+				return 0;
+		for(int i = 0; i < vtab->num_inputs; i++)
+			if(sqlite3_bind_parameter_name(stmt,i+1) && !sqlite3_stricmp(sqlite3_bind_parameter_name(stmt,i+1)+1,names[n]))
+				return 0;
+		for(int i = 0; i < vtab->num_ranges; i++)
+			if(vtab->ranges[i].column >= vtab->num_outputs+vtab->num_inputs && !sqlite3_stricmp(vtab->ranges[i].name,names[n]))
+				return 0;
+	}
+	return 1;
+}
+
+static char* build_create_statement(struct statement_vtab* vtab, sqlite3_stmt* stmt) {
 	sqlite3_str* sql = sqlite3_str_new(NULL);
 	sqlite3_str_appendall(sql,"CREATE TABLE x( ");
 	for(int i = 0, nout = sqlite3_column_count(stmt); i < nout; i++) {
@@ -49,224 +578,4736 @@ static char* build_create_statement(sqlite3_stmt* stmt) {
 		else
 			sqlite3_str_appendf(sql,"'%d' hidden,",i+1);
 	}
+	for(int i = 0; i < vtab->num_ranges; i++)
+		if(vtab->ranges[i].column >= vtab->num_outputs+vtab->num_inputs)
+			sqlite3_str_appendf(sql,"%Q hidden,",vtab->ranges[i].name);
+	if((vtab->batched = statement_vtab_batchable(vtab,stmt)))
+		sqlite3_str_appendall(sql,"__batch hidden,__batch_index hidden,");
 	if(sqlite3_str_length(sql))
 		sqlite3_str_value(sql)[sqlite3_str_length(sql)-1] = ')';
 	return sqlite3_str_finish(sql);
 }
 
-static int statement_vtab_destroy(sqlite3_vtab* pVTab){
-	sqlite3_free(((struct statement_vtab*)pVTab)->sql);
-	sqlite3_free(pVTab);
+// group parameters named with a range suffix by the name of the column they constrain
+static int statement_vtab_find_ranges(struct statement_vtab* vtab, sqlite3_stmt* stmt) {
+	static const char suffixes[STATEMENT_RANGE_OPS][4] = {"_gt","_ge","_lt","_le"};
+	for(int i = 0; i < vtab->num_inputs; i++) {
+		const char* name = sqlite3_bind_parameter_name(stmt,i+1);
+		if(!name)
+			continue;
+		name++; // skip the :, @, or $
+		size_t len = strlen(name);
+		int op = 0;
+		while(op < STATEMENT_RANGE_OPS && (len <= 3 || sqlite3_stricmp(name+len-3,suffixes[op])))
+			op++;
+		if(op == STATEMENT_RANGE_OPS)
+			continue;
+		len -= 3;
+
+		int r = 0;
+		while(r < vtab->num_ranges && (strlen(vtab->ranges[r].name) != len || sqlite3_strnicmp(vtab->ranges[r].name,name,len)))
+			r++;
+		if(r == vtab->num_ranges) {
+			struct statement_range* ranges = sqlite3_realloc64(vtab->ranges,sizeof(*ranges)*(vtab->num_ranges+1));
+			if(!ranges)
+				return SQLITE_NOMEM;
+			vtab->ranges = ranges;
+			memset(&ranges[r],0,sizeof(*ranges));
+			if(!(ranges[r].name = sqlite3_mprintf("%.*s",(int)len,name)))
+				return SQLITE_NOMEM;
+			vtab->num_ranges++;
+			ranges[r].column = -1;
+			for(int j = 0; j < vtab->num_inputs; j++) {
+				const char* param = sqlite3_bind_parameter_name(stmt,j+1);
+				if(param && !sqlite3_stricmp(param+1,ranges[r].name))
+					ranges[r].column = vtab->num_outputs+j;
+			}
+			// an output of the same name can have range constraints pushed into the statement as predicates instead
+			for(int j = 0; j < vtab->num_outputs && ranges[r].column < 0; j++)
+				if(!sqlite3_stricmp(sqlite3_column_name(stmt,j),ranges[r].name))
+					ranges[r].column = -2;
+			if(ranges[r].column == -1)
+				ranges[r].column = vtab->num_outputs+vtab->num_inputs+vtab->num_range_columns++;
+		}
+		if(!vtab->ranges[r].params[op])
+			vtab->ranges[r].params[op] = i+1;
+	}
 	return SQLITE_OK;
 }
 
-static int statement_vtab_create(sqlite3* db, void* pAux, int argc, const char* const* argv, sqlite3_vtab** ppVtab, char** pzErr) {
-	size_t len;
-	if(argc < 4 || (len = strlen(argv[3])) < 3) {
-		if(!(*pzErr = sqlite3_mprintf("no statement provided")))
-			return SQLITE_NOMEM;
-		return SQLITE_MISUSE;
-	}
-	if(argv[3][0] != '(' || argv[3][len-1] != ')') {
-		if(!(*pzErr = sqlite3_mprintf("statement must be parenthesized")))
-			return SQLITE_NOMEM;
-		return SQLITE_MISUSE;
-	}
+// estimate rows per invocation of the statement from its query plan, as
+// the product of the rows visited by each loop of a join and the sum over the arms of a compound select
+struct statement_eqp_node {
+	int id;
+	int parent;
+	char* detail;
+};
 
-	int ret;
-	sqlite3_stmt* stmt = NULL;
-	char* create = NULL;
+// returns the number of rows (or index entries with eq_terms equality constraints) from sqlite_stat1, or -1 if unavailable
+static double statement_stat1_rows(sqlite3* db, const char* column, const char* name, size_t namelen, int eq_terms) {
+	sqlite3_stmt* stmt;
+	char* sql = sqlite3_mprintf("SELECT stat FROM sqlite_stat1 WHERE %s = ?1 ORDER BY idx IS NOT NULL",column);
+	if(!sql)
+		return -1;
+	int ret = sqlite3_prepare_v2(db,sql,-1,&stmt,NULL);
+	sqlite3_free(sql);
+	if(ret != SQLITE_OK)
+		return -1;
 
-	struct statement_vtab* vtab = sqlite3_malloc64(sizeof(*vtab));
-	if(!vtab)
-		return SQLITE_NOMEM;
-	memset(vtab,0,sizeof(*vtab));
-	*ppVtab = &vtab->base;
+	double rows = -1;
+	sqlite3_bind_text(stmt,1,name,namelen,SQLITE_STATIC);
+	const char* stat;
+	if(sqlite3_step(stmt) == SQLITE_ROW && (stat = (const char*)sqlite3_column_text(stmt,0)))
+		for(int i = 0; isdigit((unsigned char)*stat) && i <= eq_terms; i++) {
+			rows = strtod(stat,(char**)&stat);
+			while(*stat == ' ')
+				stat++;
+		}
+	sqlite3_finalize(stmt);
+	return rows;
+}
 
-	vtab->db = db;
-	vtab->sql_len = len-2;
-	if(!(vtab->sql = sqlite3_mprintf("%.*s",vtab->sql_len,argv[3]+1))) {
-		ret = SQLITE_NOMEM;
-		goto error;
+static double statement_eqp_rows(sqlite3* db, struct statement_eqp_node* nodes, int num_nodes, int parent);
+
+static double statement_eqp_loop_rows(sqlite3* db, struct statement_eqp_node* nodes, int num_nodes, const char* detail) {
+	int search = !strncmp(detail,"SEARCH ",7);
+	detail += search ? 7 : 5;
+	if(!strncmp(detail,"TABLE ",6)) // format prior to 3.36
+		detail += 6;
+	if(!strcmp(detail,"CONSTANT ROW"))
+		return 1;
+
+	size_t namelen = strcspn(detail," ");
+	// scans of subqueries and CTEs are estimated from their own plans
+	for(int i = 0; i < num_nodes; i++) {
+		const char* sub = nodes[i].detail;
+		if(!strncmp(sub,"CO-ROUTINE ",11))
+			sub += 11;
+		else if(!strncmp(sub,"MATERIALIZE ",12))
+			sub += 12;
+		else
+			continue;
+		if(!strncmp(sub,detail,namelen) && (!sub[namelen] || sub[namelen] == ' '))
+			return statement_eqp_rows(db,nodes,num_nodes,nodes[i].id);
 	}
+	if(strstr(detail," VIRTUAL TABLE "))
+		return STATEMENT_VTAB_DEFAULT_TABLE_ROWS;
 
-	if((ret = sqlite3_prepare_v2(db,vtab->sql,vtab->sql_len,&stmt,NULL)) != SQLITE_OK)
-		goto sqlite_error;
-	if(!sqlite3_stmt_readonly(stmt)) {
-		ret = SQLITE_ERROR;
-		if(!(*pzErr = sqlite3_mprintf("Statement must be read only.")))
-			ret = SQLITE_NOMEM;
-		goto error;
+	double table_rows = statement_stat1_rows(db,"tbl",detail,namelen,0);
+	if(table_rows < 0)
+		table_rows = STATEMENT_VTAB_DEFAULT_TABLE_ROWS;
+	if(!search)
+		return table_rows;
+
+	const char* terms = strchr(detail,'(');
+	int eq_terms = 0, range = 0;
+	for(const char* c = terms; c && *c; c++) {
+		if(*c == '=' && c[-1] != '<' && c[-1] != '>')
+			eq_terms++;
+		else if(*c == '<' || *c == '>')
+			range = 1;
+	}
+	double rows = -1;
+	if(strstr(detail," USING INTEGER PRIMARY KEY ") || strstr(detail," USING PRIMARY KEY "))
+		rows = eq_terms ? 1 : table_rows;
+	else {
+		const char* idx = strstr(detail,"INDEX ");
+		if(idx && !strstr(detail," AUTOMATIC ")) {
+			idx += 6;
+			rows = statement_stat1_rows(db,"idx",idx,strcspn(idx," "),eq_terms);
+		}
+		if(rows < 0)
+			rows = eq_terms ? STATEMENT_VTAB_DEFAULT_EQ_ROWS : table_rows;
 	}
+	// sqlite assumes a range constraint reduces the search space by a factor of 4
+	return range ? rows/4 : rows;
+}
 
-	vtab->num_inputs = sqlite3_bind_parameter_count(stmt);
-	vtab->num_outputs = sqlite3_column_count(stmt);
+static double statement_eqp_rows(sqlite3* db, struct statement_eqp_node* nodes, int num_nodes, int parent) {
+	double rows = 1;
+	for(int i = 0; i < num_nodes; i++) {
+		if(nodes[i].parent != parent)
+			continue;
+		const char* detail = nodes[i].detail;
+		if(!strncmp(detail,"SCAN ",5) || !strncmp(detail,"SEARCH ",7))
+			rows *= statement_eqp_loop_rows(db,nodes,num_nodes,detail);
+		else if(!strcmp(detail,"COMPOUND QUERY")) {
+			double sum = 0;
+			for(int j = 0; j < num_nodes; j++)
+				if(nodes[j].parent == nodes[i].id)
+					sum += statement_eqp_rows(db,nodes,num_nodes,nodes[j].id);
+			rows *= sum;
+		}
+	}
+	return rows < 1 ? 1 : rows;
+}
 
-	if(!(create = build_create_statement(stmt))) {
-		ret = SQLITE_NOMEM;
-		goto error;
+static double statement_vtab_estimate_rows(sqlite3* db, const char* sql) {
+	double rows = 1;
+	sqlite3_stmt* stmt = NULL;
+	struct statement_eqp_node* nodes = NULL;
+	int num_nodes = 0;
+	char* explain = sqlite3_mprintf("EXPLAIN QUERY PLAN %s",sql);
+	if(!explain || sqlite3_prepare_v2(db,explain,-1,&stmt,NULL) != SQLITE_OK)
+		goto end;
+	while(sqlite3_step(stmt) == SQLITE_ROW) {
+		struct statement_eqp_node* n = sqlite3_realloc64(nodes,sizeof(*nodes)*(num_nodes+1));
+		if(!n)
+			goto end;
+		nodes = n;
+		nodes[num_nodes].id = sqlite3_column_int(stmt,0);
+		nodes[num_nodes].parent = sqlite3_column_int(stmt,1);
+		if(!(nodes[num_nodes].detail = sqlite3_mprintf("%s",sqlite3_column_text(stmt,3))))
+			goto end;
+		num_nodes++;
 	}
-	if((ret = sqlite3_declare_vtab(db,create)) != SQLITE_OK)
-		goto sqlite_error;
+	rows = statement_eqp_rows(db,nodes,num_nodes,0);
 
-	sqlite3_free(create);
+end:
+	for(int i = 0; i < num_nodes; i++)
+		sqlite3_free(nodes[i].detail);
+	sqlite3_free(nodes);
 	sqlite3_finalize(stmt);
-	return SQLITE_OK;
+	sqlite3_free(explain);
+	return rows;
+}
 
-sqlite_error:
-	if(!(*pzErr = sqlite3_mprintf("%s",sqlite3_errmsg(db))))
-		ret = SQLITE_NOMEM;
-error:
-	sqlite3_free(create);
-	sqlite3_finalize(stmt);
-	statement_vtab_destroy(*ppVtab);
-	*ppVtab = NULL;
-	return ret;
+// data_version only reflects commits made by other connections, so writes on this one are tracked by total_changes
+static int statement_vtab_generation(struct statement_vtab* vtab, struct statement_generation* generation) {
+	int ret;
+	if(!vtab->generation_stmt &&
+	   (ret = sqlite3_prepare_v3(vtab->db,"SELECT schema_version, data_version FROM pragma_schema_version, pragma_data_version",-1,
+	                             SQLITE_PREPARE_PERSISTENT,&vtab->generation_stmt,NULL)) != SQLITE_OK)
+		return ret;
+	if((ret = sqlite3_step(vtab->generation_stmt)) == SQLITE_ROW) {
+		generation->schema_version = sqlite3_column_int64(vtab->generation_stmt,0);
+		generation->data_version = sqlite3_column_int64(vtab->generation_stmt,1);
+		generation->total_changes = sqlite3_total_changes(vtab->db) - vtab->registry->persist_changes;
+		ret = SQLITE_OK;
+	}
+	sqlite3_reset(vtab->generation_stmt);
+	return ret == SQLITE_DONE ? SQLITE_ERROR : ret;
 }
 
-// if these point to the literal same function sqlite makes statement_vtab eponymous, which we don't want
-static int statement_vtab_connect(sqlite3* db, void* pAux, int argc, const char* const* argv, sqlite3_vtab** ppVtab, char** pzErr) {
-	return statement_vtab_create(db,pAux,argc,argv,ppVtab,pzErr);
+// hash the schema versions of every database on the connection, which changes with any of their schemas.
+// databases without a schema (such as temp until it's used) are left out, so that opening one doesn't change the hash
+static int statement_schema_versions(sqlite3* db, sqlite3_uint64* hash) {
+	sqlite3_stmt* list;
+	int ret = sqlite3_prepare_v2(db,"SELECT name FROM pragma_database_list",-1,&list,NULL);
+	*hash = 0;
+	if(ret != SQLITE_OK)
+		return ret;
+	while((ret = sqlite3_step(list)) == SQLITE_ROW) {
+		const unsigned char* name = sqlite3_column_text(list,0);
+		sqlite3_stmt* stmt;
+		char* sql = name ? sqlite3_mprintf("PRAGMA \"%w\".schema_version",(const char*)name) : NULL;
+		if(!sql) {
+			ret = SQLITE_NOMEM;
+			break;
+		}
+		ret = sqlite3_prepare_v2(db,sql,-1,&stmt,NULL);
+		sqlite3_free(sql);
+		if(ret != SQLITE_OK)
+			break;
+		sqlite3_int64 version = (ret = sqlite3_step(stmt)) == SQLITE_ROW ? sqlite3_column_int64(stmt,0) : 0;
+		sqlite3_finalize(stmt);
+		if(ret != SQLITE_ROW && ret != SQLITE_DONE)
+			break;
+		// summed so that the order databases are listed in doesn't matter
+		sqlite3_uint64 row = 0xcbf29ce484222325ull;
+		for(; *name; name++)
+			row = (row ^ *name) * 0x100000001b3ull;
+		if(version)
+			*hash += (row ^ (sqlite3_uint64)version) * 0x100000001b3ull;
+	}
+	sqlite3_finalize(list);
+	return ret == SQLITE_DONE ? SQLITE_OK : ret;
 }
 
-static int statement_vtab_open(sqlite3_vtab* pVTab, sqlite3_vtab_cursor** ppCursor) {
-	struct statement_vtab* vtab = (struct statement_vtab*)pVTab;
-	struct statement_cursor* cur = sqlite3_malloc64(sizeof(*cur));
-	if(!cur)
-		return SQLITE_NOMEM;
+static sqlite3_int64 statement_clock_ns(void) {
+#ifdef _WIN32
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (sqlite3_int64)((double)count.QuadPart * 1e9 / freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (sqlite3_int64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
 
-	*ppCursor = &cur->base;
-	cur->stmt = NULL;
-	cur->param_argv = NULL;
-	if(vtab->num_inputs && !(cur->param_argv = sqlite3_malloc64(sizeof(*cur->param_argv)*vtab->num_inputs)))
-		return SQLITE_NOMEM;
+static int statement_step(struct statement_vtab* vtab, sqlite3_stmt* stmt) {
+#ifndef STATEMENT_VTAB_OMIT_STATS
+	sqlite3_int64 start = statement_clock_ns();
+	int ret = sqlite3_step(stmt);
+	STATEMENT_STAT(vtab,step_ns,statement_clock_ns() - start);
+	return ret;
+#else
+	return sqlite3_step(stmt);
+#endif
+}
 
-	return sqlite3_prepare_v2(vtab->db,vtab->sql,vtab->sql_len,&cur->stmt,NULL);
+#ifdef STATEMENT_VTAB_SCANSTATUS
+// add the loops a variant's statement ran to its profile. a loop that can't be recorded for want of memory is left out
+static void statement_profile_collect(struct statement_variant* variant, sqlite3_stmt* stmt) {
+	for(int i = 0;; i++) {
+		sqlite3_int64 loops, rows, cycles = -1;
+		const char* detail;
+		if(sqlite3_stmt_scanstatus(stmt,i,SQLITE_SCANSTAT_NLOOP,&loops) ||
+		   sqlite3_stmt_scanstatus(stmt,i,SQLITE_SCANSTAT_NVISIT,&rows) ||
+		   sqlite3_stmt_scanstatus(stmt,i,SQLITE_SCANSTAT_EXPLAIN,(void*)&detail))
+			break;
+#if SQLITE_VERSION_NUMBER >= 3042000
+		if(sqlite3_stmt_scanstatus_v2(stmt,i,SQLITE_SCANSTAT_NCYCLE,0,&cycles))
+			cycles = -1;
+#endif
+		if(!detail || (!loops && !rows))
+			continue;
+		int p = 0;
+		while(p < variant->num_profiled && strcmp(variant->profiled[p].detail,detail))
+			p++;
+		if(p == variant->num_profiled) {
+			struct statement_profile* profiled = sqlite3_realloc64(variant->profiled,sizeof(*profiled)*(p+1));
+			if(!profiled)
+				break;
+			variant->profiled = profiled;
+			memset(&profiled[p],0,sizeof(*profiled));
+			if(!(profiled[p].detail = sqlite3_mprintf("%s",detail)))
+				break;
+			variant->num_profiled++;
+		}
+		variant->profiled[p].loops += loops;
+		variant->profiled[p].rows += rows;
+		variant->profiled[p].cycles = cycles < 0 ? -1 : variant->profiled[p].cycles + cycles;
+	}
+	sqlite3_stmt_scanstatus_reset(stmt);
 }
+#endif
 
-static int statement_vtab_close(sqlite3_vtab_cursor* cur){
-	struct statement_cursor* stmtcur = (struct statement_cursor*)cur;
-	sqlite3_finalize(stmtcur->stmt);
-	sqlite3_free(stmtcur->param_argv);
-	sqlite3_free(cur);
-	return SQLITE_OK;
+#ifndef STATEMENT_VTAB_OMIT_STATS
+// an instruction of a statement's bytecode, as much of it as recommending an index looks at
+struct statement_op {
+	char opcode[16];
+	int p1, p2, p3;
+	int p4;    // as an integer, such as the number of key fields a seek compares
+	int keyed; // p4 is a KeyInfo, so an OpenRead is on an index rather than a table
+};
+
+// the column of cursor a value in reg was last read from before op i, or -1
+static int statement_op_column(const struct statement_op* ops, int i, int reg, int cursor) {
+	while(--i >= 0)
+		if(!strcmp(ops[i].opcode,"Column") && ops[i].p3 == reg)
+			return ops[i].p1 == cursor ? ops[i].p2 : -1;
+	return -1;
 }
 
-static int statement_vtab_next(sqlite3_vtab_cursor* cur){
-	struct statement_cursor* stmtcur = (struct statement_cursor*)cur;
-	int ret = sqlite3_step(stmtcur->stmt);
-	if(ret == SQLITE_ROW) {
-		stmtcur->rowid++;
-		return SQLITE_OK;
+// whether reg holds a parameter or a literal, such as a constant argument written into a variant
+static int statement_op_constant(const struct statement_op* ops, int num_ops, int reg) {
+	for(int i = 0; i < num_ops; i++) {
+		const char* op = ops[i].opcode;
+		if(ops[i].p2 == reg && (!strcmp(op,"Variable") || !strcmp(op,"Integer") || !strcmp(op,"Int64") || !strcmp(op,"Real") ||
+		                        !strcmp(op,"String8") || !strcmp(op,"String")))
+			return 1;
 	}
-	return ret == SQLITE_DONE ? SQLITE_OK : ret;
+	return 0;
 }
 
-static int statement_vtab_rowid(sqlite3_vtab_cursor* cur, sqlite_int64* pRowid) {
-	*pRowid = ((struct statement_cursor*)cur)->rowid;
-	return SQLITE_OK;
+// copy out the text in the first row of a lookup, then reset it
+static char* statement_lookup_text(sqlite3_stmt* stmt) {
+	char* text = NULL;
+	if(sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt,0))
+		text = sqlite3_mprintf("%s",sqlite3_column_text(stmt,0));
+	sqlite3_reset(stmt);
+	return text;
 }
 
-static int statement_vtab_eof(sqlite3_vtab_cursor* cur) {
-	return !sqlite3_stmt_busy(((struct statement_cursor*)cur)->stmt);
-}
+// work out an index for the table an invocation builds an automatic index on, or otherwise scans in full, from the statement's bytecode.
+// an automatic index is keyed on the leading columns copied into it, as many as its seeks compare, and a scanned table is indexed on
+// the columns it compares to parameters or literals, equalities ahead of a range. the CREATE INDEX statement is returned, or NULL if there's none
+static char* statement_index_recommend(sqlite3* db, const char* sql, int autoindex) {
+	struct statement_op* ops = NULL;
+	int num_ops = 0, cursor = -1, num_columns = 0;
+	int columns[16];
+	char* schema = NULL;
+	char* table = NULL;
+	char* recommendation = NULL;
+	sqlite3_stmt* stmt = NULL;
+	sqlite3_stmt* lookup = NULL;
+	sqlite3_str* str = NULL;
 
-static int statement_vtab_column(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int i) {
-	struct statement_cursor* stmtcur = (struct statement_cursor*)cur;
-	struct statement_vtab* vtab = (struct statement_vtab*)cur->pVtab;
-	int num_outputs = vtab->num_outputs;
-	int num_inputs = vtab->num_inputs;
+	char* explain = sqlite3_mprintf("EXPLAIN %s",sql);
+	if(!explain || sqlite3_prepare_v2(db,explain,-1,&stmt,NULL) != SQLITE_OK)
+		goto done;
+	while(sqlite3_step(stmt) == SQLITE_ROW) {
+		struct statement_op* grown = sqlite3_realloc64(ops,sizeof(*ops)*(num_ops+1));
+		if(!grown)
+			goto done;
+		ops = grown;
+		struct statement_op* op = &ops[num_ops++];
+		const char* p4 = (const char*)sqlite3_column_text(stmt,5);
+		sqlite3_snprintf(sizeof(op->opcode),op->opcode,"%s",sqlite3_column_text(stmt,1));
+		op->p1 = sqlite3_column_int(stmt,2);
+		op->p2 = sqlite3_column_int(stmt,3);
+		op->p3 = sqlite3_column_int(stmt,4);
+		op->p4 = sqlite3_column_int(stmt,5);
+		op->keyed = p4 && !strncmp(p4,"k(",2);
+	}
 
-	sqlite3_value* v;
-	if(i < num_outputs) // a result from the statement
-		v = sqlite3_column_value(stmtcur->stmt,i);
-	else if(i-num_outputs < num_inputs) // one of the input parameters
-		v = stmtcur->param_argv[i-num_outputs];
-	else
-		return SQLITE_RANGE;
+	if(autoindex) {
+		for(int i = 0; i < num_ops && cursor < 0; i++) {
+			if(strcmp(ops[i].opcode,"OpenAutoindex"))
+				continue;
+			// the index is filled by a loop over the table, reading the columns into a record
+			int j = i;
+			while(j < num_ops && strcmp(ops[j].opcode,"Rewind"))
+				j++;
+			if(j == num_ops)
+				break;
+			cursor = ops[j].p1;
+			for(; j < num_ops && strcmp(ops[j].opcode,"MakeRecord"); j++)
+				if(!strcmp(ops[j].opcode,"Column") && ops[j].p1 == cursor && num_columns < (int)(sizeof(columns)/sizeof(*columns)))
+					columns[num_columns++] = ops[j].p2;
+			int keys = 0;
+			for(j = 0; j < num_ops; j++)
+				if(ops[j].p1 == ops[i].p1 && !strncmp(ops[j].opcode,"Seek",4) && ops[j].p4 > keys)
+					keys = ops[j].p4;
+			if(keys && keys < num_columns)
+				num_columns = keys;
+		}
+	} else {
+		// the loop filling an automatic index isn't what's scanning in full
+		int filling = 0;
+		for(int i = 0; i < num_ops && !num_columns; i++) {
+			if(!strcmp(ops[i].opcode,"OpenAutoindex"))
+				filling = 1;
+			if(strcmp(ops[i].opcode,"Rewind") && strcmp(ops[i].opcode,"Last"))
+				continue;
+			if(filling) {
+				filling = 0;
+				continue;
+			}
+			cursor = ops[i].p1;
+			int range = -1;
+			for(int j = i; j < num_ops; j++) {
+				const char* op = ops[j].opcode;
+				int eq = !strcmp(op,"Eq") || !strcmp(op,"Ne");
+				if(!eq && strcmp(op,"Lt") && strcmp(op,"Le") && strcmp(op,"Gt") && strcmp(op,"Ge"))
+					continue;
+				int column = statement_op_column(ops,j,ops[j].p3,cursor);
+				if(column >= 0 ? !statement_op_constant(ops,num_ops,ops[j].p1)
+				               : (column = statement_op_column(ops,j,ops[j].p1,cursor)) < 0 || !statement_op_constant(ops,num_ops,ops[j].p3))
+					continue;
+				if(!eq) {
+					if(range < 0)
+						range = column;
+					continue;
+				}
+				int seen = 0;
+				for(int k = 0; k < num_columns; k++)
+					seen |= columns[k] == column;
+				if(!seen && num_columns < (int)(sizeof(columns)/sizeof(*columns)) - 1)
+					columns[num_columns++] = column;
+			}
+			if(range >= 0)
+				columns[num_columns++] = range;
+		}
+	}
+	if(!num_columns)
+		goto done;
 
-	if(v)
-		sqlite3_result_value(ctx,v);
+	// the table is the one the cursor was opened on, by root page within the attached database
+	int open = -1;
+	for(int i = 0; i < num_ops; i++)
+		if(!strcmp(ops[i].opcode,"OpenRead") && ops[i].p1 == cursor)
+			open = i;
+	if(open < 0 || ops[open].keyed)
+		goto done;
+	if(sqlite3_prepare_v2(db,"SELECT name FROM pragma_database_list WHERE seq = ?1",-1,&lookup,NULL) != SQLITE_OK)
+		goto done;
+	sqlite3_bind_int(lookup,1,ops[open].p3);
+	schema = statement_lookup_text(lookup);
+	sqlite3_finalize(lookup);
+	char* find = schema ? sqlite3_mprintf("SELECT name FROM \"%w\".sqlite_master WHERE type = 'table' AND rootpage = ?1",schema) : NULL;
+	lookup = NULL;
+	if(!find || sqlite3_prepare_v2(db,find,-1,&lookup,NULL) != SQLITE_OK) {
+		sqlite3_free(find);
+		goto done;
+	}
+	sqlite3_free(find);
+	sqlite3_bind_int(lookup,1,ops[open].p2);
+	if(!(table = statement_lookup_text(lookup)))
+		goto done;
+	sqlite3_finalize(lookup);
+	if(sqlite3_prepare_v2(db,"SELECT name FROM pragma_table_info(?1,?2) WHERE cid = ?3",-1,&lookup,NULL) != SQLITE_OK)
+		goto done;
+	sqlite3_bind_text(lookup,1,table,-1,SQLITE_STATIC);
+	sqlite3_bind_text(lookup,2,schema,-1,SQLITE_STATIC);
 
-	return SQLITE_OK;
+	// named after the table and its columns, e.g. CREATE INDEX "events_kind_at" ON "events"("kind", "at")
+	str = sqlite3_str_new(db);
+	sqlite3_str* name = sqlite3_str_new(db);
+	sqlite3_str_appendf(name,"%s",table);
+	sqlite3_str_appendf(str," ON \"%w\"(",table);
+	for(int i = 0; i < num_columns; i++) {
+		sqlite3_bind_int(lookup,3,columns[i]);
+		char* column = statement_lookup_text(lookup);
+		if(!column) {
+			sqlite3_free(sqlite3_str_finish(name));
+			goto done;
+		}
+		sqlite3_str_appendf(name,"_%s",column);
+		sqlite3_str_appendf(str,"%s\"%w\"",i ? ", " : "",column);
+		sqlite3_free(column);
+	}
+	sqlite3_str_appendall(str,")");
+	char* index = sqlite3_str_finish(name);
+	char* on = sqlite3_str_finish(str);
+	str = NULL;
+	if(index && on)
+		recommendation = strcmp(schema,"main") ? sqlite3_mprintf("CREATE INDEX \"%w\".\"%w\"%s",schema,index,on)
+		                                       : sqlite3_mprintf("CREATE INDEX \"%w\"%s",index,on);
+	sqlite3_free(index);
+	sqlite3_free(on);
+
+done:
+	sqlite3_free(sqlite3_str_finish(str));
+	sqlite3_finalize(lookup);
+	sqlite3_finalize(stmt);
+	sqlite3_free(explain);
+	sqlite3_free(table);
+	sqlite3_free(schema);
+	sqlite3_free(ops);
+	return recommendation;
 }
 
-// parameter map encoding for xBestIndex/xFilter
-// constraint -> param index mappings are stored in idxStr when not contiguous. idxStr is expected to be NUL terminated
-// and printable, so we use a 6 bit encoding in the ASCII range.
-// for simplicity encoded indexes are fixed to the length necessary to encode an int. this is overkill on most systems
-// due to sqlite's current hard limit on number of columns but makes statement_vtab agnostic to changes to this limit
-const static size_t param_idx_size = (sizeof(int)*CHAR_BIT+5)/6;
+// warn once a vtab has built automatic indexes or scanned in full often enough, working out the index it's missing
+static void statement_churn_check(struct statement_vtab* vtab, struct statement_variant* variant, int autoindex) {
+	struct statement_stats* stats = &vtab->stats;
+	sqlite3_int64 invocations = autoindex ? stats->autoindex_invocations : stats->fullscan_invocations;
+	if(stats->churned || invocations < STATEMENT_VTAB_CHURN_INVOCATIONS)
+		return;
+	stats->churned = 1;
+	stats->recommendation = statement_index_recommend(vtab->db,variant->sql,autoindex);
+	sqlite3_log(SQLITE_WARNING,"statement vtab %s %s in %lld invocations%s%s",vtab->name,
+	            autoindex ? "built an automatic index" : "scanned a table in full",invocations,
+	            stats->recommendation ? ", consider " : "",stats->recommendation ? stats->recommendation : "");
+}
+#endif
 
-static inline void encode_param_idx(int i, char* restrict param_map, int param_idx) {
-	assert(param_idx >= 0);
-	for(size_t j = 0; j < param_idx_size; j++)
-		param_map[i*param_idx_size+j] = ((param_idx >> 6*j) & 63) + 33;
+// fold an inner statement's counters into the vtab's, resetting them so they're only counted once
+static void statement_stats_collect(struct statement_vtab* vtab, struct statement_variant* variant, sqlite3_stmt* stmt) {
+#ifdef STATEMENT_VTAB_SCANSTATUS
+	if(vtab->profile)
+		statement_profile_collect(variant,stmt);
+#endif
+#ifndef STATEMENT_VTAB_OMIT_STATS
+	int fullscan_steps = sqlite3_stmt_status(stmt,SQLITE_STMTSTATUS_FULLSCAN_STEP,1);
+	int autoindexes = sqlite3_stmt_status(stmt,SQLITE_STMTSTATUS_AUTOINDEX,1);
+	STATEMENT_STAT(vtab,fullscan_steps,fullscan_steps);
+	STATEMENT_STAT(vtab,sorts,sqlite3_stmt_status(stmt,SQLITE_STMTSTATUS_SORT,1));
+	STATEMENT_STAT(vtab,autoindexes,autoindexes);
+	STATEMENT_STAT(vtab,vm_steps,sqlite3_stmt_status(stmt,SQLITE_STMTSTATUS_VM_STEP,1));
+	// building the automatic index scans the table as well, so that's what an invocation doing both is counted as
+	if(sqlite3_bind_parameter_count(stmt) && (autoindexes || fullscan_steps >= STATEMENT_VTAB_CHURN_SCAN_STEPS)) {
+		if(autoindexes)
+			STATEMENT_STAT(vtab,autoindex_invocations,1);
+		else
+			STATEMENT_STAT(vtab,fullscan_invocations,1);
+		statement_churn_check(vtab,variant,autoindexes);
+	}
+#endif
 }
 
-static inline int decode_param_idx(int i, const char* param_map) {
-	int param_idx = 0;
-	for(size_t j = 0; j < param_idx_size; j++)
-		param_idx |= (param_map[i*param_idx_size+j] - 33) << 6*j;
-	return param_idx;
+// cursors check statements out of a small per-variant pool rather than preparing their own in every xFilter,
+// which dominates when sqlite repeatedly opens cursors on the inner loop of a join. handles prepared against an older
+// schema are recompiled by sqlite on their next step, so are reused as they are
+static void statement_pool_clear(struct statement_vtab* vtab) {
+	for(int i = 0; i < vtab->num_variants; i++) {
+		struct statement_variant* variant = vtab->variants[i];
+		while(variant->pool_size) {
+			sqlite3_stmt* stmt = variant->pool[--variant->pool_size];
+			statement_stats_collect(vtab,variant,stmt);
+			sqlite3_finalize(stmt);
+		}
+	}
 }
 
-// xBestIndex needs to communicate which columns are constrained by the where clause to xFilter;
-// in terms of a statement table this translates to which parameters will be available to bind.
-static int statement_vtab_filter(sqlite3_vtab_cursor* cur, int idxNum, const char* idxStr, int argc, sqlite3_value** argv) {
-	struct statement_cursor* stmtcur = (struct statement_cursor*)cur;
-	struct statement_vtab* vtab = (struct statement_vtab*)cur->pVtab;
+static int statement_pool_checkout(struct statement_vtab* vtab, struct statement_variant* variant, sqlite3_stmt** stmt) {
+	if(variant->pool_size) {
+		*stmt = variant->pool[--variant->pool_size];
+		return SQLITE_OK;
+	}
+	STATEMENT_STAT(vtab,prepares,1);
+	return sqlite3_prepare_v3(vtab->db,variant->sql,-1,SQLITE_PREPARE_PERSISTENT,stmt,NULL);
+}
 
-	stmtcur->rowid = 1;
-	sqlite3_stmt* stmt = stmtcur->stmt;
+static void statement_pool_return(struct statement_vtab* vtab, struct statement_variant* variant, sqlite3_stmt* stmt) {
+	if(!stmt)
+		return;
+	statement_stats_collect(vtab,variant,stmt);
+	if(variant->pool_size == STATEMENT_VTAB_POOL_SIZE) {
+		sqlite3_finalize(stmt);
+		return;
+	}
 	sqlite3_reset(stmt);
 	sqlite3_clear_bindings(stmt);
-	if(vtab->num_inputs)
-		memset(stmtcur->param_argv,0,sizeof(*stmtcur->param_argv)*vtab->num_inputs);
+	variant->pool[variant->pool_size++] = stmt;
+}
+
+// count the sorters and ephemeral tables the statement's bytecode opens, to tell whether a variant adds to the work of the statement as written
+static int statement_sort_count(sqlite3* db, const char* sql) {
+	sqlite3_stmt* stmt;
+	char* explain = sqlite3_mprintf("EXPLAIN %s",sql);
+	if(!explain)
+		return -1;
+	int ret = sqlite3_prepare_v2(db,explain,-1,&stmt,NULL);
+	sqlite3_free(explain);
+	if(ret != SQLITE_OK)
+		return -1;
+	int num_sorts = 0;
+	while((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		const char* opcode = (const char*)sqlite3_column_text(stmt,1);
+		if(opcode && (!strcmp(opcode,"SorterOpen") || !strcmp(opcode,"OpenEphemeral")))
+			num_sorts++;
+	}
+	sqlite3_finalize(stmt);
+	return ret == SQLITE_DONE ? num_sorts : -1;
+}
+
+// make room for a variant after the existing ones, which is only counted among them once the caller has finished setting it up
+static struct statement_variant* statement_vtab_new_variant(struct statement_vtab* vtab, char* sql, int exact) {
+	struct statement_variant** variants = sqlite3_realloc64(vtab->variants,sizeof(*variants)*(vtab->num_variants+1));
+	if(!variants) {
+		sqlite3_free(sql);
+		return NULL;
+	}
+	vtab->variants = variants;
+	struct statement_variant* variant = sqlite3_malloc64(sizeof(*variant));
+	if(!variant) {
+		sqlite3_free(sql);
+		return NULL;
+	}
+	memset(variant,0,sizeof(*variant));
+	variant->sql = sql;
+	variant->index = vtab->num_variants;
+	variant->exact = exact;
+	return variants[vtab->num_variants] = variant;
+}
+
+// variants and plans are only added over the lifetime of a vtab, so that indexes held by prepared statements stay valid
+static int statement_vtab_add_variant(struct statement_vtab* vtab, char* sql, int exact, int* index) {
+	if(!sql)
+		return SQLITE_NOMEM;
+	for(int i = 0; i < vtab->num_variants; i++)
+		if(!strcmp(vtab->variants[i]->sql,sql)) {
+			sqlite3_free(sql);
+			*index = i;
+			return SQLITE_OK;
+		}
+	struct statement_variant* variant = statement_vtab_new_variant(vtab,sql,exact);
+	if(!variant)
+		return SQLITE_NOMEM;
+
+	// prepare one up front so that a variant sqlite won't accept is turned away before any plan can refer to it
+	sqlite3_stmt* stmt;
+	int ret = statement_pool_checkout(vtab,variant,&stmt);
+	if(ret != SQLITE_OK) {
+		sqlite3_free(sql);
+		sqlite3_free(variant);
+		return ret;
+	}
+	statement_pool_return(vtab,variant,stmt);
+	variant->num_sorts = statement_sort_count(vtab->db,sql);
+	*index = vtab->num_variants++;
+	return SQLITE_OK;
+}
+
+static int statement_vtab_add_plan(struct statement_vtab* vtab, const struct statement_plan* plan, int* index) {
+	for(int i = 0; i < vtab->num_plans; i++)
+		if(!memcmp(vtab->plans[i],plan,sizeof(*plan))) {
+			*index = i;
+			return SQLITE_OK;
+		}
+	struct statement_plan** plans = sqlite3_realloc64(vtab->plans,sizeof(*plans)*(vtab->num_plans+1));
+	if(!plans)
+		return SQLITE_NOMEM;
+	vtab->plans = plans;
+	if(!(plans[vtab->num_plans] = sqlite3_malloc64(sizeof(**plans))))
+		return SQLITE_NOMEM;
+	*plans[vtab->num_plans] = *plan;
+	*index = vtab->num_plans++;
+	return SQLITE_OK;
+}
+
+// find or add a map from xFilter args to parameters, whose first element is its length
+static int statement_vtab_add_param_map(struct statement_vtab* vtab, int* map, int* index) {
+	for(int i = 0; i < vtab->num_param_maps; i++)
+		if(vtab->param_maps[i][0] == map[0] && !memcmp(vtab->param_maps[i],map,sizeof(*map)*(map[0]+1))) {
+			sqlite3_free(map);
+			*index = i;
+			return SQLITE_OK;
+		}
+	int** maps = sqlite3_realloc64(vtab->param_maps,sizeof(*maps)*(vtab->num_param_maps+1));
+	if(!maps) {
+		sqlite3_free(map);
+		return SQLITE_NOMEM;
+	}
+	vtab->param_maps = maps;
+	maps[vtab->num_param_maps] = map;
+	*index = vtab->num_param_maps++;
+	return SQLITE_OK;
+}
+
+static void statement_rows_clear(struct statement_rows* rows) {
+	for(sqlite3_int64 i = 0; i < rows->num_rows*rows->num_cols; i++)
+		sqlite3_value_free(rows->values[i]);
+	sqlite3_free(rows->values);
+	memset(rows,0,sizeof(*rows));
+}
+
+static sqlite3_uint64 statement_value_size(sqlite3_value* v) {
+	int type = v ? sqlite3_value_type(v) : SQLITE_NULL;
+	return STATEMENT_VALUE_OVERHEAD + (type == SQLITE_TEXT || type == SQLITE_BLOB ? sqlite3_value_bytes(v) : 0);
+}
+
+static int statement_rows_append(struct statement_rows* rows, sqlite3_stmt* stmt) {
+	if(rows->num_rows == rows->alloc_rows) {
+		sqlite3_int64 alloc_rows = rows->alloc_rows ? rows->alloc_rows*2 : 4;
+		sqlite3_value** values = sqlite3_realloc64(rows->values,sizeof(*values)*alloc_rows*rows->num_cols);
+		if(!values)
+			return SQLITE_NOMEM;
+		rows->values = values;
+		rows->alloc_rows = alloc_rows;
+	}
+	sqlite3_value** row = rows->values + rows->num_rows*rows->num_cols;
+	for(int i = 0; i < rows->num_cols; i++) {
+		if(!(row[i] = sqlite3_value_dup(sqlite3_column_value(stmt,i)))) {
+			while(i--)
+				sqlite3_value_free(row[i]);
+			return SQLITE_NOMEM;
+		}
+		rows->size += statement_value_size(row[i]);
+	}
+	rows->num_rows++;
+	return SQLITE_OK;
+}
+
+// cache keys compare bound values exactly, by type and content, since e.g. 1 and 1.0 may produce different results.
+// unbound parameters behave as NULL so the two are treated as the same key.
+static sqlite3_uint64 statement_cache_hash(int variant, sqlite3_value** key, int num_keys) {
+	sqlite3_uint64 hash = (0xcbf29ce484222325ull ^ variant) * 0x100000001b3ull;
+	for(int i = 0; i < num_keys; i++) {
+		int type = key[i] ? sqlite3_value_type(key[i]) : SQLITE_NULL;
+		const unsigned char* data = NULL;
+		size_t len = 0;
+		sqlite3_int64 ival;
+		double rval;
+		switch(type) {
+			case SQLITE_INTEGER: ival = sqlite3_value_int64(key[i]); data = (const unsigned char*)&ival; len = sizeof(ival); break;
+			case SQLITE_FLOAT:   rval = sqlite3_value_double(key[i]); data = (const unsigned char*)&rval; len = sizeof(rval); break;
+			case SQLITE_TEXT:    data = sqlite3_value_text(key[i]); len = sqlite3_value_bytes(key[i]); break;
+			case SQLITE_BLOB:    data = sqlite3_value_blob(key[i]); len = sqlite3_value_bytes(key[i]); break;
+		}
+		hash = (hash ^ type) * 0x100000001b3ull;
+		for(size_t j = 0; j < len; j++)
+			hash = (hash ^ data[j]) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static int statement_value_identical(sqlite3_value* a, sqlite3_value* b) {
+	int type = a ? sqlite3_value_type(a) : SQLITE_NULL;
+	if(type != (b ? sqlite3_value_type(b) : SQLITE_NULL))
+		return 0;
+	switch(type) {
+		case SQLITE_INTEGER: return sqlite3_value_int64(a) == sqlite3_value_int64(b);
+		case SQLITE_FLOAT:   return !memcmp(&(double){sqlite3_value_double(a)},&(double){sqlite3_value_double(b)},sizeof(double));
+		case SQLITE_TEXT: {
+			const unsigned char* atext = sqlite3_value_text(a);
+			const unsigned char* btext = sqlite3_value_text(b);
+			int len = sqlite3_value_bytes(a);
+			return len == sqlite3_value_bytes(b) && !memcmp(atext,btext,len);
+		}
+		case SQLITE_BLOB: {
+			int len = sqlite3_value_bytes(a);
+			return len == sqlite3_value_bytes(b) && (!len || !memcmp(sqlite3_value_blob(a),sqlite3_value_blob(b),len));
+		}
+	}
+	return 1;
+}
+
+static sqlite3_uint64 statement_cache_entry_size(struct statement_cache_entry* entry, int num_keys) {
+	sqlite3_uint64 size = sizeof(*entry) + entry->rows.size;
+	for(int i = 0; i < num_keys; i++)
+		size += statement_value_size(entry->key[i]);
+	return size;
+}
+
+static void statement_cache_entry_free(struct statement_cache_entry* entry, int num_keys) {
+	if(entry->key)
+		for(int i = 0; i < num_keys; i++)
+			sqlite3_value_free(entry->key[i]);
+	sqlite3_free(entry->key);
+	statement_rows_clear(&entry->rows);
+	sqlite3_free(entry);
+}
+
+static void statement_cache_evict(struct statement_vtab* vtab, struct statement_cache_entry* entry) {
+	struct statement_cache* cache = vtab->cache;
+	struct statement_cache_entry** link = &cache->buckets[entry->hash & (cache->num_buckets-1)];
+	while(*link != entry)
+		link = &(*link)->hash_next;
+	*link = entry->hash_next;
+	entry->lru_prev->lru_next = entry->lru_next;
+	entry->lru_next->lru_prev = entry->lru_prev;
+	cache->size -= statement_cache_entry_size(entry,vtab->num_inputs);
+	cache->num_entries--;
+	if(entry->refs)
+		entry->evicted = 1;
+	else
+		statement_cache_entry_free(entry,vtab->num_inputs);
+}
+
+static void statement_cache_release(struct statement_vtab* vtab, struct statement_cache_entry* entry) {
+	if(!--entry->refs && entry->evicted)
+		statement_cache_entry_free(entry,vtab->num_inputs);
+}
+
+static void statement_cache_clear(struct statement_vtab* vtab) {
+	struct statement_cache* cache = vtab->cache;
+	while(cache->lru.lru_next != &cache->lru)
+		statement_cache_evict(vtab,cache->lru.lru_next);
+}
+
+static void statement_cache_free(struct statement_vtab* vtab) {
+	if(!vtab->cache)
+		return;
+	statement_cache_clear(vtab);
+	sqlite3_free(vtab->cache->buckets);
+	sqlite3_free(vtab->cache);
+	vtab->cache = NULL;
+}
+
+static int statement_cache_init(struct statement_vtab* vtab) {
+	if(!(vtab->cache = sqlite3_malloc64(sizeof(*vtab->cache))))
+		return SQLITE_NOMEM;
+	memset(vtab->cache,0,sizeof(*vtab->cache));
+	vtab->cache->limit = vtab->cache_size;
+	vtab->cache->lru.lru_next = vtab->cache->lru.lru_prev = &vtab->cache->lru;
+	return SQLITE_OK;
+}
+
+// results observed inside a write transaction may yet be rolled back, so they are neither served nor stored
+static int statement_cache_usable(struct statement_vtab* vtab) {
+#if SQLITE_VERSION_NUMBER >= 3034000
+	if(sqlite3_libversion_number() >= 3034000)
+		return sqlite3_txn_state(vtab->db,NULL) != SQLITE_TXN_WRITE;
+#endif
+	return sqlite3_get_autocommit(vtab->db);
+}
+
+static int statement_cache_validate(struct statement_vtab* vtab) {
+	struct statement_cache* cache = vtab->cache;
+	struct statement_generation generation;
+	int ret;
+	// results of statements that read no tables can't go stale
+	if(vtab->deterministic)
+		return SQLITE_OK;
+	if((ret = statement_vtab_generation(vtab,&generation)) != SQLITE_OK)
+		return ret;
+	if(memcmp(&generation,&cache->generation,sizeof(generation))) {
+		statement_cache_clear(vtab);
+		cache->generation = generation;
+	}
+	return SQLITE_OK;
+}
+
+static struct statement_cache_entry* statement_cache_lookup(struct statement_vtab* vtab, int variant, sqlite3_value** key) {
+	struct statement_cache* cache = vtab->cache;
+	if(!cache->num_entries)
+		return NULL;
+	sqlite3_uint64 hash = statement_cache_hash(variant,key,vtab->num_inputs);
+	for(struct statement_cache_entry* entry = cache->buckets[hash & (cache->num_buckets-1)]; entry; entry = entry->hash_next) {
+		if(entry->hash != hash || entry->variant != variant)
+			continue;
+		int i = 0;
+		while(i < vtab->num_inputs && statement_value_identical(entry->key[i],key[i]))
+			i++;
+		if(i < vtab->num_inputs)
+			continue;
+		entry->lru_prev->lru_next = entry->lru_next;
+		entry->lru_next->lru_prev = entry->lru_prev;
+		entry->lru_next = cache->lru.lru_next;
+		entry->lru_prev = &cache->lru;
+		entry->lru_next->lru_prev = entry->lru_prev->lru_next = entry;
+		return entry;
+	}
+	return NULL;
+}
+
+// takes ownership of rows, evicting least recently used entries to stay under the limit
+static int statement_cache_insert(struct statement_vtab* vtab, int variant, sqlite3_value** key, struct statement_rows* rows) {
+	struct statement_cache* cache = vtab->cache;
+	struct statement_cache_entry* entry = sqlite3_malloc64(sizeof(*entry));
+	if(!entry) {
+		statement_rows_clear(rows);
+		return SQLITE_NOMEM;
+	}
+	memset(entry,0,sizeof(*entry));
+	entry->rows = *rows;
+	memset(rows,0,sizeof(*rows));
+	if(vtab->num_inputs && !(entry->key = sqlite3_malloc64(sizeof(*entry->key)*vtab->num_inputs)))
+		goto nomem;
+	for(int i = 0; i < vtab->num_inputs; i++)
+		if(!(entry->key[i] = key[i] ? sqlite3_value_dup(key[i]) : NULL) && key[i]) {
+			while(i--)
+				sqlite3_value_free(entry->key[i]);
+			sqlite3_free(entry->key);
+			entry->key = NULL;
+			goto nomem;
+		}
+
+	sqlite3_uint64 size = statement_cache_entry_size(entry,vtab->num_inputs);
+	if(size > cache->limit) {
+		statement_cache_entry_free(entry,vtab->num_inputs);
+		return SQLITE_OK;
+	}
+	while(cache->size + size > cache->limit)
+		statement_cache_evict(vtab,cache->lru.lru_prev);
+
+	if(cache->num_entries >= cache->num_buckets) {
+		size_t num_buckets = cache->num_buckets ? cache->num_buckets*2 : 16;
+		struct statement_cache_entry** buckets = sqlite3_malloc64(sizeof(*buckets)*num_buckets);
+		if(!buckets)
+			goto nomem;
+		memset(buckets,0,sizeof(*buckets)*num_buckets);
+		for(struct statement_cache_entry* e = cache->lru.lru_next; e != &cache->lru; e = e->lru_next) {
+			e->hash_next = buckets[e->hash & (num_buckets-1)];
+			buckets[e->hash & (num_buckets-1)] = e;
+		}
+		sqlite3_free(cache->buckets);
+		cache->buckets = buckets;
+		cache->num_buckets = num_buckets;
+	}
+
+	entry->variant = variant;
+	entry->hash = statement_cache_hash(variant,key,vtab->num_inputs);
+	entry->hash_next = cache->buckets[entry->hash & (cache->num_buckets-1)];
+	cache->buckets[entry->hash & (cache->num_buckets-1)] = entry;
+	entry->lru_next = cache->lru.lru_next;
+	entry->lru_prev = &cache->lru;
+	entry->lru_next->lru_prev = entry->lru_prev->lru_next = entry;
+	cache->size += size;
+	cache->num_entries++;
+	return SQLITE_OK;
+
+nomem:
+	statement_cache_entry_free(entry,vtab->num_inputs);
+	return SQLITE_NOMEM;
+}
+
+// persistent caches store each result in the vtab's <name>_cache shadow table as a single blob, keyed on the variant and bound values.
+// values are serialized as a type byte followed by a big-endian 8 byte integer or double, or a 4 byte length and the text or blob
+static void statement_serialize_uint(sqlite3_str* out, sqlite3_uint64 n, int bytes) {
+	unsigned char buf[8];
+	for(int i = 0; i < bytes; i++)
+		buf[i] = n >> (bytes-1-i)*8;
+	sqlite3_str_append(out,(const char*)buf,bytes);
+}
+
+static void statement_serialize_value(sqlite3_str* out, sqlite3_value* v) {
+	int type = v ? sqlite3_value_type(v) : SQLITE_NULL;
+	sqlite3_str_appendchar(out,1,type);
+	switch(type) {
+		case SQLITE_INTEGER: statement_serialize_uint(out,sqlite3_value_int64(v),8); break;
+		case SQLITE_FLOAT: {
+			double r = sqlite3_value_double(v);
+			sqlite3_uint64 n;
+			memcpy(&n,&r,sizeof(n));
+			statement_serialize_uint(out,n,8);
+			break;
+		}
+		case SQLITE_TEXT:
+		case SQLITE_BLOB: {
+			const void* data = type == SQLITE_TEXT ? (const void*)sqlite3_value_text(v) : sqlite3_value_blob(v);
+			int len = sqlite3_value_bytes(v);
+			statement_serialize_uint(out,len,4);
+			if(len)
+				sqlite3_str_append(out,data,len);
+			break;
+		}
+	}
+}
+
+static sqlite3_uint64 statement_deserialize_uint(const unsigned char* p, int bytes) {
+	sqlite3_uint64 n = 0;
+	for(int i = 0; i < bytes; i++)
+		n = n << 8 | p[i];
+	return n;
+}
+
+// bind the value at *p to the row statement, advancing past it. returns SQLITE_CORRUPT if it runs past end
+static int statement_deserialize_value(sqlite3_stmt* row, int param_idx, const unsigned char** p, const unsigned char* end) {
+	if(*p == end)
+		return SQLITE_CORRUPT;
+	int type = *(*p)++;
+	switch(type) {
+		case SQLITE_NULL: return sqlite3_bind_null(row,param_idx);
+		case SQLITE_INTEGER:
+		case SQLITE_FLOAT: {
+			if(end - *p < 8)
+				return SQLITE_CORRUPT;
+			sqlite3_uint64 n = statement_deserialize_uint(*p,8);
+			*p += 8;
+			if(type == SQLITE_INTEGER)
+				return sqlite3_bind_int64(row,param_idx,(sqlite3_int64)n);
+			double r;
+			memcpy(&r,&n,sizeof(r));
+			return sqlite3_bind_double(row,param_idx,r);
+		}
+		case SQLITE_TEXT:
+		case SQLITE_BLOB: {
+			if(end - *p < 4)
+				return SQLITE_CORRUPT;
+			sqlite3_uint64 len = statement_deserialize_uint(*p,4);
+			*p += 4;
+			if((sqlite3_uint64)(end - *p) < len)
+				return SQLITE_CORRUPT;
+			const char* data = (const char*)*p;
+			*p += len;
+			return type == SQLITE_TEXT ? sqlite3_bind_text(row,param_idx,data,len,SQLITE_STATIC) : sqlite3_bind_blob(row,param_idx,data,len,SQLITE_STATIC);
+		}
+	}
+	return SQLITE_CORRUPT;
+}
+
+// the key includes a hash of the variant's SQL since variant numbering is particular to each connection
+static char* statement_persist_key(struct statement_cursor* cur, int* len) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	sqlite3_uint64 hash = 0xcbf29ce484222325ull;
+	for(const char* c = cur->variant->sql; *c; c++)
+		hash = (hash ^ (unsigned char)*c) * 0x100000001b3ull;
+	sqlite3_str* key = sqlite3_str_new(vtab->db);
+	statement_serialize_uint(key,hash,8);
+	for(int i = 0; i < vtab->num_inputs; i++)
+		statement_serialize_value(key,cur->param_argv[i]);
+	*len = sqlite3_str_length(key);
+	return sqlite3_str_finish(key);
+}
+
+static int statement_persist_prepare(struct statement_vtab* vtab, sqlite3_stmt** stmt, const char* fmt) {
+	if(*stmt)
+		return SQLITE_OK;
+	char* sql = sqlite3_mprintf(fmt,vtab->schema,vtab->name);
+	if(!sql)
+		return SQLITE_NOMEM;
+	int ret = sqlite3_prepare_v3(vtab->db,sql,-1,SQLITE_PREPARE_PERSISTENT,stmt,NULL);
+	sqlite3_free(sql);
+	return ret;
+}
+
+// look the cursor's bindings up in the persistent cache, copying any stored result into the memory cache to replay from there.
+// a missing or unreadable shadow table just means a miss
+static int statement_persist_lookup(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	int ret, len;
+	if(statement_persist_prepare(vtab,&vtab->persist_lookup,"SELECT rows FROM \"%w\".\"%w_cache\" WHERE key = ?1") != SQLITE_OK)
+		return SQLITE_OK;
+	if(!vtab->persist_row) {
+		sqlite3_str* sql = sqlite3_str_new(vtab->db);
+		sqlite3_str_appendall(sql,"SELECT ");
+		for(int i = 0; i < vtab->num_outputs; i++)
+			sqlite3_str_appendf(sql,"%s?%d",i ? "," : "",i+1);
+		char* row = sqlite3_str_finish(sql);
+		if(!row)
+			return SQLITE_NOMEM;
+		ret = sqlite3_prepare_v3(vtab->db,row,-1,SQLITE_PREPARE_PERSISTENT,&vtab->persist_row,NULL);
+		sqlite3_free(row);
+		if(ret != SQLITE_OK)
+			return ret;
+	}
+
+	char* key = statement_persist_key(cur,&len);
+	if(!key)
+		return SQLITE_NOMEM;
+	sqlite3_stmt* lookup = vtab->persist_lookup;
+	if((ret = sqlite3_bind_blob(lookup,1,key,len,sqlite3_free)) != SQLITE_OK || sqlite3_step(lookup) != SQLITE_ROW) {
+		sqlite3_reset(lookup);
+		return ret;
+	}
+
+	struct statement_rows rows = {.num_cols = vtab->num_outputs};
+	const unsigned char* p = sqlite3_column_blob(lookup,0);
+	const unsigned char* end = p + sqlite3_column_bytes(lookup,0);
+	sqlite3_uint64 num_rows = 0;
+	if(end - p >= 8) {
+		num_rows = statement_deserialize_uint(p,8);
+		p += 8;
+	}
+	else ret = SQLITE_CORRUPT;
+	for(sqlite3_uint64 r = 0; r < num_rows && ret == SQLITE_OK; r++) {
+		for(int i = 0; i < vtab->num_outputs && ret == SQLITE_OK; i++)
+			ret = statement_deserialize_value(vtab->persist_row,i+1,&p,end);
+		if(ret == SQLITE_OK && sqlite3_step(vtab->persist_row) == SQLITE_ROW)
+			ret = statement_rows_append(&rows,vtab->persist_row);
+		sqlite3_reset(vtab->persist_row);
+	}
+	sqlite3_clear_bindings(vtab->persist_row);
+	sqlite3_reset(lookup);
+	if(ret == SQLITE_OK && (ret = statement_cache_insert(vtab,cur->variant->index,cur->param_argv,&rows)) == SQLITE_OK)
+		cur->replay = statement_cache_lookup(vtab,cur->variant->index,cur->param_argv);
+	statement_rows_clear(&rows);
+	return ret == SQLITE_CORRUPT ? SQLITE_OK : ret;
+}
+
+// storing a result turns the query reading it into a write, so it's only done where that can't fail or hold the query up:
+// outside of any transaction the application opened, on a connection that isn't defensive (where writing the shadow table
+// fails), and with a read transaction already open on the database. sqlite fails straight away rather than calling the
+// busy handler when a read transaction can't be upgraded, where starting a new one could wait out a busy timeout
+static int statement_persist_writable(struct statement_vtab* vtab) {
+	if(sqlite3_db_readonly(vtab->db,vtab->schema) || !sqlite3_get_autocommit(vtab->db))
+		return 0;
+#if SQLITE_VERSION_NUMBER >= 3034000
+	int defensive = 0;
+	if(sqlite3_libversion_number() >= 3034000)
+		return sqlite3_db_config(vtab->db,SQLITE_DBCONFIG_DEFENSIVE,-1,&defensive) == SQLITE_OK && !defensive &&
+		       sqlite3_txn_state(vtab->db,vtab->schema) == SQLITE_TXN_READ;
+#endif
+	return 0;
+}
+
+// write a result to the persistent cache. this is only an optimization, so failing to get a write lock or similar is ignored
+static int statement_persist_store(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	int len;
+	if(!statement_persist_writable(vtab) ||
+	   statement_persist_prepare(vtab,&vtab->persist_insert,"INSERT OR REPLACE INTO \"%w\".\"%w_cache\"(key, rows) VALUES(?1, ?2)") != SQLITE_OK)
+		return SQLITE_OK;
+
+	sqlite3_str* rows = sqlite3_str_new(vtab->db);
+	statement_serialize_uint(rows,cur->recorded.num_rows,8);
+	for(sqlite3_int64 i = 0; i < cur->recorded.num_rows*cur->recorded.num_cols; i++)
+		statement_serialize_value(rows,cur->recorded.values[i]);
+	int rows_len = sqlite3_str_length(rows);
+	char* data = sqlite3_str_finish(rows);
+	char* key = statement_persist_key(cur,&len);
+	if(!data || !key) {
+		sqlite3_free(data);
+		sqlite3_free(key);
+		return SQLITE_NOMEM;
+	}
+
+	// the values are freed by sqlite even if binding them fails
+	sqlite3_stmt* insert = vtab->persist_insert;
+	int ret = sqlite3_bind_blob(insert,1,key,len,sqlite3_free);
+	if(ret != SQLITE_OK)
+		sqlite3_free(data);
+	else if((ret = sqlite3_bind_blob(insert,2,data,rows_len,sqlite3_free)) == SQLITE_OK && sqlite3_step(insert) == SQLITE_DONE)
+		vtab->registry->persist_changes += sqlite3_changes(vtab->db);
+	sqlite3_reset(insert);
+	sqlite3_clear_bindings(insert);
+	return ret == SQLITE_NOMEM ? ret : SQLITE_OK;
+}
+
+static void statement_mat_free(struct statement_materialized* mat, int num_outputs) {
+	if(mat->indexes)
+		for(int i = 0; i < num_outputs; i++)
+			if(mat->indexes[i]) {
+				sqlite3_free(mat->indexes[i]->heads);
+				sqlite3_free(mat->indexes[i]->next);
+				sqlite3_free(mat->indexes[i]->hashes);
+				sqlite3_free(mat->indexes[i]);
+			}
+	sqlite3_free(mat->indexes);
+	statement_rows_clear(&mat->rows);
+	sqlite3_free(mat);
+}
+
+static void statement_mat_release(struct statement_vtab* vtab, struct statement_materialized* mat) {
+	if(!--mat->refs && mat->stale)
+		statement_mat_free(mat,vtab->num_outputs);
+}
+
+// buckets values so that any two sqlite could consider equal with the BINARY collation, whatever affinity is applied to them,
+// end up with the same hash. this means numbers compare by value and text that looks like a number hashes as that number.
+// sqlite still checks each row found this way, so it doesn't matter that e.g. '1.0' and 1 share a hash.
+// results in 0 for NULLs, which are never equal to anything, or SQLITE_NOMEM
+static int statement_mat_hash(sqlite3_value* v, sqlite3_uint64* hash) {
+	int type = v ? sqlite3_value_type(v) : SQLITE_NULL;
+	*hash = 0;
+	if(type == SQLITE_NULL)
+		return SQLITE_OK;
+	sqlite3_value* num = NULL;
+	if(type == SQLITE_TEXT) {
+		if(!(num = sqlite3_value_dup(v)))
+			return SQLITE_NOMEM;
+		int numtype = sqlite3_value_numeric_type(num);
+		if(numtype == SQLITE_INTEGER || numtype == SQLITE_FLOAT) {
+			v = num;
+			type = numtype;
+		}
+	}
+
+	const unsigned char* data = NULL;
+	size_t len = 0;
+	double rval;
+	if(type == SQLITE_INTEGER || type == SQLITE_FLOAT) {
+		rval = sqlite3_value_double(v);
+		if(rval == 0)
+			rval = 0; // -0.0
+		data = (const unsigned char*)&rval;
+		len = sizeof(rval);
+		type = SQLITE_FLOAT;
+	}
+	else {
+		data = type == SQLITE_TEXT ? sqlite3_value_text(v) : sqlite3_value_blob(v);
+		len = sqlite3_value_bytes(v);
+	}
+	sqlite3_uint64 h = (0xcbf29ce484222325ull ^ type) * 0x100000001b3ull;
+	for(size_t i = 0; i < len; i++)
+		h = (h ^ data[i]) * 0x100000001b3ull;
+	sqlite3_value_free(num);
+	*hash = h ? h : 1;
+	return SQLITE_OK;
+}
+
+static int statement_mat_index(struct statement_vtab* vtab, struct statement_materialized* mat, int col, struct statement_mat_index** index) {
+	if((*index = mat->indexes[col]))
+		return SQLITE_OK;
+	struct statement_mat_index* idx = sqlite3_malloc64(sizeof(*idx));
+	if(!idx)
+		return SQLITE_NOMEM;
+	memset(idx,0,sizeof(*idx));
+	sqlite3_int64 num_rows = mat->rows.num_rows;
+	idx->num_buckets = 16;
+	while(idx->num_buckets < (size_t)num_rows)
+		idx->num_buckets *= 2;
+	int ret = SQLITE_NOMEM;
+	if(!(idx->heads = sqlite3_malloc64(sizeof(*idx->heads)*idx->num_buckets)) ||
+	   !(idx->next = sqlite3_malloc64(sizeof(*idx->next)*(num_rows+1))) ||
+	   !(idx->hashes = sqlite3_malloc64(sizeof(*idx->hashes)*(num_rows+1))))
+		goto error;
+	for(size_t i = 0; i < idx->num_buckets; i++)
+		idx->heads[i] = -1;
+	// link rows in reverse so that each bucket lists them in their original order
+	for(sqlite3_int64 i = num_rows-1; i >= 0; i--) {
+		if((ret = statement_mat_hash(mat->rows.values[i*vtab->num_outputs+col],&idx->hashes[i])) != SQLITE_OK)
+			goto error;
+		size_t bucket = idx->hashes[i] & (idx->num_buckets-1);
+		idx->next[i] = idx->heads[bucket];
+		idx->heads[bucket] = i;
+	}
+	*index = mat->indexes[col] = idx;
+	return SQLITE_OK;
+
+error:
+	sqlite3_free(idx->heads);
+	sqlite3_free(idx->next);
+	sqlite3_free(idx->hashes);
+	sqlite3_free(idx);
+	return ret;
+}
+
+// get the statement's current results, spooling them again if anything they depend on has changed since they were last
+static int statement_materialize(struct statement_vtab* vtab, struct statement_materialized** result) {
+	struct statement_generation generation;
+	int ret;
+	if((ret = statement_vtab_generation(vtab,&generation)) != SQLITE_OK)
+		return ret;
+	if(vtab->mat && !memcmp(&generation,&vtab->mat->generation,sizeof(generation))) {
+		STATEMENT_STAT(vtab,cache_hits,1);
+		*result = vtab->mat;
+		return SQLITE_OK;
+	}
+	STATEMENT_STAT(vtab,cache_misses,1);
+
+	struct statement_materialized* mat = sqlite3_malloc64(sizeof(*mat));
+	if(!mat)
+		return SQLITE_NOMEM;
+	memset(mat,0,sizeof(*mat));
+	mat->refs = 1;
+	mat->generation = generation;
+	mat->rows.num_cols = vtab->num_outputs;
+	if(!(mat->indexes = sqlite3_malloc64(sizeof(*mat->indexes)*(vtab->num_outputs+1)))) {
+		statement_mat_free(mat,vtab->num_outputs);
+		return SQLITE_NOMEM;
+	}
+	memset(mat->indexes,0,sizeof(*mat->indexes)*(vtab->num_outputs+1));
+
+	sqlite3_stmt* stmt;
+	if((ret = statement_pool_checkout(vtab,vtab->variants[0],&stmt)) != SQLITE_OK) {
+		statement_mat_free(mat,vtab->num_outputs);
+		return ret;
+	}
+	while((ret = statement_step(vtab,stmt)) == SQLITE_ROW)
+		if((ret = statement_rows_append(&mat->rows,stmt)) != SQLITE_OK)
+			break;
+	statement_pool_return(vtab,vtab->variants[0],stmt);
+	if(ret != SQLITE_DONE) {
+		statement_mat_free(mat,vtab->num_outputs);
+		return ret;
+	}
+
+	if(vtab->mat) {
+		vtab->mat->stale = 1;
+		statement_mat_release(vtab,vtab->mat);
+	}
+	*result = vtab->mat = mat;
+	return SQLITE_OK;
+}
+
+// whether the function named in a Function or Agg* opcode's p4, e.g. "upper(1)", was registered as deterministic.
+// the date and time functions are registered as such but only hold still for the length of a statement, as they accept 'now'
+static int statement_function_deterministic(sqlite3_stmt* lookup, const char* p4) {
+	static const char* const time_functions[] = {"date","time","datetime","julianday","unixepoch","strftime","timediff"};
+	const char* paren = p4 ? strrchr(p4,'(') : NULL;
+	if(!paren)
+		return 0;
+	for(size_t i = 0; i < sizeof(time_functions)/sizeof(*time_functions); i++)
+		if(strlen(time_functions[i]) == (size_t)(paren-p4) && !sqlite3_strnicmp(p4,time_functions[i],paren-p4))
+			return 0;
+	sqlite3_reset(lookup);
+	sqlite3_bind_text(lookup,1,p4,paren-p4,SQLITE_STATIC);
+	sqlite3_bind_int(lookup,2,atoi(paren+1));
+	int deterministic = sqlite3_step(lookup) == SQLITE_ROW && (sqlite3_column_int(lookup,0) & SQLITE_DETERMINISTIC);
+	sqlite3_reset(lookup);
+	return deterministic;
+}
+
+// inspect the statement's bytecode for whether it produces at most one row per invocation (a single ResultRow that no loop revisits),
+// and whether its results depend on nothing but its parameters (no tables are read and only deterministic functions called).
+// anything that can't be inspected (e.g. without EXPLAIN or pragma_function_list) is assumed to be neither.
+static int statement_vtab_analyze(struct statement_vtab* vtab) {
+	sqlite3_stmt* stmt = NULL;
+	sqlite3_stmt* lookup = NULL;
+	char* explain = sqlite3_mprintf("EXPLAIN %s",vtab->sql);
+	if(!explain)
+		return SQLITE_NOMEM;
+	int ret = sqlite3_prepare_v2(vtab->db,explain,-1,&stmt,NULL);
+	sqlite3_free(explain);
+	if(ret != SQLITE_OK)
+		return ret == SQLITE_NOMEM ? ret : SQLITE_OK;
+	if((ret = sqlite3_prepare_v2(vtab->db,"SELECT flags FROM pragma_function_list WHERE name = ?1 COLLATE NOCASE AND narg IN (?2,-1) ORDER BY narg = -1",-1,&lookup,NULL)) == SQLITE_NOMEM)
+		goto done;
+
+	int results = 0, loops = 0, tables = 0, nondeterministic = !lookup;
+	while((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		int addr = sqlite3_column_int(stmt,0);
+		const char* opcode = (const char*)sqlite3_column_text(stmt,1);
+		if(!opcode)
+			continue;
+		if(!strcmp(opcode,"ResultRow"))
+			results++;
+		else if(!strcmp(opcode,"Next") || !strcmp(opcode,"Prev") || !strcmp(opcode,"VNext") || !strcmp(opcode,"SorterNext") || !strcmp(opcode,"Yield"))
+			loops++;
+		// every program ends by jumping back to just after its Init, anything else jumping backwards is a loop
+		else if(!strcmp(opcode,"Goto") && sqlite3_column_int(stmt,3) <= addr && sqlite3_column_int(stmt,3) != 1)
+			loops++;
+		else if(!strcmp(opcode,"OpenRead") || !strcmp(opcode,"OpenWrite") || !strcmp(opcode,"ReopenIdx") || !strcmp(opcode,"VOpen"))
+			tables++;
+		else if(!nondeterministic && (!strcmp(opcode,"Function") || !strcmp(opcode,"PureFunc") || !strncmp(opcode,"Agg",3)))
+			nondeterministic = !statement_function_deterministic(lookup,(const char*)sqlite3_column_text(stmt,5));
+	}
+	if(ret != SQLITE_DONE)
+		goto done;
+	ret = SQLITE_OK;
+
+	vtab->unique = results == 1 && !loops;
+	vtab->deterministic = !tables && !nondeterministic;
+
+done:
+	sqlite3_finalize(lookup);
+	sqlite3_finalize(stmt);
+	return ret == SQLITE_NOMEM ? ret : SQLITE_OK;
+}
+
+// tokens of a statement, only as finely as inlining needs them told apart
+enum {
+	STATEMENT_TOKEN_END,
+	STATEMENT_TOKEN_SPACE,
+	STATEMENT_TOKEN_ID,      // a bare or quoted identifier, or a keyword
+	STATEMENT_TOKEN_LITERAL, // a string, number or blob
+	STATEMENT_TOKEN_VARIABLE,
+	STATEMENT_TOKEN_OTHER,   // an operator or punctuation, a character at a time
+};
+
+static int statement_id_char(unsigned char c) {
+	return isalnum(c) || c == '_' || c == '$' || c >= 0x80;
+}
+
+// the length of the token at p, loosely following SQLite's own tokenizer
+static int statement_token(const char* p, int* type) {
+	const unsigned char* s = (const unsigned char*)p;
+	int n = 1;
+	*type = STATEMENT_TOKEN_OTHER;
+	if(!*s) {
+		*type = STATEMENT_TOKEN_END;
+		return 0;
+	}
+	if(isspace(*s) || (s[0] == '-' && s[1] == '-') || (s[0] == '/' && s[1] == '*')) {
+		*type = STATEMENT_TOKEN_SPACE;
+		if(isspace(*s))
+			while(isspace(s[n]))
+				n++;
+		else if(*s == '-')
+			while(s[n] && s[n] != '\n')
+				n++;
+		else {
+			n = 2;
+			while(s[n] && !(s[n] == '*' && s[n+1] == '/'))
+				n++;
+			if(s[n])
+				n += 2;
+		}
+	}
+	else if(*s == '\'' || *s == '"' || *s == '`' || *s == '[') {
+		unsigned char close = *s == '[' ? ']' : *s;
+		*type = *s == '\'' ? STATEMENT_TOKEN_LITERAL : STATEMENT_TOKEN_ID;
+		while(s[n] && (s[n] != close || (close != ']' && s[n+1] == close)))
+			n += s[n] == close ? 2 : 1;
+		if(s[n])
+			n++;
+	}
+	else if((*s == 'x' || *s == 'X') && s[1] == '\'') {
+		*type = STATEMENT_TOKEN_LITERAL;
+		for(n = 2; s[n] && s[n] != '\''; n++)
+			;
+		if(s[n])
+			n++;
+	}
+	else if(isdigit(*s) || (*s == '.' && isdigit(s[1]))) {
+		*type = STATEMENT_TOKEN_LITERAL;
+		while(isalnum(s[n]) || s[n] == '.' || s[n] == '_' || ((s[n] == '+' || s[n] == '-') && (s[n-1] == 'e' || s[n-1] == 'E') && s[0] != '0'))
+			n++;
+	}
+	else if(*s == '?') {
+		*type = STATEMENT_TOKEN_VARIABLE;
+		while(isdigit(s[n]))
+			n++;
+	}
+	else if((*s == ':' || *s == '@' || *s == '$') && statement_id_char(s[1])) {
+		*type = STATEMENT_TOKEN_VARIABLE;
+		while(statement_id_char(s[n]) || (s[n] == ':' && s[n+1] == ':' && n++))
+			n++;
+	}
+	else if(statement_id_char(*s) && !isdigit(*s)) {
+		*type = STATEMENT_TOKEN_ID;
+		while(statement_id_char(s[n]))
+			n++;
+	}
+	return n;
+}
+
+// the next token at or after p that isn't whitespace or a comment
+static const char* statement_token_next(const char* p, int* type, int* len) {
+	while((*len = statement_token(p,type)) && *type == STATEMENT_TOKEN_SPACE)
+		p += *len;
+	return p;
+}
+
+static int statement_token_keyword(const char* p, int type, int len, const char* keyword) {
+	return type == STATEMENT_TOKEN_ID && (size_t)len == strlen(keyword) && !sqlite3_strnicmp(p,keyword,len);
+}
+
+// whether an identifier token names the given object, which SQLite compares without regard to case
+static int statement_token_names(const char* p, int len, const char* name) {
+	if(*p == '"' || *p == '`' || *p == '[') {
+		p++;
+		len -= 2;
+	}
+	return len >= 0 && (size_t)len == strlen(name) && !sqlite3_strnicmp(p,name,len);
+}
+
+// whether sql defines a common table expression named name, as name[(columns)] AS [NOT] [MATERIALIZED] (, shadowing any table of that name
+static int statement_sql_defines(const char* sql, const char* name) {
+	int type, len, ntype, nlen;
+	for(const char* p = statement_token_next(sql,&type,&len); type != STATEMENT_TOKEN_END; p = statement_token_next(p+len,&type,&len)) {
+		if(type != STATEMENT_TOKEN_ID || !statement_token_names(p,len,name))
+			continue;
+		const char* next = statement_token_next(p+len,&ntype,&nlen);
+		if(*next == '(')
+			for(int depth = 0; ntype != STATEMENT_TOKEN_END;) {
+				depth += *next == '(' ? 1 : *next == ')' ? -1 : 0;
+				next = statement_token_next(next+nlen,&ntype,&nlen);
+				if(!depth)
+					break;
+			}
+		if(!statement_token_keyword(next,ntype,nlen,"AS"))
+			continue;
+		next = statement_token_next(next+nlen,&ntype,&nlen);
+		if(*next == '(' || statement_token_keyword(next,ntype,nlen,"NOT") || statement_token_keyword(next,ntype,nlen,"MATERIALIZED"))
+			return 1;
+	}
+	return 0;
+}
+
+struct statement_token_span {
+	const char* p;
+	int len;
+};
+
+// a vtab whose statement may be spliced into another's: one without options changing how it's run, and which the other's
+// statement was prepared against, rather than one whose name it merely mentions or a stale instance left from an older schema
+static struct statement_vtab* statement_inline_target(struct statement_vtab** opened, int num_opened, const char* schema, int schema_len, const char* name, int name_len) {
+	for(int i = 0; i < num_opened; i++) {
+		struct statement_vtab* target = opened[i];
+		if(!statement_token_names(name,name_len,target->name) || target->cache_set || target->persist || target->materialize || target->workers || target->prefetch ||
+		   target->max_rows || target->max_steps || target->max_ns)
+			continue;
+		if(schema ? statement_token_names(schema,schema_len,target->schema) : !sqlite3_stricmp(target->schema,"temp") || !sqlite3_stricmp(target->schema,"main"))
+			return target;
+	}
+	return NULL;
+}
+
+// append a statement with each parameter replaced by the value given for it. parameters without one become NULL,
+// or with renumber are numbered explicitly as ?NNN, so that replacing some doesn't renumber the rest.
+// parameters are numbered as SQLite does: ?NNN explicitly, and anything else one past the highest number so far unless it's a name already seen
+static int statement_sql_substitute(sqlite3_str* out, const char* sql, int num_params, const struct statement_token_span* values, int num_values, int renumber) {
+	struct statement_token_span* names = sqlite3_malloc64(sizeof(*names)*(num_params+1));
+	if(!names)
+		return SQLITE_NOMEM;
+	int ret = SQLITE_OK, num_names = 0, max_param = 0, type, len;
+	const char* copied = sql;
+	for(const char* p = sql; (len = statement_token(p,&type)) && ret == SQLITE_OK; p += len) {
+		if(type != STATEMENT_TOKEN_VARIABLE)
+			continue;
+		int param = 0;
+		if(*p == '?')
+			param = len > 1 ? atoi(p+1) : max_param+1;
+		else {
+			for(int i = 0; i < num_names && !param; i++)
+				if(names[i].len == len && !memcmp(names[i].p,p,len))
+					param = i+1;
+			if(!param) {
+				param = max_param+1;
+				if(num_names == num_params)
+					ret = SQLITE_ERROR;
+				else {
+					names[num_names].p = p;
+					names[num_names++].len = len;
+				}
+			}
+		}
+		if(param > max_param)
+			max_param = param;
+		if(param < 1 || param > num_params)
+			ret = SQLITE_ERROR;
+		sqlite3_str_append(out,copied,p-copied);
+		if(param <= num_values && values[param-1].p)
+			sqlite3_str_appendf(out,"(%.*s)",values[param-1].len,values[param-1].p);
+		else if(renumber)
+			sqlite3_str_appendf(out,"?%d",param);
+		else
+			sqlite3_str_appendall(out,"NULL");
+		copied = p+len;
+	}
+	sqlite3_str_appendall(out,copied);
+	sqlite3_free(names);
+	return ret;
+}
+
+// splice the statements of other statement vtabs this one selects from in as subqueries, so that SQLite sees one query it can flatten
+// rather than a cursor per layer. only FROM clause references whose arguments are all literals or named or numbered parameters are
+// inlined, and the result is only kept if it prepares to the same columns and parameters as the statement as written
+static int statement_vtab_inline(struct statement_vtab* vtab, sqlite3_stmt** stmt) {
+	struct statement_vtab* opened[16];
+	int num_opened = 0, ret, type, len;
+	if(!vtab->registry->head)
+		return SQLITE_OK;
+
+	// the vtabs opened by the statement are named by the VOpen opcodes' p4, which list the sqlite3_vtab they're for
+	sqlite3_stmt* explain = NULL;
+	char* sql = sqlite3_mprintf("EXPLAIN %s",vtab->sql);
+	if(!sql)
+		return SQLITE_NOMEM;
+	ret = sqlite3_prepare_v2(vtab->db,sql,-1,&explain,NULL);
+	sqlite3_free(sql);
+	if(ret != SQLITE_OK)
+		return ret == SQLITE_NOMEM ? ret : SQLITE_OK;
+	while((ret = sqlite3_step(explain)) == SQLITE_ROW) {
+		const char* opcode = (const char*)sqlite3_column_text(explain,1);
+		const char* p4 = (const char*)sqlite3_column_text(explain,5);
+		if(!opcode || strcmp(opcode,"VOpen") || !p4)
+			continue;
+		for(struct statement_vtab* v = vtab->registry->head; v && num_opened < (int)(sizeof(opened)/sizeof(*opened)); v = v->registry_next) {
+			char ptr[64];
+			sqlite3_snprintf(sizeof(ptr),ptr,"vtab:%p",(void*)&v->base);
+			int seen = 0;
+			for(int i = 0; i < num_opened; i++)
+				seen |= opened[i] == v;
+			if(!seen && !strcmp(p4,ptr))
+				opened[num_opened++] = v;
+		}
+	}
+	sqlite3_finalize(explain);
+	if(ret != SQLITE_DONE)
+		return ret == SQLITE_NOMEM ? ret : SQLITE_OK;
+	if(!num_opened)
+		return SQLITE_OK;
+
+	// whether the FROM clause at each level of parentheses is the one being read
+	unsigned char in_from[64] = {0};
+	int depth = 0, table_next = 0, inlined = 0;
+	const char* copied = vtab->sql;
+	sqlite3_str* out = sqlite3_str_new(vtab->db);
+	for(const char* p = statement_token_next(vtab->sql,&type,&len); type != STATEMENT_TOKEN_END; p = statement_token_next(p,&type,&len)) {
+		if(table_next && type == STATEMENT_TOKEN_ID) {
+			// [schema.]name[(args)], followed by an alias or not
+			const char* schema = NULL;
+			const char* name = p;
+			int schema_len = 0, name_len = len, ntype, nlen;
+			const char* end = p+len;
+			const char* next = statement_token_next(end,&ntype,&nlen);
+			if(*next == '.') {
+				next = statement_token_next(next+1,&ntype,&nlen);
+				if(ntype == STATEMENT_TOKEN_ID) {
+					schema = p;
+					schema_len = len;
+					name = next;
+					name_len = nlen;
+					end = next+nlen;
+					next = statement_token_next(end,&ntype,&nlen);
+				}
+			}
+			struct statement_vtab* target = statement_inline_target(opened,num_opened,schema,schema_len,name,name_len);
+			struct statement_token_span* args = NULL;
+			int num_args = 0, usable = !!target;
+			if(usable && !(args = sqlite3_malloc64(sizeof(*args)*(target->num_inputs+1)))) {
+				ret = SQLITE_NOMEM;
+				goto done;
+			}
+			if(usable && *next == '(') {
+				next = statement_token_next(next+1,&ntype,&nlen);
+				while(usable && *next != ')') {
+					// a literal or parameter with an optional sign, where a ? would be renumbered once copied more than once
+					const char* arg = next;
+					if(*next == '-' || *next == '+')
+						next = statement_token_next(next+1,&ntype,&nlen);
+					usable = num_args < target->num_inputs && (ntype == STATEMENT_TOKEN_LITERAL || statement_token_keyword(next,ntype,nlen,"NULL") ||
+					         (ntype == STATEMENT_TOKEN_VARIABLE && nlen > 1));
+					args[num_args].p = arg;
+					args[num_args++].len = next+nlen-arg;
+					next = statement_token_next(next+nlen,&ntype,&nlen);
+					if(*next == ',')
+						next = statement_token_next(next+1,&ntype,&nlen);
+					else if(*next != ')')
+						usable = 0;
+				}
+				if(usable) {
+					end = next+1;
+					next = statement_token_next(end,&ntype,&nlen);
+				}
+			}
+			usable = usable && !statement_sql_defines(vtab->sql,target->name);
+			if(usable && !sqlite3_stricmp(target->schema,"main") && !schema) {
+				// a temp table of the same name would be found first
+				sqlite3_stmt* shadowed;
+				char* find = sqlite3_mprintf("SELECT 1 FROM temp.sqlite_master WHERE name = %Q COLLATE NOCASE",target->name);
+				if(!find || (ret = sqlite3_prepare_v2(vtab->db,find,-1,&shadowed,NULL)) != SQLITE_OK) {
+					ret = find ? ret : SQLITE_NOMEM;
+					sqlite3_free(find);
+					sqlite3_free(args);
+					goto done;
+				}
+				sqlite3_free(find);
+				usable = (ret = sqlite3_step(shadowed)) == SQLITE_DONE;
+				sqlite3_finalize(shadowed);
+				if(ret != SQLITE_ROW && ret != SQLITE_DONE) {
+					sqlite3_free(args);
+					goto done;
+				}
+			}
+			if(usable) {
+				int aliased = statement_token_keyword(next,ntype,nlen,"AS") || (ntype == STATEMENT_TOKEN_ID && (*next == '"' || *next == '[' || *next == '`' || !sqlite3_keyword_check(next,nlen)));
+				sqlite3_str_append(out,copied,p-copied);
+				sqlite3_str_appendall(out,"(\n");
+				ret = statement_sql_substitute(out,target->sql,target->num_inputs,args,num_args,0);
+				sqlite3_free(args);
+				if(ret != SQLITE_OK)
+					goto done;
+				sqlite3_str_appendall(out,"\n)");
+				if(!aliased)
+					sqlite3_str_appendf(out," AS %.*s",name_len,name);
+				copied = p = end;
+				table_next = 0;
+				inlined = 1;
+				continue;
+			}
+			sqlite3_free(args);
+		}
+
+		if(*p == '(') {
+			if(++depth == sizeof(in_from))
+				goto done;
+			in_from[depth] = 0;
+		}
+		else if(*p == ')' && depth)
+			depth--;
+		else if(statement_token_keyword(p,type,len,"FROM") || statement_token_keyword(p,type,len,"JOIN"))
+			in_from[depth] = 1;
+		else if(type == STATEMENT_TOKEN_ID && sqlite3_keyword_check(p,len) && *p != '"' && *p != '[' && *p != '`') {
+			static const char* const clauses[] = {"SELECT","WHERE","GROUP","HAVING","WINDOW","ORDER","LIMIT","ON","USING","UNION","EXCEPT","INTERSECT","VALUES"};
+			for(size_t i = 0; i < sizeof(clauses)/sizeof(*clauses); i++)
+				if(statement_token_keyword(p,type,len,clauses[i]))
+					in_from[depth] = 0;
+		}
+		table_next = statement_token_keyword(p,type,len,"FROM") || statement_token_keyword(p,type,len,"JOIN") || (*p == ',' && in_from[depth]);
+		p += len;
+	}
+	if(!inlined)
+		goto done;
+	sqlite3_str_appendall(out,copied);
+	if((ret = sqlite3_str_errcode(out)) != SQLITE_OK)
+		goto done;
+
+	// keep the inlined statement only if it's indistinguishable from the outside
+	sqlite3_stmt* replaced;
+	if((ret = sqlite3_prepare_v2(vtab->db,sqlite3_str_value(out),sqlite3_str_length(out),&replaced,NULL)) != SQLITE_OK)
+		goto done;
+	int same = sqlite3_stmt_readonly(replaced) && sqlite3_column_count(replaced) == sqlite3_column_count(*stmt) &&
+	           sqlite3_bind_parameter_count(replaced) == sqlite3_bind_parameter_count(*stmt);
+	for(int i = 0; same && i < sqlite3_column_count(*stmt); i++) {
+		const char* name = sqlite3_column_name(*stmt,i);
+		const char* type1 = sqlite3_column_decltype(*stmt,i);
+		const char* type2 = sqlite3_column_decltype(replaced,i);
+		same = name && sqlite3_column_name(replaced,i) && !strcmp(name,sqlite3_column_name(replaced,i)) && (type1 && type2 ? !strcmp(type1,type2) : type1 == type2);
+	}
+	for(int i = 1; same && i <= sqlite3_bind_parameter_count(*stmt); i++) {
+		const char* name1 = sqlite3_bind_parameter_name(*stmt,i);
+		const char* name2 = sqlite3_bind_parameter_name(replaced,i);
+		same = name1 && name2 ? !strcmp(name1,name2) : name1 == name2;
+	}
+	if(!same) {
+		sqlite3_finalize(replaced);
+		goto done;
+	}
+	sqlite3_finalize(*stmt);
+	*stmt = replaced;
+	if((ret = statement_schema_versions(vtab->db,&vtab->written_schemas)) != SQLITE_OK)
+		goto done;
+	vtab->written = vtab->sql;
+	vtab->sql_len = sqlite3_str_length(out);
+	vtab->sql = sqlite3_str_finish(out);
+	return SQLITE_OK;
+
+	// anything short of running out of memory leaves the statement as written
+done:
+	sqlite3_free(sqlite3_str_finish(out));
+	return ret == SQLITE_NOMEM ? ret : SQLITE_OK;
+}
+
+static void statement_scalar_reset(struct statement_scalar* scalar);
+
+// the statements spliced into a vtab's were those of the vtabs it selected from when it was connected, which a schema change
+// may have since dropped, replaced or shadowed, so the splicing is done over from the statement as written once any schema
+// changes. the statement as written and anything derived from the spliced one is replaced, while variants built around it
+// are only left for plans from before the change, which sqlite no longer runs. sets changed if the statement run is different
+static int statement_vtab_reinline(struct statement_vtab* vtab, int* changed) {
+	sqlite3_uint64 schemas;
+	*changed = 0;
+	int ret = statement_schema_versions(vtab->db,&schemas);
+	if(ret != SQLITE_OK || schemas == vtab->written_schemas)
+		return ret;
+
+	char* spliced = vtab->sql;
+	vtab->sql = vtab->written;
+	vtab->sql_len = strlen(vtab->sql);
+	vtab->written = NULL;
+	// a statement that no longer prepares fails as it would have without any splicing
+	sqlite3_stmt* stmt;
+	if((ret = sqlite3_prepare_v2(vtab->db,vtab->sql,-1,&stmt,NULL)) == SQLITE_OK) {
+		ret = statement_vtab_inline(vtab,&stmt);
+		sqlite3_finalize(stmt);
+	}
+	*changed = strcmp(spliced,vtab->sql);
+	sqlite3_free(spliced);
+	if(ret == SQLITE_NOMEM)
+		return ret;
+	if(!*changed)
+		return SQLITE_OK;
+
+	struct statement_variant* variant = vtab->variants[0];
+	char* sql = sqlite3_mprintf("%s",vtab->sql);
+	if(!sql)
+		return SQLITE_NOMEM;
+	sqlite3_free(variant->sql);
+	variant->sql = sql;
+	while(variant->pool_size) {
+		sqlite3_stmt* pooled = variant->pool[--variant->pool_size];
+		statement_stats_collect(vtab,variant,pooled);
+		sqlite3_finalize(pooled);
+	}
+	variant->num_sorts = statement_sort_count(vtab->db,sql);
+	for(int i = 0; i < STATEMENT_VTAB_MEMO_SIZE; i++)
+		if(vtab->memos[i]) {
+			sqlite3_free(vtab->memos[i]->key);
+			sqlite3_free(vtab->memos[i]);
+			vtab->memos[i] = NULL;
+		}
+	if(vtab->cache)
+		statement_cache_clear(vtab);
+	if(vtab->mat) {
+		vtab->mat->stale = 1;
+		statement_mat_release(vtab,vtab->mat);
+		vtab->mat = NULL;
+	}
+	if(vtab->function)
+		statement_scalar_reset(vtab->function);
+	return SQLITE_OK;
+}
+
+static int parse_size(const char* str, sqlite3_uint64* size) {
+	char* end;
+	while(isspace((unsigned char)*str))
+		str++;
+	if(!isdigit((unsigned char)*str))
+		return SQLITE_ERROR;
+	unsigned long long n = strtoull(str,&end,10);
+	while(isspace((unsigned char)*end))
+		end++;
+	int shift = 0;
+	switch(*end) {
+		case 'k': case 'K': shift = 10; end++; break;
+		case 'm': case 'M': shift = 20; end++; break;
+		case 'g': case 'G': shift = 30; end++; break;
+	}
+	if(shift && (*end == 'b' || *end == 'B'))
+		end++;
+	while(isspace((unsigned char)*end))
+		end++;
+	if(*end || n > (UINT64_MAX >> shift))
+		return SQLITE_ERROR;
+	*size = (sqlite3_uint64)n << shift;
+	return SQLITE_OK;
+}
+
+// the value of a switch, which is on when given without one. results in -1 if it's neither on nor off
+static int parse_switch(const char* str) {
+	static const char* const values[] = {"0","off","false","no","1","on","true","yes"};
+	if(!str)
+		return 1;
+	for(int i = 0; i < (int)(sizeof(values)/sizeof(*values)); i++)
+		if(!sqlite3_stricmp(str,values[i]))
+			return i >= 4;
+	return -1;
+}
+
+static int parse_number(const char* str, double* n) {
+	char* end;
+	if(!str || !*str)
+		return SQLITE_ERROR;
+	*n = strtod(str,&end);
+	return *end || !(*n >= 0 && *n < 1e300) ? SQLITE_ERROR : SQLITE_OK;
+}
+
+// trailing module arguments are options of the form key or key=value
+// values which aren't valid SQL tokens on their own (e.g. 64M) may be quoted
+static int statement_vtab_parse_options(struct statement_vtab* vtab, int argc, const char* const* argv, char** pzErr) {
+	int ret = SQLITE_OK;
+	char* value = NULL;
+	for(int i = 4; i < argc && ret == SQLITE_OK; i++) {
+		const char* opt = argv[i];
+		const char* eq = strchr(opt,'=');
+		size_t keylen = eq ? (size_t)(eq - opt) : strlen(opt);
+		while(keylen && isspace((unsigned char)opt[keylen-1]))
+			keylen--;
+		sqlite3_free(value);
+		value = NULL;
+		if(eq) {
+			while(isspace((unsigned char)*++eq))
+				;
+			size_t len = strlen(eq);
+			if(len >= 2 && (eq[0] == '\'' || eq[0] == '"') && eq[len-1] == eq[0])
+				value = sqlite3_mprintf("%.*s",(int)len-2,eq+1);
+			else
+				value = sqlite3_mprintf("%s",eq);
+			if(!value)
+				return SQLITE_NOMEM;
+		}
+
+		// sizes and counts are numbers, even 0 and 1
+		int on = parse_switch(value);
+		int numeric = value && isdigit((unsigned char)*value);
+		if(keylen == 5 && !sqlite3_strnicmp(opt,"cache",5)) {
+			vtab->cache_set = 1;
+			vtab->cache_size = !numeric && on >= 0 ? on*STATEMENT_VTAB_CACHE_DEFAULT_SIZE : 0;
+			if((numeric || on < 0) && parse_size(value,&vtab->cache_size) != SQLITE_OK) {
+				*pzErr = sqlite3_mprintf("invalid cache size: %s",value);
+				ret = SQLITE_MISUSE;
+			}
+		}
+		else if(keylen == 11 && !sqlite3_strnicmp(opt,"materialize",11)) {
+			if((vtab->materialize = on) < 0) {
+				*pzErr = sqlite3_mprintf("materialize must be on or off");
+				ret = SQLITE_MISUSE;
+			}
+		}
+		else if(keylen == 7 && !sqlite3_strnicmp(opt,"workers",7)) {
+			char* end = NULL;
+			long n = value ? strtol(value,&end,10) : 0;
+			if(!value || *end || n < 0 || n > STATEMENT_VTAB_MAX_WORKERS) {
+				*pzErr = sqlite3_mprintf("workers must be a number of threads from 0 to %d",STATEMENT_VTAB_MAX_WORKERS);
+				ret = SQLITE_MISUSE;
+			}
+			vtab->workers = (int)n;
+		}
+		else if(keylen == 8 && !sqlite3_strnicmp(opt,"prefetch",8)) {
+			char* end = NULL;
+			long n = !numeric && on >= 0 ? on*STATEMENT_VTAB_PREFETCH_ROWS : strtol(value,&end,10);
+			if((end && *end) || n < 0 || n > (1 << 20)) {
+				*pzErr = sqlite3_mprintf("invalid prefetch row count: %s",value);
+				ret = SQLITE_MISUSE;
+			}
+			vtab->prefetch = (int)n;
+		}
+		else if(keylen == 7 && !sqlite3_strnicmp(opt,"persist",7)) {
+			if((vtab->persist = on) < 0) {
+				*pzErr = sqlite3_mprintf("persist must be on or off");
+				ret = SQLITE_MISUSE;
+			}
+		}
+		else if(keylen == 7 && !sqlite3_strnicmp(opt,"profile",7)) {
+			if((vtab->profile = on) < 0) {
+				*pzErr = sqlite3_mprintf("profile must be on or off");
+				ret = SQLITE_MISUSE;
+			}
+		}
+		else if(keylen == 6 && !sqlite3_strnicmp(opt,"scalar",6)) {
+			if((vtab->scalar = on) < 0) {
+				*pzErr = sqlite3_mprintf("scalar must be on or off");
+				ret = SQLITE_MISUSE;
+			}
+		}
+		else if(keylen == 7 && !sqlite3_strnicmp(opt,"latency",7)) {
+			if((vtab->latency = on) < 0) {
+				*pzErr = sqlite3_mprintf("latency must be on or off");
+				ret = SQLITE_MISUSE;
+			}
+		}
+		else if(keylen == 4 && !sqlite3_strnicmp(opt,"slow",4)) {
+			// a threshold in milliseconds. switched on without one, every invocation is logged
+			double ms = on > 0 ? 0 : -1;
+			if((numeric || on < 0) && parse_number(value,&ms) != SQLITE_OK) {
+				*pzErr = sqlite3_mprintf("slow must be a number of milliseconds");
+				ret = SQLITE_MISUSE;
+			}
+			vtab->slow_ns = ms < 0 ? -1 : ms < 9e12 ? (sqlite3_int64)(ms*1e6) : LLONG_MAX;
+		}
+		// hints taking the place of what's worked out from the statement
+		else if(keylen == 6 && !sqlite3_strnicmp(opt,"unique",6)) {
+			if((vtab->unique_hint = on) < 0) {
+				*pzErr = sqlite3_mprintf("unique must be on or off");
+				ret = SQLITE_MISUSE;
+			}
+		}
+		else if(keylen == 4 && !sqlite3_strnicmp(opt,"rows",4)) {
+			if(parse_number(value,&vtab->rows_hint) != SQLITE_OK) {
+				*pzErr = sqlite3_mprintf("rows must be a number of rows");
+				ret = SQLITE_MISUSE;
+			}
+		}
+		else if(keylen == 4 && !sqlite3_strnicmp(opt,"cost",4)) {
+			if(parse_number(value,&vtab->filter_cost) != SQLITE_OK) {
+				*pzErr = sqlite3_mprintf("cost must be a number");
+				ret = SQLITE_MISUSE;
+			}
+		}
+		// budgets on each invocation
+		else if(keylen == 8 && !sqlite3_strnicmp(opt,"max_rows",8)) {
+			double n = 0;
+			if(parse_number(value,&n) != SQLITE_OK) {
+				*pzErr = sqlite3_mprintf("max_rows must be a number of rows");
+				ret = SQLITE_MISUSE;
+			}
+			vtab->max_rows = n < 9e18 ? (sqlite3_int64)n : LLONG_MAX;
+		}
+		else if(keylen == 9 && !sqlite3_strnicmp(opt,"max_steps",9)) {
+			double n = 0;
+			if(parse_number(value,&n) != SQLITE_OK) {
+				*pzErr = sqlite3_mprintf("max_steps must be a number of instructions");
+				ret = SQLITE_MISUSE;
+			}
+			vtab->max_steps = n < 9e18 ? (sqlite3_int64)n : LLONG_MAX;
+		}
+		else if(keylen == 6 && !sqlite3_strnicmp(opt,"max_ms",6)) {
+			double ms = 0;
+			if(parse_number(value,&ms) != SQLITE_OK) {
+				*pzErr = sqlite3_mprintf("max_ms must be a number of milliseconds");
+				ret = SQLITE_MISUSE;
+			}
+			vtab->max_ns = ms < 9e12 ? (sqlite3_int64)(ms*1e6) : LLONG_MAX;
+		}
+		else if(keylen == 8 && !sqlite3_strnicmp(opt,"truncate",8)) {
+			if((vtab->truncate = on) < 0) {
+				*pzErr = sqlite3_mprintf("truncate must be on or off");
+				ret = SQLITE_MISUSE;
+			}
+		}
+		else {
+			*pzErr = sqlite3_mprintf("unknown option: %.*s",(int)keylen,opt);
+			ret = SQLITE_MISUSE;
+		}
+	}
+	sqlite3_free(value);
+	if(ret != SQLITE_OK && !*pzErr)
+		ret = SQLITE_NOMEM;
+	return ret;
+}
+
+// everything learned about a statement from preparing it when the vtab is set up, shared between connections to the same database file
+// so that only the first of them to connect has to do so. entries are keyed on the file and statement and stamped with main's
+// schema cookie and a hash of what else on the connection names in the statement could refer to, which together change along
+// with anything the statement's columns could depend on
+struct statement_decl {
+	struct statement_decl* next;
+	char* filename;
+	char* sql;
+	char* inlined; // the statement run in place of sql, with other statement vtabs spliced in, or NULL
+	sqlite3_int64 schema_version;
+	sqlite3_uint64 context;
+	char* create;
+	int num_inputs;
+	int num_outputs;
+	char* output_typed;
+	double est_rows;
+	int unique;
+	int deterministic;
+	int num_ranges;
+	int num_range_columns;
+	int batched;
+	struct statement_range* ranges;
+	int num_sorts;
+};
+
+// the cache lives as long as some connection has the module registered, so that a loadable extension
+// unloaded once its last connection closes doesn't leave anything behind
+static struct statement_decl* statement_decls;
+static int statement_num_decls;
+static int statement_num_registries;
+static struct statement_registry* statement_registries;
+
+static void statement_decl_free(struct statement_decl* decl) {
+	if(!decl)
+		return;
+	sqlite3_free(decl->filename);
+	sqlite3_free(decl->sql);
+	sqlite3_free(decl->inlined);
+	sqlite3_free(decl->create);
+	sqlite3_free(decl->output_typed);
+	for(int i = 0; i < decl->num_ranges; i++)
+		sqlite3_free(decl->ranges[i].name);
+	sqlite3_free(decl->ranges);
+	sqlite3_free(decl);
+}
+
+static int statement_ranges_copy(struct statement_range** dst, const struct statement_range* src, int num_ranges) {
+	*dst = NULL;
+	if(!num_ranges)
+		return SQLITE_OK;
+	if(!(*dst = sqlite3_malloc64(sizeof(**dst)*num_ranges)))
+		return SQLITE_NOMEM;
+	memcpy(*dst,src,sizeof(**dst)*num_ranges);
+	for(int i = 0; i < num_ranges; i++)
+		(*dst)[i].name = NULL;
+	for(int i = 0; i < num_ranges; i++)
+		if(!((*dst)[i].name = sqlite3_mprintf("%s",src[i].name)))
+			return SQLITE_NOMEM;
+	return SQLITE_OK;
+}
+
+// find the database file and schema cookie a vtab's declaration would be cached under, or set filename to NULL if it can't be.
+// temporary databases aren't shared, temp objects may shadow the statement's tables, and a cookie read inside a write transaction may yet be rolled back
+static int statement_decl_key(struct statement_vtab* vtab, const char** filename, sqlite3_int64* schema_version) {
+	*filename = NULL;
+	*schema_version = 0;
+	const char* file = sqlite3_db_filename(vtab->db,"main");
+	if(!file || !*file || strcmp(vtab->schema,"main") || !statement_cache_usable(vtab))
+		return SQLITE_OK;
+
+	sqlite3_stmt* stmt;
+	int ret = sqlite3_prepare_v2(vtab->db,"SELECT schema_version, (SELECT count(*) FROM temp.sqlite_master) FROM pragma_schema_version",-1,&stmt,NULL);
+	if(ret != SQLITE_OK)
+		return ret;
+	if((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		*schema_version = sqlite3_column_int64(stmt,0);
+		if(!sqlite3_column_int(stmt,1))
+			*filename = file;
+		ret = SQLITE_OK;
+	}
+	sqlite3_finalize(stmt);
+	return ret == SQLITE_DONE ? SQLITE_ERROR : ret;
+}
+
+// hash the databases attached to the connection along with their schema versions, which change without main's, and the functions,
+// collations and modules registered on it, which can differ between connections to the same file. rows are hashed independently
+// of their order, which can differ too. sets ok to 0 if the connection can't list them, in which case declarations aren't shared
+static int statement_decl_context(sqlite3* db, sqlite3_uint64* hash, int* ok) {
+	// temp is only listed once it's been used or has an attached file, and pragma modules once they're queried
+	static const char* const lists[] = {
+		"SELECT name, file FROM pragma_database_list WHERE name <> 'temp'",
+		"SELECT * FROM pragma_function_list",
+		"SELECT name FROM pragma_collation_list",
+		"SELECT name FROM pragma_module_list WHERE name NOT LIKE 'pragma\\_%' ESCAPE '\\'",
+	};
+	*hash = 0;
+	*ok = 0;
+	for(int i = 0; i < (int)(sizeof(lists)/sizeof(*lists)); i++) {
+		sqlite3_stmt* stmt;
+		if(sqlite3_prepare_v2(db,lists[i],-1,&stmt,NULL) != SQLITE_OK)
+			return sqlite3_errcode(db) == SQLITE_NOMEM ? SQLITE_NOMEM : SQLITE_OK;
+		int ret;
+		while((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+			sqlite3_uint64 row = (0xcbf29ce484222325ull ^ i) * 0x100000001b3ull;
+			for(int c = 0; c < sqlite3_column_count(stmt); c++) {
+				for(const unsigned char* text = sqlite3_column_text(stmt,c); text && *text; text++)
+					row = (row ^ *text) * 0x100000001b3ull;
+				// 0xff never appears in UTF-8, so separates the values
+				row = (row ^ 0xff) * 0x100000001b3ull;
+			}
+			*hash += row;
+		}
+		sqlite3_finalize(stmt);
+		if(ret != SQLITE_DONE)
+			return ret;
+	}
+	sqlite3_uint64 versions;
+	int ret = statement_schema_versions(db,&versions);
+	if(ret != SQLITE_OK)
+		return ret;
+	*hash += versions;
+	*ok = 1;
+	return SQLITE_OK;
+}
+
+static void statement_registry_release(struct statement_registry* registry) {
+	struct statement_decl* decls = NULL;
+	sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MAIN);
+	sqlite3_mutex_enter(mutex);
+	if(--registry->refs) {
+		sqlite3_mutex_leave(mutex);
+		return;
+	}
+	if(!--statement_num_registries) {
+		decls = statement_decls;
+		statement_decls = NULL;
+		statement_num_decls = 0;
+	}
+	sqlite3_mutex_leave(mutex);
+	while(decls) {
+		struct statement_decl* next = decls->next;
+		statement_decl_free(decls);
+		decls = next;
+	}
+	sqlite3_free(registry);
+}
+
+// the registry of a connection, with a reference taken for the caller
+static struct statement_registry* statement_registry_find(sqlite3* db) {
+	struct statement_registry* registry;
+	sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MAIN);
+	sqlite3_mutex_enter(mutex);
+	for(registry = statement_registries; registry && registry->db != db; registry = registry->next)
+		;
+	if(registry)
+		registry->refs++;
+	sqlite3_mutex_leave(mutex);
+	return registry;
+}
+
+// destructor of the statement module
+static void statement_registry_free(void* p) {
+	sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MAIN);
+	sqlite3_mutex_enter(mutex);
+	for(struct statement_registry** prev = &statement_registries; *prev; prev = &(*prev)->next)
+		if(*prev == p) {
+			*prev = (*prev)->next;
+			break;
+		}
+	sqlite3_mutex_leave(mutex);
+	statement_registry_release(p);
+}
+
+// fill in the vtab from a cached declaration if there is one, setting create to the statement to declare it with
+static int statement_decl_lookup(struct statement_vtab* vtab, const char* filename, sqlite3_int64 schema_version, sqlite3_uint64 context, char** create) {
+	int ret = SQLITE_OK;
+	*create = NULL;
+	sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MAIN);
+	sqlite3_mutex_enter(mutex);
+	struct statement_decl* decl = statement_decls;
+	while(decl && (decl->schema_version != schema_version || decl->context != context || strcmp(decl->sql,vtab->sql) || strcmp(decl->filename,filename)))
+		decl = decl->next;
+	if(!decl)
+		goto end;
+
+	if(decl->inlined) {
+		char* inlined = sqlite3_mprintf("%s",decl->inlined);
+		if(!inlined) {
+			ret = SQLITE_NOMEM;
+			goto end;
+		}
+		vtab->written = vtab->sql;
+		vtab->sql = inlined;
+		vtab->sql_len = strlen(inlined);
+	}
+
+	struct statement_variant* variant;
+	if(!(*create = sqlite3_mprintf("%s",decl->create)) ||
+	   !(vtab->output_typed = sqlite3_malloc64(decl->num_outputs+1)) ||
+	   (ret = statement_ranges_copy(&vtab->ranges,decl->ranges,decl->num_ranges)) != SQLITE_OK ||
+	   !(variant = statement_vtab_new_variant(vtab,sqlite3_mprintf("%s",vtab->sql),1))) {
+		vtab->num_ranges = vtab->ranges ? decl->num_ranges : 0;
+		ret = SQLITE_NOMEM;
+		goto end;
+	}
+	// the first cursor to use it prepares it
+	variant->num_sorts = decl->num_sorts;
+	vtab->num_variants = 1;
+	memcpy(vtab->output_typed,decl->output_typed,decl->num_outputs+1);
+	vtab->num_inputs = decl->num_inputs;
+	vtab->num_outputs = decl->num_outputs;
+	vtab->est_rows = decl->est_rows;
+	vtab->unique = decl->unique;
+	vtab->deterministic = decl->deterministic;
+	vtab->num_ranges = decl->num_ranges;
+	vtab->num_range_columns = decl->num_range_columns;
+	vtab->batched = decl->batched;
+
+end:
+	sqlite3_mutex_leave(mutex);
+	return ret;
+}
+
+// remember how a vtab was declared, replacing any entry for an older schema and dropping the oldest entries once there are too many
+static int statement_decl_store(struct statement_vtab* vtab, const char* filename, sqlite3_int64 schema_version, sqlite3_uint64 context, const char* create, const char* sql, size_t sql_len) {
+	struct statement_decl* decl = sqlite3_malloc64(sizeof(*decl));
+	if(!decl)
+		return SQLITE_NOMEM;
+	memset(decl,0,sizeof(*decl));
+	decl->schema_version = schema_version;
+	decl->context = context;
+	decl->num_inputs = vtab->num_inputs;
+	decl->num_outputs = vtab->num_outputs;
+	decl->est_rows = vtab->est_rows;
+	decl->unique = vtab->unique;
+	decl->deterministic = vtab->deterministic;
+	decl->num_range_columns = vtab->num_range_columns;
+	decl->batched = vtab->batched;
+	decl->num_sorts = vtab->variants[0]->num_sorts;
+	if(!(decl->filename = sqlite3_mprintf("%s",filename)) ||
+	   !(decl->sql = sqlite3_mprintf("%.*s",(int)sql_len,sql)) ||
+	   (strcmp(decl->sql,vtab->sql) && !(decl->inlined = sqlite3_mprintf("%s",vtab->sql))) ||
+	   !(decl->create = sqlite3_mprintf("%s",create)) ||
+	   !(decl->output_typed = sqlite3_malloc64(vtab->num_outputs+1)) ||
+	   statement_ranges_copy(&decl->ranges,vtab->ranges,vtab->num_ranges) != SQLITE_OK) {
+		decl->num_ranges = decl->ranges ? vtab->num_ranges : 0;
+		statement_decl_free(decl);
+		return SQLITE_NOMEM;
+	}
+	decl->num_ranges = vtab->num_ranges;
+	memcpy(decl->output_typed,vtab->output_typed,vtab->num_outputs+1);
+
+	struct statement_decl* evicted = NULL;
+	sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MAIN);
+	sqlite3_mutex_enter(mutex);
+	decl->next = statement_decls;
+	statement_decls = decl;
+	statement_num_decls++;
+	for(struct statement_decl** prev = &decl->next; *prev;) {
+		struct statement_decl* old = *prev;
+		if((statement_num_decls > STATEMENT_VTAB_DECL_CACHE_SIZE && !old->next) ||
+		   (old->context == decl->context && !strcmp(old->sql,decl->sql) && !strcmp(old->filename,decl->filename))) {
+			*prev = old->next;
+			old->next = evicted;
+			evicted = old;
+			statement_num_decls--;
+		}
+		else prev = &old->next;
+	}
+	sqlite3_mutex_leave(mutex);
+
+	while(evicted) {
+		struct statement_decl* next = evicted->next;
+		statement_decl_free(evicted);
+		evicted = next;
+	}
+	return SQLITE_OK;
+}
+
+// let go of the function's statement, once it's done with if a call is running it
+static void statement_scalar_reset(struct statement_scalar* scalar) {
+	if(scalar->busy)
+		scalar->stale = 1;
+	else {
+		sqlite3_finalize(scalar->stmt);
+		scalar->stmt = NULL;
+	}
+}
+
+#ifdef STATEMENT_VTAB_WORKERS
+static void statement_workers_free(struct statement_workers* pool);
+static void statement_cursor_unjob(struct statement_cursor* cur);
+#endif
+
+static int statement_vtab_destroy(sqlite3_vtab* pVTab){
+	struct statement_vtab* vtab = (struct statement_vtab*)pVTab;
+	if(vtab->registry_prev)
+		vtab->registry_prev->registry_next = vtab->registry_next;
+	else if(vtab->registry && vtab->registry->head == vtab)
+		vtab->registry->head = vtab->registry_next;
+	if(vtab->registry_next)
+		vtab->registry_next->registry_prev = vtab->registry_prev;
+	if(vtab->function) {
+		vtab->function->vtab = NULL;
+		statement_scalar_reset(vtab->function);
+	}
+	statement_pool_clear(vtab);
+	for(int i = 0; i < vtab->num_variants; i++) {
+#ifdef STATEMENT_VTAB_SCANSTATUS
+		for(int p = 0; p < vtab->variants[i]->num_profiled; p++)
+			sqlite3_free(vtab->variants[i]->profiled[p].detail);
+		sqlite3_free(vtab->variants[i]->profiled);
+#endif
+		sqlite3_free(vtab->variants[i]->sql);
+		sqlite3_free(vtab->variants[i]);
+	}
+	sqlite3_free(vtab->variants);
+	for(int i = 0; i < vtab->num_plans; i++)
+		sqlite3_free(vtab->plans[i]);
+	sqlite3_free(vtab->plans);
+	for(int i = 0; i < vtab->num_param_maps; i++)
+		sqlite3_free(vtab->param_maps[i]);
+	sqlite3_free(vtab->param_maps);
+	for(int i = 0; i < STATEMENT_VTAB_MEMO_SIZE; i++)
+		if(vtab->memos[i]) {
+			sqlite3_free(vtab->memos[i]->key);
+			sqlite3_free(vtab->memos[i]);
+		}
+	statement_cache_free(vtab);
+	if(vtab->mat) {
+		vtab->mat->stale = 1;
+		statement_mat_release(vtab,vtab->mat);
+	}
+#ifdef STATEMENT_VTAB_WORKERS
+	statement_workers_free(vtab->pool);
+#endif
+	sqlite3_finalize(vtab->generation_stmt);
+	sqlite3_finalize(vtab->persist_lookup);
+	sqlite3_finalize(vtab->persist_insert);
+	sqlite3_finalize(vtab->persist_row);
+	sqlite3_free(vtab->output_typed);
+	for(int i = 0; i < vtab->num_ranges; i++)
+		sqlite3_free(vtab->ranges[i].name);
+	sqlite3_free(vtab->ranges);
+#ifndef STATEMENT_VTAB_OMIT_STATS
+	statement_stats_clear(&vtab->stats);
+#endif
+	sqlite3_free(vtab->sql);
+	sqlite3_free(vtab->written);
+	sqlite3_free(vtab->schema);
+	sqlite3_free(vtab->name);
+	sqlite3_free(vtab);
+	return SQLITE_OK;
+}
+
+static void statement_scalar_call(sqlite3_context* ctx, int argc, sqlite3_value** argv);
+
+static void statement_scalar_free(void* p) {
+	struct statement_scalar* scalar = p;
+	for(struct statement_scalar** prev = &scalar->registry->scalars; *prev; prev = &(*prev)->next)
+		if(*prev == scalar) {
+			*prev = scalar->next;
+			break;
+		}
+	if(scalar->vtab)
+		scalar->vtab->function = NULL;
+	sqlite3_finalize(scalar->stmt);
+	statement_registry_release(scalar->registry);
+	sqlite3_free(scalar->name);
+	sqlite3_free(scalar);
+}
+
+// define the function for a scalar vtab of the given name, unless it already is
+static int statement_scalar_define(struct statement_registry* registry, sqlite3* db, const char* name) {
+	struct statement_scalar* scalar = registry->scalars;
+	while(scalar && sqlite3_stricmp(scalar->name,name))
+		scalar = scalar->next;
+	if(scalar)
+		return SQLITE_OK;
+	if(!(scalar = sqlite3_malloc64(sizeof(*scalar))))
+		return SQLITE_NOMEM;
+	memset(scalar,0,sizeof(*scalar));
+	if(!(scalar->name = sqlite3_mprintf("%s",name))) {
+		sqlite3_free(scalar);
+		return SQLITE_NOMEM;
+	}
+	sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MAIN);
+	sqlite3_mutex_enter(mutex);
+	registry->refs++;
+	sqlite3_mutex_leave(mutex);
+	scalar->registry = registry;
+	scalar->next = registry->scalars;
+	registry->scalars = scalar;
+	// sqlite frees the function's data if this fails
+	return sqlite3_create_function_v2(db,name,-1,SQLITE_UTF8,scalar,statement_scalar_call,NULL,NULL,statement_scalar_free);
+}
+
+// whether a statement vtab's CREATE VIRTUAL TABLE statement gives the scalar option. module arguments are split as sqlite
+// does, at commas outside of parentheses, and other options are checked along the way as they would be when it's connected
+static int statement_scalar_declared(const char* create) {
+	int type, len, ret = 0;
+	const char* p = statement_token_next(create,&type,&len);
+	while(type != STATEMENT_TOKEN_END && !statement_token_keyword(p,type,len,"using"))
+		p = statement_token_next(p+len,&type,&len);
+	if(type == STATEMENT_TOKEN_END)
+		return 0;
+	p = statement_token_next(p+len,&type,&len);
+	if(type != STATEMENT_TOKEN_ID || !statement_token_names(p,len,"statement"))
+		return 0;
+	p = statement_token_next(p+len,&type,&len);
+	if(*p != '(')
+		return 0;
+
+	const char* args[STATEMENT_VTAB_MAX_OPTIONS+4] = {NULL};
+	char* texts[STATEMENT_VTAB_MAX_OPTIONS+1] = {NULL};
+	int argc = 3, depth = 0;
+	const char* arg = p+1;
+	for(p = statement_token_next(p+1,&type,&len); type != STATEMENT_TOKEN_END; p = statement_token_next(p+len,&type,&len)) {
+		if(type != STATEMENT_TOKEN_OTHER)
+			continue;
+		if(*p == '(')
+			depth++;
+		else if(*p == ')' && depth)
+			depth--;
+		else if(*p == ',' ? !depth : *p == ')') {
+			if(argc == STATEMENT_VTAB_MAX_OPTIONS+4)
+				goto end;
+			while(isspace((unsigned char)*arg))
+				arg++;
+			size_t arg_len = p-arg;
+			while(arg_len && isspace((unsigned char)arg[arg_len-1]))
+				arg_len--;
+			if(!(texts[argc-3] = sqlite3_mprintf("%.*s",(int)arg_len,arg)))
+				goto end;
+			args[argc] = texts[argc-3];
+			argc++;
+			arg = p+1;
+			if(*p == ')')
+				break;
+		}
+	}
+	char* err = NULL;
+	struct statement_vtab scratch;
+	memset(&scratch,0,sizeof(scratch));
+	ret = type != STATEMENT_TOKEN_END && statement_vtab_parse_options(&scratch,argc,args,&err) == SQLITE_OK && scratch.scalar > 0;
+	sqlite3_free(err);
+
+end:
+	for(int i = 0; i <= STATEMENT_VTAB_MAX_OPTIONS; i++)
+		sqlite3_free(texts[i]);
+	return ret;
+}
+
+// define the functions of scalar vtabs already in the schema, so that they can be called before anything connects the vtab.
+// the schema may not be readable yet, for instance as the connection is opened, in which case this is left to connecting them
+static void statement_scalar_scan(struct statement_registry* registry, sqlite3* db) {
+	sqlite3_stmt* schemas;
+	if(sqlite3_prepare_v2(db,"SELECT name FROM pragma_database_list",-1,&schemas,NULL) == SQLITE_OK) {
+		while(sqlite3_step(schemas) == SQLITE_ROW) {
+			sqlite3_stmt* tables;
+			char* sql = sqlite3_mprintf("SELECT name, sql FROM \"%w\".sqlite_master WHERE type = 'table' AND sql LIKE 'CREATE VIRTUAL TABLE%%'",
+			                            (const char*)sqlite3_column_text(schemas,0));
+			if(!sql || sqlite3_prepare_v2(db,sql,-1,&tables,NULL) != SQLITE_OK) {
+				sqlite3_free(sql);
+				break;
+			}
+			sqlite3_free(sql);
+			while(sqlite3_step(tables) == SQLITE_ROW)
+				if(statement_scalar_declared((const char*)sqlite3_column_text(tables,1)))
+					statement_scalar_define(registry,db,(const char*)sqlite3_column_text(tables,0));
+			sqlite3_finalize(tables);
+		}
+	}
+	sqlite3_finalize(schemas);
+	// none of this is an error of the caller's, which a connection being opened would otherwise fail with
+	if(sqlite3_errcode(db) != SQLITE_OK && sqlite3_prepare_v2(db,"SELECT 1",-1,&schemas,NULL) == SQLITE_OK)
+		sqlite3_finalize(schemas);
+}
+
+// set up the vtab for xCreate or xConnect. connecting uses a cached declaration when available, in which case nothing is prepared until first used
+static int statement_vtab_init(sqlite3* db, void* pAux, int argc, const char* const* argv, sqlite3_vtab** ppVtab, char** pzErr, int connect) {
+	size_t len;
+	if(argc < 4 || (len = strlen(argv[3])) < 3) {
+		if(!(*pzErr = sqlite3_mprintf("no statement provided")))
+			return SQLITE_NOMEM;
+		return SQLITE_MISUSE;
+	}
+	if(argv[3][0] != '(' || argv[3][len-1] != ')') {
+		if(!(*pzErr = sqlite3_mprintf("statement must be parenthesized")))
+			return SQLITE_NOMEM;
+		return SQLITE_MISUSE;
+	}
+
+	int ret;
+	sqlite3_stmt* stmt = NULL;
+	char* create = NULL;
+
+	struct statement_vtab* vtab = sqlite3_malloc64(sizeof(*vtab));
+	if(!vtab)
+		return SQLITE_NOMEM;
+	memset(vtab,0,sizeof(*vtab));
+	*ppVtab = &vtab->base;
+
+	vtab->db = db;
+	vtab->registry = pAux;
+	vtab->sql_len = len-2;
+	if(!(vtab->sql = sqlite3_mprintf("%.*s",vtab->sql_len,argv[3]+1)) ||
+	   !(vtab->schema = sqlite3_mprintf("%s",argv[1])) ||
+	   !(vtab->name = sqlite3_mprintf("%s",argv[2]))) {
+		ret = SQLITE_NOMEM;
+		goto error;
+	}
+
+	vtab->rows_hint = -1;
+	vtab->filter_cost = STATEMENT_VTAB_FILTER_COST;
+	vtab->unique_hint = -1;
+	vtab->slow_ns = -1;
+	vtab->truncated_column = -1;
+	if((ret = statement_vtab_parse_options(vtab,argc,argv,pzErr)) != SQLITE_OK)
+		goto error;
+
+	// xCreate always prepares, as its own schema change leaves the cookie stale anyway
+	const char* filename = NULL;
+	sqlite3_int64 schema_version = 0;
+	sqlite3_uint64 context = 0;
+	int shared = 0;
+	if(connect && (ret = statement_decl_key(vtab,&filename,&schema_version)) != SQLITE_OK)
+		goto sqlite_error;
+	if(filename && (ret = statement_decl_context(db,&context,&shared)) != SQLITE_OK)
+		goto sqlite_error;
+	if(!shared)
+		filename = NULL;
+	if(filename && (ret = statement_decl_lookup(vtab,filename,schema_version,context,&create)) != SQLITE_OK)
+		goto error;
+	if(create && vtab->written && (ret = statement_schema_versions(db,&vtab->written_schemas)) != SQLITE_OK)
+		goto sqlite_error;
+	if(create)
+		goto declare;
+
+	if((ret = sqlite3_prepare_v2(db,vtab->sql,vtab->sql_len,&stmt,NULL)) != SQLITE_OK)
+		goto sqlite_error;
+	if(!sqlite3_stmt_readonly(stmt)) {
+		ret = SQLITE_ERROR;
+		if(!(*pzErr = sqlite3_mprintf("Statement must be read only.")))
+			ret = SQLITE_NOMEM;
+		goto error;
+	}
+	if((ret = statement_vtab_inline(vtab,&stmt)) != SQLITE_OK)
+		goto error;
+
+	vtab->num_inputs = sqlite3_bind_parameter_count(stmt);
+	vtab->num_outputs = sqlite3_column_count(stmt);
+	if(!(vtab->output_typed = sqlite3_malloc64(vtab->num_outputs+1))) {
+		ret = SQLITE_NOMEM;
+		goto error;
+	}
+	for(int i = 0; i < vtab->num_outputs; i++)
+		vtab->output_typed[i] = !!sqlite3_column_decltype(stmt,i);
+	vtab->est_rows = statement_vtab_estimate_rows(db,vtab->sql);
+	if((ret = statement_vtab_analyze(vtab)) != SQLITE_OK)
+		goto error;
+
+	int variant;
+	if((ret = statement_vtab_add_variant(vtab,sqlite3_mprintf("%s",vtab->sql),1,&variant)) != SQLITE_OK)
+		goto error;
+	assert(variant == 0);
+
+	if((ret = statement_vtab_find_ranges(vtab,stmt)) != SQLITE_OK)
+		goto error;
+
+	if(!(create = build_create_statement(vtab,stmt))) {
+		ret = SQLITE_NOMEM;
+		goto error;
+	}
+	if(filename && (ret = statement_decl_store(vtab,filename,schema_version,context,create,argv[3]+1,len-2)) != SQLITE_OK)
+		goto error;
+
+declare:
+	if(vtab->materialize && vtab->num_inputs) {
+		ret = SQLITE_MISUSE;
+		if(!(*pzErr = sqlite3_mprintf("materialize requires a statement without parameters")))
+			ret = SQLITE_NOMEM;
+		goto error;
+	}
+	if(vtab->scalar && vtab->num_outputs != 1) {
+		ret = SQLITE_MISUSE;
+		if(!(*pzErr = sqlite3_mprintf("scalar requires a statement with one column")))
+			ret = SQLITE_NOMEM;
+		goto error;
+	}
+	if(vtab->unique_hint >= 0)
+		vtab->unique = vtab->unique_hint;
+	if(vtab->unique)
+		vtab->est_rows = 1;
+	if(vtab->rows_hint >= 0)
+		vtab->est_rows = vtab->rows_hint;
+
+	// persistent results are kept forever, so are only allowed for statements whose results can't change
+	if(vtab->persist && (!vtab->deterministic || vtab->materialize || (vtab->cache_set && !vtab->cache_size))) {
+		ret = SQLITE_MISUSE;
+		if(!(*pzErr = sqlite3_mprintf(vtab->deterministic ? "persist can't be used with materialize or cache=0" :
+		                              "persist requires a statement that reads no tables and calls only deterministic functions")))
+			ret = SQLITE_NOMEM;
+		goto error;
+	}
+	// prefetched rows are handed straight to the cursor, so there's nothing to cache
+	if(vtab->prefetch && (vtab->materialize || vtab->persist || (vtab->cache_set && vtab->cache_size))) {
+		ret = SQLITE_MISUSE;
+		if(!(*pzErr = sqlite3_mprintf("prefetch can't be used with cache, persist or materialize")))
+			ret = SQLITE_NOMEM;
+		goto error;
+	}
+	// budgets are kept by the cursor stepping the statement, which materialized results and workers leave to others
+	int budgeted = vtab->max_rows || vtab->max_steps || vtab->max_ns;
+	if(budgeted && (vtab->materialize || vtab->workers || vtab->prefetch)) {
+		ret = SQLITE_MISUSE;
+		if(!(*pzErr = sqlite3_mprintf("max_rows, max_steps and max_ms can't be used with materialize, workers or prefetch")))
+			ret = SQLITE_NOMEM;
+		goto error;
+	}
+	if(vtab->truncate) {
+		if(!budgeted) {
+			ret = SQLITE_MISUSE;
+			if(!(*pzErr = sqlite3_mprintf("truncate requires max_rows, max_steps or max_ms")))
+				ret = SQLITE_NOMEM;
+			goto error;
+		}
+		// declared after the columns the statement's own declaration has, which is shared by vtabs with other options
+		char* declared = sqlite3_mprintf("%.*s,__truncated hidden)",(int)strlen(create)-1,create);
+		if(!declared) {
+			ret = SQLITE_NOMEM;
+			goto error;
+		}
+		sqlite3_free(create);
+		create = declared;
+		vtab->truncated_column = vtab->num_outputs+vtab->num_inputs+vtab->num_range_columns+(vtab->batched ? 2 : 0);
+	}
+	if(!vtab->cache_set && vtab->deterministic && !vtab->prefetch)
+		vtab->cache_size = STATEMENT_VTAB_CACHE_AUTO_SIZE;
+	if(vtab->cache_size && (ret = statement_cache_init(vtab)) != SQLITE_OK)
+		goto error;
+	if(vtab->persist && !connect) {
+		char* shadow = sqlite3_mprintf("CREATE TABLE IF NOT EXISTS \"%w\".\"%w_cache\"(key BLOB PRIMARY KEY, rows BLOB NOT NULL) WITHOUT ROWID",vtab->schema,vtab->name);
+		if(!shadow) {
+			ret = SQLITE_NOMEM;
+			goto error;
+		}
+		ret = sqlite3_exec(db,shadow,NULL,NULL,NULL);
+		sqlite3_free(shadow);
+		if(ret != SQLITE_OK)
+			goto sqlite_error;
+	}
+
+	if((ret = sqlite3_declare_vtab(db,create)) != SQLITE_OK)
+		goto sqlite_error;
+
+	struct statement_registry* registry = pAux;
+	if((vtab->registry_next = registry->head))
+		registry->head->registry_prev = vtab;
+	registry->head = vtab;
+	if(vtab->scalar && (ret = statement_scalar_define(registry,db,vtab->name)) != SQLITE_OK)
+		goto sqlite_error;
+
+	sqlite3_free(create);
+	sqlite3_finalize(stmt);
+	return SQLITE_OK;
+
+sqlite_error:
+	if(!(*pzErr = sqlite3_mprintf("%s",sqlite3_errmsg(db))))
+		ret = SQLITE_NOMEM;
+error:
+	sqlite3_free(create);
+	sqlite3_finalize(stmt);
+	statement_vtab_destroy(*ppVtab);
+	*ppVtab = NULL;
+	return ret;
+}
+
+static int statement_vtab_drop(sqlite3_vtab* pVTab) {
+	struct statement_vtab* vtab = (struct statement_vtab*)pVTab;
+	if(vtab->persist) {
+		char* sql = sqlite3_mprintf("DROP TABLE IF EXISTS \"%w\".\"%w_cache\"",vtab->schema,vtab->name);
+		if(!sql)
+			return SQLITE_NOMEM;
+		int ret = sqlite3_exec(vtab->db,sql,NULL,NULL,NULL);
+		sqlite3_free(sql);
+		if(ret != SQLITE_OK)
+			return ret;
+	}
+	return statement_vtab_destroy(pVTab);
+}
+
+static int statement_vtab_rename(sqlite3_vtab* pVTab, const char* zNew) {
+	struct statement_vtab* vtab = (struct statement_vtab*)pVTab;
+	char* name = sqlite3_mprintf("%s",zNew);
+	if(!name)
+		return SQLITE_NOMEM;
+	if(vtab->persist) {
+		char* sql = sqlite3_mprintf("ALTER TABLE \"%w\".\"%w_cache\" RENAME TO \"%w_cache\"",vtab->schema,vtab->name,zNew);
+		int ret = sql ? sqlite3_exec(vtab->db,sql,NULL,NULL,NULL) : SQLITE_NOMEM;
+		sqlite3_free(sql);
+		if(ret != SQLITE_OK) {
+			sqlite3_free(name);
+			return ret;
+		}
+	}
+	sqlite3_free(vtab->name);
+	vtab->name = name;
+	return SQLITE_OK;
+}
+
+static int statement_vtab_shadow_name(const char* suffix) {
+	return !sqlite3_stricmp(suffix,"cache");
+}
+
+// if these point to the literal same function sqlite makes statement_vtab eponymous, which we don't want
+static int statement_vtab_create(sqlite3* db, void* pAux, int argc, const char* const* argv, sqlite3_vtab** ppVtab, char** pzErr) {
+	return statement_vtab_init(db,pAux,argc,argv,ppVtab,pzErr,0);
+}
+
+static int statement_vtab_connect(sqlite3* db, void* pAux, int argc, const char* const* argv, sqlite3_vtab** ppVtab, char** pzErr) {
+	return statement_vtab_init(db,pAux,argc,argv,ppVtab,pzErr,1);
+}
+
+static int statement_vtab_open(sqlite3_vtab* pVTab, sqlite3_vtab_cursor** ppCursor) {
+	struct statement_vtab* vtab = (struct statement_vtab*)pVTab;
+	// statements are checked out in xFilter once the plan determines which variant to use
+	size_t size = sizeof(struct statement_cursor) + sizeof(sqlite3_value*)*vtab->num_inputs;
+	struct statement_cursor* cur = sqlite3_malloc64(size);
+	if(!cur)
+		return SQLITE_NOMEM;
+
+	memset(cur,0,size);
+	*ppCursor = &cur->base;
+	cur->param_argv = cur->param_buf;
+	STATEMENT_STAT(vtab,opens,1);
+	return SQLITE_OK;
+}
+
+// drop any cached result being replayed or partially recorded by the cursor
+static void statement_cursor_reset(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	if(cur->replay)
+		statement_cache_release(vtab,cur->replay);
+	cur->replay = NULL;
+	if(cur->mat)
+		statement_mat_release(vtab,cur->mat);
+	cur->mat = NULL;
+	cur->mat_index = NULL;
+	cur->recording = 0;
+	statement_rows_clear(&cur->recorded);
+}
+
+// free the values of the batch tuple last bound
+static void statement_cursor_unbatch(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	if(!cur->batching)
+		return;
+	for(int i = 0; i < vtab->num_inputs; i++) {
+		sqlite3_value_free(cur->param_argv[i]);
+		cur->param_argv[i] = NULL;
+	}
+	cur->batching = 0;
+}
+
+// free the copies of IN list values, once the statement no longer has them bound
+static void statement_cursor_unlist(struct statement_cursor* cur) {
+	for(int i = 0; i < cur->num_in; i++) {
+		for(int j = 0; j < cur->in_args[i].num_values; j++)
+			sqlite3_value_free(cur->in_args[i].values[j]);
+		sqlite3_free(cur->in_args[i].values);
+	}
+	cur->num_in = 0;
+}
+
+#ifndef STATEMENT_VTAB_OMIT_STATS
+// the histogram bucket for a value, by the number of bits it takes
+static int statement_histogram_bucket(sqlite3_int64 n) {
+	int bucket = 0;
+	while(n > 0 && bucket < STATEMENT_VTAB_HISTOGRAM_BUCKETS-1) {
+		n >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+// count the cursor's invocation once it's complete or abandoned, logging it if it was slow
+static void statement_cursor_finish(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	struct statement_stats* stats = &vtab->stats;
+	if(cur->timing) {
+		cur->timing = 0;
+		if(vtab->latency || vtab->slow_ns >= 0)
+			stats->latency_histogram[statement_histogram_bucket(cur->elapsed_ns / 1000)]++;
+		stats->rows_histogram[statement_histogram_bucket(cur->produced)]++;
+		if(vtab->slow_ns >= 0 && cur->elapsed_ns >= vtab->slow_ns) {
+			int i = stats->num_slow++ % STATEMENT_VTAB_SLOW_LOG_SIZE;
+			sqlite3_free(stats->slow[i].args);
+			stats->slow[i].elapsed_ns = cur->elapsed_ns;
+			stats->slow[i].rows = cur->produced;
+			stats->slow[i].args = cur->slow_args;
+			cur->slow_args = NULL;
+		}
+	}
+	sqlite3_free(cur->slow_args);
+	cur->slow_args = NULL;
+}
+#endif
+
+static int statement_vtab_close(sqlite3_vtab_cursor* cur){
+	struct statement_cursor* stmtcur = (struct statement_cursor*)cur;
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->pVtab;
+#ifndef STATEMENT_VTAB_OMIT_STATS
+	statement_cursor_finish(stmtcur);
+#endif
+	statement_cursor_reset(stmtcur);
+#ifdef STATEMENT_VTAB_WORKERS
+	statement_cursor_unjob(stmtcur);
+#endif
+	statement_cursor_unbatch(stmtcur);
+	sqlite3_finalize(stmtcur->batch);
+	if(stmtcur->variant)
+		statement_pool_return(vtab,stmtcur->variant,stmtcur->stmt);
+	statement_cursor_unlist(stmtcur);
+	sqlite3_free(cur);
+	return SQLITE_OK;
+}
+
+// fold the number of rows produced by a completed invocation into the running estimate for its number of bound parameters
+static void statement_cursor_observe(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	if(!cur->observing)
+		return;
+	cur->observing = 0;
+	int bucket = cur->num_bound < STATEMENT_VTAB_OBSERVED_BUCKETS ? cur->num_bound : STATEMENT_VTAB_OBSERVED_BUCKETS-1;
+	if(vtab->observed[bucket].count < STATEMENT_VTAB_OBSERVED_WINDOW)
+		vtab->observed[bucket].count++;
+	vtab->observed[bucket].rows += (cur->num_rows - vtab->observed[bucket].rows) / vtab->observed[bucket].count;
+}
+
+enum { STATEMENT_BUDGET_ROWS = 1, STATEMENT_BUDGET_STEPS, STATEMENT_BUDGET_TIME };
+
+// the budget an invocation has run out of, if any. the clock is only read if needed, once for every cursor being checked
+static int statement_budget_check(struct statement_cursor* cur, sqlite3_int64* now) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	if(vtab->max_steps && sqlite3_stmt_status(cur->stmt,SQLITE_STMTSTATUS_VM_STEP,0) - cur->budget_steps_base + cur->budget_steps_stepping >= vtab->max_steps)
+		return STATEMENT_BUDGET_STEPS;
+	if(vtab->max_ns && !*now)
+		*now = statement_clock_ns();
+	if(vtab->max_ns && *now - cur->budget_start_ns >= vtab->max_ns)
+		return STATEMENT_BUDGET_TIME;
+	return 0;
+}
+
+// interrupt the innermost statement once any invocation stepping has run out of its budget,
+// calling the handler set by sqlite3_statementvtab_progress_handler about as often as it asked for
+static int statement_budget_progress(void* p) {
+	struct statement_registry* registry = p;
+	sqlite3_int64 now = 0;
+	for(struct statement_cursor* cur = registry->budgeted; cur; cur = cur->budget_next) {
+		cur->budget_steps_stepping += registry->budget_ops;
+		if((cur->budget_spent = statement_budget_check(cur,&now)))
+			return 1;
+	}
+	if(!registry->progress)
+		return 0;
+	if((registry->progress_count += registry->budget_ops) < registry->progress_ops)
+		return 0;
+	registry->progress_count = 0;
+	return registry->progress(registry->progress_arg);
+}
+
+static void statement_budget_restore(struct statement_registry* registry) {
+	sqlite3_progress_handler(registry->db,registry->progress ? registry->progress_ops : 0,registry->progress,registry->progress_arg);
+}
+
+// step the statement within the invocation's budget. one that runs out is reset and either fails with SQLITE_INTERRUPT,
+// or with the truncate option is ended by a row flagged as __truncated, which isn't a result to be cached
+static int statement_budget_step(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	struct statement_registry* registry = vtab->registry;
+	int ret;
+	if(vtab->max_steps || vtab->max_ns) {
+		if(!registry->budgeted) {
+			registry->budget_ops = registry->progress && registry->progress_ops < STATEMENT_VTAB_BUDGET_OPS ? registry->progress_ops : STATEMENT_VTAB_BUDGET_OPS;
+			sqlite3_progress_handler(vtab->db,registry->budget_ops,statement_budget_progress,registry);
+		}
+		cur->budget_next = registry->budgeted;
+		registry->budgeted = cur;
+		cur->budget_steps_stepping = 0;
+		ret = statement_step(vtab,cur->stmt);
+		cur->budget_steps_stepping = 0;
+		if(!(registry->budgeted = cur->budget_next))
+			statement_budget_restore(registry);
+	}
+	else
+		ret = statement_step(vtab,cur->stmt);
+
+	// the progress handler only looks every so many instructions, so a row may have been produced after a budget ran out
+	sqlite3_int64 now = 0;
+	if(ret == SQLITE_ROW && !cur->budget_spent && !(cur->budget_spent = statement_budget_check(cur,&now)) &&
+	   vtab->max_rows && cur->budget_rows++ >= vtab->max_rows)
+		cur->budget_spent = STATEMENT_BUDGET_ROWS;
+	if(!cur->budget_spent)
+		return ret;
+
+	STATEMENT_STAT(vtab,over_budget,1);
+	sqlite3_reset(cur->stmt);
+	cur->recording = 0;
+	statement_rows_clear(&cur->recorded);
+	if(vtab->truncate) {
+		cur->truncated = 1;
+		return SQLITE_ROW;
+	}
+	static const char* const budgets[] = {"max_rows","max_steps","max_ms"};
+	sqlite3_free(vtab->base.zErrMsg);
+	vtab->base.zErrMsg = sqlite3_mprintf("%s ran out of its %s budget",vtab->name,budgets[cur->budget_spent-1]);
+	return vtab->base.zErrMsg ? SQLITE_INTERRUPT : SQLITE_NOMEM;
+}
+
+// step the inner statement, capturing its results if they're to be cached once complete
+static int statement_cursor_step(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	int ret = vtab->max_rows || vtab->max_steps || vtab->max_ns ? statement_budget_step(cur) : statement_step(vtab,cur->stmt);
+	if(!cur->recording)
+		return ret;
+
+	int err = SQLITE_OK;
+	if(ret == SQLITE_ROW) {
+		if((err = statement_rows_append(&cur->recorded,cur->stmt)) == SQLITE_OK && cur->recorded.size <= vtab->cache->limit)
+			return ret;
+	}
+	else if(ret == SQLITE_DONE && statement_cache_usable(vtab) && (err = statement_cache_validate(vtab)) == SQLITE_OK) {
+		// only keep results if nothing they depend on changed while they were being computed
+		if(!memcmp(&cur->recorded_generation,&vtab->cache->generation,sizeof(cur->recorded_generation)) &&
+		   (!vtab->persist || (err = statement_persist_store(cur)) == SQLITE_OK))
+			err = statement_cache_insert(vtab,cur->variant->index,cur->param_argv,&cur->recorded);
+	}
+	cur->recording = 0;
+	statement_rows_clear(&cur->recorded);
+	return err == SQLITE_OK ? ret : err;
+}
+
+// run the statement for the cursor's current bindings, replaying the results from the cache if possible
+// returns SQLITE_ROW if this produced a row or SQLITE_DONE if not
+static int statement_cursor_invoke(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	int ret;
+	// results are only cached and observed for variants producing the same rows as the statement,
+	// since others' depend on more than its parameters
+	int exact = cur->variant->exact;
+	cur->num_rows = 0;
+	cur->observing = exact;
+	if(exact && vtab->cache && statement_cache_usable(vtab)) {
+		if((ret = statement_cache_validate(vtab)) != SQLITE_OK)
+			return ret;
+		cur->replay = statement_cache_lookup(vtab,cur->variant->index,cur->param_argv);
+		if(!cur->replay && vtab->persist && (ret = statement_persist_lookup(cur)) != SQLITE_OK)
+			return ret;
+		if(cur->replay) {
+			STATEMENT_STAT(vtab,cache_hits,1);
+			cur->replay->refs++;
+			cur->replay_row = 0;
+			if(cur->replay->rows.num_rows) {
+				cur->num_rows++;
+				return SQLITE_ROW;
+			}
+			statement_cursor_observe(cur);
+			return SQLITE_DONE;
+		}
+		STATEMENT_STAT(vtab,cache_misses,1);
+		cur->recording = 1;
+		cur->recorded.num_cols = vtab->num_outputs;
+		cur->recorded_generation = vtab->cache->generation;
+	}
+
+	ret = statement_cursor_step(cur);
+	if(ret == SQLITE_ROW)
+		cur->num_rows++;
+	else if(ret == SQLITE_DONE)
+		statement_cursor_observe(cur);
+	return ret;
+}
+
+// bind an argument or IN list value, which stay put until the statement is next reset (and so rebound) or the scan ends.
+// results can't be passed through the same way since sqlite may hold on to them (e.g. for max()) after the cursor moves on
+// a variant may have had its last parameters replaced by the constants it was planned for, which leaves nothing to bind
+static int statement_bind_value(sqlite3_stmt* stmt, int param_idx, sqlite3_value* v) {
+	if(param_idx > sqlite3_bind_parameter_count(stmt))
+		return SQLITE_OK;
+	int type = sqlite3_value_type(v);
+	if(STATEMENT_VTAB_STATIC_BIND_SIZE && (type == SQLITE_TEXT || type == SQLITE_BLOB)) {
+		const void* data = type == SQLITE_TEXT ? (const void*)sqlite3_value_text(v) : sqlite3_value_blob(v);
+		int len = sqlite3_value_bytes(v);
+		if(len >= STATEMENT_VTAB_STATIC_BIND_SIZE && data)
+			return type == SQLITE_TEXT ? sqlite3_bind_text(stmt,param_idx,data,len,SQLITE_STATIC) : sqlite3_bind_blob(stmt,param_idx,data,len,SQLITE_STATIC);
+	}
+	return sqlite3_bind_value(stmt,param_idx,v);
+}
+
+// the scalar vtab a function call is for, if there is one on the connection
+static struct statement_vtab* statement_scalar_vtab(struct statement_scalar* scalar) {
+	struct statement_vtab* vtab = scalar->registry->head;
+	while(vtab && !(vtab->scalar && !sqlite3_stricmp(vtab->name,scalar->name)))
+		vtab = vtab->registry_next;
+	return vtab;
+}
+
+// the function defined by the scalar option binds its arguments to the statement without going through a cursor,
+// producing the first column of the first row or NULL if there isn't one
+static void statement_scalar_call(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+	struct statement_scalar* scalar = sqlite3_user_data(ctx);
+	sqlite3* db = sqlite3_context_db_handle(ctx);
+	int ret;
+	struct statement_vtab* vtab = statement_scalar_vtab(scalar);
+	if(!vtab) {
+		// a vtab in the schema that hasn't been connected yet is by preparing a query of it
+		sqlite3_stmt* connect = NULL;
+		char* sql = sqlite3_mprintf("SELECT 1 FROM \"%w\"",scalar->name);
+		if(!sql) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+		sqlite3_prepare_v2(db,sql,-1,&connect,NULL);
+		sqlite3_free(sql);
+		sqlite3_finalize(connect);
+	}
+	if(!vtab && !(vtab = statement_scalar_vtab(scalar))) {
+		char* err = sqlite3_mprintf("no such function: %s",scalar->name);
+		sqlite3_result_error(ctx,err ? err : "out of memory",-1);
+		sqlite3_free(err);
+		return;
+	}
+	if(argc != vtab->num_inputs) {
+		char* err = sqlite3_mprintf("wrong number of arguments to function %s()",scalar->name);
+		sqlite3_result_error(ctx,err ? err : "out of memory",-1);
+		sqlite3_free(err);
+		return;
+	}
+	// a statement prepared for a vtab that's since gone is let go of by statement_vtab_destroy
+	if(scalar->vtab != vtab) {
+		if(scalar->vtab)
+			scalar->vtab->function = NULL;
+		statement_scalar_reset(scalar);
+		scalar->vtab = vtab;
+		vtab->function = scalar;
+	}
+
+	ret = SQLITE_OK;
+	int own = scalar->busy;
+	sqlite3_stmt* stmt = own ? NULL : scalar->stmt;
+	if(!stmt && (ret = sqlite3_prepare_v3(db,vtab->sql,-1,own ? 0 : SQLITE_PREPARE_PERSISTENT,&stmt,NULL)) != SQLITE_OK) {
+		sqlite3_result_error(ctx,sqlite3_errmsg(db),-1);
+		sqlite3_result_error_code(ctx,ret);
+		return;
+	}
+	if(!own) {
+		scalar->stmt = stmt;
+		scalar->busy = 1;
+	}
+	int reprepares = sqlite3_stmt_status(stmt,SQLITE_STMTSTATUS_REPREPARE,0);
+	for(int i = 0; i < argc && ret == SQLITE_OK; i++)
+		ret = statement_bind_value(stmt,i+1,argv[i]);
+	if(ret == SQLITE_OK)
+		ret = sqlite3_step(stmt);
+	// sqlite recompiles the statement as it steps after a schema change, which the statements spliced into it may not survive.
+	// if the splicing has to be done over, the call is run again with a statement of its own
+	int changed = 0;
+	if((ret == SQLITE_ROW || ret == SQLITE_DONE) && vtab->written && sqlite3_stmt_status(stmt,SQLITE_STMTSTATUS_REPREPARE,0) != reprepares) {
+		int err = statement_vtab_reinline(vtab,&changed);
+		if(err != SQLITE_OK)
+			ret = err;
+	}
+	if(changed) {
+		sqlite3_reset(stmt);
+		sqlite3_stmt* again;
+		if((ret = sqlite3_prepare_v2(db,vtab->sql,-1,&again,NULL)) == SQLITE_OK) {
+			for(int i = 0; i < argc && ret == SQLITE_OK; i++)
+				ret = sqlite3_bind_value(again,i+1,argv[i]);
+			if(ret == SQLITE_OK)
+				ret = sqlite3_step(again);
+			if(ret == SQLITE_ROW)
+				sqlite3_result_value(ctx,sqlite3_column_value(again,0));
+			sqlite3_finalize(again);
+		}
+	}
+	else if(ret == SQLITE_ROW)
+		sqlite3_result_value(ctx,sqlite3_column_value(stmt,0));
+	if(ret != SQLITE_ROW && ret != SQLITE_DONE) {
+		sqlite3_result_error(ctx,sqlite3_errmsg(db),-1);
+		sqlite3_result_error_code(ctx,ret);
+	}
+	// the vtab may have been disconnected while the statement ran
+	if(scalar->vtab) {
+		STATEMENT_STAT(scalar->vtab,filters,1);
+		STATEMENT_STAT(scalar->vtab,rows,ret == SQLITE_ROW);
+	}
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	if(own)
+		sqlite3_finalize(stmt);
+	else {
+		scalar->busy = 0;
+		if(scalar->stale) {
+			sqlite3_finalize(stmt);
+			scalar->stmt = NULL;
+			scalar->stale = 0;
+		}
+	}
+}
+
+#if SQLITE_VERSION_NUMBER >= 3038000
+// NULLs never compare equal to anything so sqlite skips them when iterating IN lists itself
+static int statement_in_first(sqlite3_value* list, sqlite3_value** v) {
+	int ret = sqlite3_vtab_in_first(list,v);
+	while(ret == SQLITE_OK && sqlite3_value_type(*v) == SQLITE_NULL)
+		ret = sqlite3_vtab_in_next(list,v);
+	return ret;
+}
+
+static int statement_in_next(sqlite3_value* list, sqlite3_value** v) {
+	int ret;
+	while((ret = sqlite3_vtab_in_next(list,v)) == SQLITE_OK && sqlite3_value_type(*v) == SQLITE_NULL)
+		;
+	return ret;
+}
+
+// copy the values of an IN list into the cursor, as the list can't be iterated once xFilter returns
+static int statement_cursor_copy_list(struct statement_cursor* cur, sqlite3_value* list, int param_idx) {
+	int alloc_values = 0;
+	int in = cur->num_in++;
+	cur->in_args[in].values = NULL;
+	cur->in_args[in].num_values = 0;
+	cur->in_args[in].pos = 0;
+	cur->in_args[in].param_idx = param_idx;
+	sqlite3_value* v;
+	int ret;
+	for(ret = statement_in_first(list,&v); ret == SQLITE_OK; ret = statement_in_next(list,&v)) {
+		if(cur->in_args[in].num_values == alloc_values) {
+			alloc_values = alloc_values ? alloc_values*2 : 8;
+			sqlite3_value** values = sqlite3_realloc64(cur->in_args[in].values,sizeof(*values)*alloc_values);
+			if(!values)
+				return SQLITE_NOMEM;
+			cur->in_args[in].values = values;
+		}
+		if(!(v = sqlite3_value_dup(v)))
+			return SQLITE_NOMEM;
+		cur->in_args[in].values[cur->in_args[in].num_values++] = v;
+	}
+	return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+#endif
+
+static int statement_cursor_error(struct statement_cursor* cur, int ret, const char* msg) {
+	sqlite3_free(cur->base.pVtab->zErrMsg);
+	if(!(cur->base.pVtab->zErrMsg = sqlite3_mprintf("%s",msg)))
+		return SQLITE_NOMEM;
+	return ret;
+}
+
+// bind the next tuple of a batch, which is given by rows of (tuple index, array index or parameter name, value).
+// only the parameters bound by the previous tuple need to be unbound first, as the others are already NULL
+static int statement_cursor_next_tuple(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	sqlite3_stmt* batch = cur->batch;
+	int ret = cur->batch_ret;
+	if(ret != SQLITE_ROW)
+		return ret == SQLITE_DONE ? ret : statement_cursor_error(cur,ret,sqlite3_errmsg(vtab->db));
+	if(sqlite3_column_type(batch,0) != SQLITE_INTEGER)
+		return statement_cursor_error(cur,SQLITE_MISMATCH,"__batch must be a JSON array");
+
+	for(int i = 0; i < vtab->num_inputs; i++)
+		if(cur->param_argv[i]) {
+			sqlite3_value_free(cur->param_argv[i]);
+			cur->param_argv[i] = NULL;
+			sqlite3_bind_null(cur->stmt,i+1);
+		}
+
+	cur->batch_index = sqlite3_column_int64(batch,0);
+	do {
+		int param_idx = 0;
+		switch(sqlite3_column_type(batch,1)) {
+			case SQLITE_NULL: // an empty tuple
+				break;
+			case SQLITE_INTEGER:
+				param_idx = sqlite3_column_int(batch,1)+1;
+				if(param_idx < 1 || param_idx > vtab->num_inputs)
+					return statement_cursor_error(cur,SQLITE_RANGE,"__batch tuple has more values than the statement has parameters");
+				break;
+			default: {
+				const char* key = (const char*)sqlite3_column_text(batch,1);
+				for(int i = 0; i < vtab->num_inputs && !param_idx; i++) {
+					const char* name = sqlite3_bind_parameter_name(cur->stmt,i+1);
+					if(name && key && !strcmp(name+1,key))
+						param_idx = i+1;
+				}
+				if(!param_idx)
+					return statement_cursor_error(cur,SQLITE_RANGE,"__batch tuple names a parameter the statement doesn't have");
+			}
+		}
+		if(param_idx) {
+			sqlite3_value* v = sqlite3_value_dup(sqlite3_column_value(batch,2));
+			if(!v)
+				return SQLITE_NOMEM;
+			sqlite3_value_free(cur->param_argv[param_idx-1]);
+			cur->param_argv[param_idx-1] = v;
+			if((ret = statement_bind_value(cur->stmt,param_idx,v)) != SQLITE_OK)
+				return ret;
+		}
+		cur->batch_ret = sqlite3_step(batch);
+	} while(cur->batch_ret == SQLITE_ROW && sqlite3_column_type(batch,0) == SQLITE_INTEGER && sqlite3_column_int64(batch,0) == cur->batch_index);
+	return SQLITE_ROW;
+}
+
+// move on to the next combination of values from any IN lists being processed all at once, rebinding only the parameters that changed,
+// or to the next tuple of a batch. returns SQLITE_ROW if there is one or SQLITE_DONE if all have been visited
+static int statement_cursor_advance(struct statement_cursor* cur) {
+	statement_cursor_reset(cur);
+	if(cur->batching) {
+		sqlite3_reset(cur->stmt);
+		return statement_cursor_next_tuple(cur);
+	}
+#if SQLITE_VERSION_NUMBER >= 3038000
+	sqlite3_reset(cur->stmt);
+	for(int i = cur->num_in-1; i >= 0; i--) {
+		if(cur->in_args[i].pos+1 >= cur->in_args[i].num_values)
+			continue;
+		cur->in_args[i].pos++;
+		for(;;) {
+			int param_idx = cur->in_args[i].param_idx;
+			sqlite3_value* v = cur->in_args[i].values[cur->in_args[i].pos];
+			cur->param_argv[param_idx-1] = v;
+			int ret = statement_bind_value(cur->stmt,param_idx,v);
+			if(ret != SQLITE_OK)
+				return ret;
+			if(++i == cur->num_in)
+				return SQLITE_ROW;
+			// lists following the one that advanced start over
+			cur->in_args[i].pos = 0;
+		}
+	}
+#endif
+	return SQLITE_DONE;
+}
+
+// invoke until a row is produced or there are no bindings left to try
+static int statement_cursor_run(struct statement_cursor* cur, int ret) {
+	while(ret == SQLITE_DONE && (ret = statement_cursor_advance(cur)) == SQLITE_ROW)
+		ret = statement_cursor_invoke(cur);
+	return ret == SQLITE_ROW || ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+#ifdef STATEMENT_VTAB_WORKERS
+#ifdef STATEMENT_VTAB_SNAPSHOTS
+int sqlite3_statementvtab_init(sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* pApi);
+#endif
+
+// whether worker connections can run the statement at all. without snapshots, they can't be shown the caller's view of any tables,
+// and a single-threaded build of SQLite can't be used from other threads
+static int statement_workers_usable(struct statement_vtab* vtab) {
+	if(!sqlite3_threadsafe())
+		return 0;
+#ifdef STATEMENT_VTAB_SNAPSHOTS
+	return 1;
+#else
+	return vtab->deterministic;
+#endif
+}
+
+// bind a job's values to the statement. the parameters every job shares are already bound
+static int statement_job_bind(sqlite3_stmt* stmt, struct statement_job* job, int num_params) {
+	int ret = SQLITE_OK;
+	sqlite3_reset(stmt);
+	for(int i = 0; i < num_params && i < sqlite3_bind_parameter_count(stmt) && ret == SQLITE_OK; i++)
+		ret = job->params[i] ? statement_bind_value(stmt,i+1,job->params[i]) : sqlite3_bind_null(stmt,i+1);
+	return ret;
+}
+
+static void statement_job_finish(sqlite3_stmt* stmt, struct statement_job* job, int ret) {
+	if(ret != SQLITE_DONE && ret != SQLITE_NOMEM)
+		job->err = sqlite3_mprintf("%s",sqlite3_errmsg(sqlite3_db_handle(stmt)));
+	sqlite3_reset(stmt);
+	job->ret = ret;
+}
+
+// run the statement for one job's binding, collecting its rows
+static void statement_job_run(sqlite3_stmt* stmt, struct statement_job* job, int num_params, int num_cols) {
+	int ret = statement_job_bind(stmt,job,num_params);
+	job->rows.num_cols = num_cols;
+	if(ret == SQLITE_OK)
+		while((ret = sqlite3_step(stmt)) == SQLITE_ROW && (ret = statement_rows_append(&job->rows,stmt)) == SQLITE_OK)
+			;
+	statement_job_finish(stmt,job,ret);
+}
+
+// run the cursor's only job, handing rows over through its ring buffer as they're produced.
+// the slot after the rows ready is only touched by the worker, so is filled without holding the mutex
+static void statement_job_prefetch(struct statement_workers* pool, sqlite3_stmt* stmt, struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	struct statement_job* job = &cur->jobs[0];
+	int num_cols = pool->num_cols;
+	int ret = statement_job_bind(stmt,job,pool->num_params);
+	while(ret == SQLITE_OK && (ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		pthread_mutex_lock(&pool->mutex);
+		while(pool->open && cur->ring_count == vtab->prefetch)
+			pthread_cond_wait(&pool->done,&pool->mutex);
+		int open = pool->open;
+		sqlite3_value** row = cur->ring + (size_t)((cur->ring_head + cur->ring_count) % vtab->prefetch)*num_cols;
+		pthread_mutex_unlock(&pool->mutex);
+		if(!open) {
+			ret = SQLITE_INTERRUPT;
+			break;
+		}
+		for(int i = 0; i < num_cols && ret == SQLITE_ROW; i++)
+			if(!(row[i] = sqlite3_value_dup(sqlite3_column_value(stmt,i)))) {
+				while(i--)
+					sqlite3_value_free(row[i]);
+				ret = SQLITE_NOMEM;
+			}
+		if(ret == SQLITE_NOMEM)
+			break;
+		pthread_mutex_lock(&pool->mutex);
+		cur->ring_count++;
+		pthread_cond_broadcast(&pool->done);
+		pthread_mutex_unlock(&pool->mutex);
+		ret = SQLITE_OK;
+	}
+	statement_job_finish(stmt,job,ret);
+}
+
+// get a worker's connection ready to run the dispatched statement, reading from the caller's snapshot if there is one
+static int statement_worker_join(struct statement_worker* worker) {
+	struct statement_workers* pool = worker->pool;
+	if(!worker->db)
+		return 0;
+#ifdef STATEMENT_VTAB_SNAPSHOTS
+	if(pool->snapshot && (sqlite3_exec(worker->db,"BEGIN",NULL,NULL,NULL) != SQLITE_OK ||
+	                      sqlite3_snapshot_open(worker->db,"main",pool->snapshot) != SQLITE_OK)) {
+		sqlite3_exec(worker->db,"ROLLBACK",NULL,NULL,NULL);
+		return 0;
+	}
+#endif
+	if(!worker->stmt || strcmp(sqlite3_sql(worker->stmt),pool->sql)) {
+		sqlite3_finalize(worker->stmt);
+		worker->stmt = NULL;
+		// statements calling functions only registered on the caller's connection can't be prepared, so leave their jobs to the cursor
+		if(sqlite3_prepare_v3(worker->db,pool->sql,-1,SQLITE_PREPARE_PERSISTENT,&worker->stmt,NULL) != SQLITE_OK)
+			goto error;
+	}
+	sqlite3_clear_bindings(worker->stmt);
+	for(int i = 0; i < pool->num_extra; i++)
+		if(sqlite3_bind_value(worker->stmt,pool->extra_params[i],pool->extra_values[i]) != SQLITE_OK)
+			goto error;
+	return 1;
+
+error:
+#ifdef STATEMENT_VTAB_SNAPSHOTS
+	if(pool->snapshot)
+		sqlite3_exec(worker->db,"ROLLBACK",NULL,NULL,NULL);
+#endif
+	return 0;
+}
+
+static void* statement_worker_main(void* arg) {
+	struct statement_worker* worker = arg;
+	struct statement_workers* pool = worker->pool;
+	pthread_mutex_lock(&pool->mutex);
+	for(;;) {
+		while(!pool->shutdown && !(pool->open && worker->seen != pool->seq))
+			pthread_cond_wait(&pool->work,&pool->mutex);
+		if(pool->shutdown)
+			break;
+		worker->seen = pool->seq;
+		pool->active++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		int joined = statement_worker_join(worker);
+		pthread_mutex_lock(&pool->mutex);
+		struct statement_cursor* owner = pool->owner;
+		pool->responded++;
+		pthread_cond_broadcast(&pool->done);
+		while(joined && pool->open && owner->next_job < owner->num_jobs) {
+			struct statement_job* job = &owner->jobs[owner->next_job++];
+			pthread_mutex_unlock(&pool->mutex);
+			if(owner->ring)
+				statement_job_prefetch(pool,worker->stmt,owner);
+			else
+				statement_job_run(worker->stmt,job,pool->num_params,pool->num_cols);
+			pthread_mutex_lock(&pool->mutex);
+			job->done = 1;
+			pthread_cond_broadcast(&pool->done);
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+#ifdef STATEMENT_VTAB_SNAPSHOTS
+		if(joined && pool->snapshot)
+			sqlite3_exec(worker->db,"COMMIT",NULL,NULL,NULL);
+#endif
+		pthread_mutex_lock(&pool->mutex);
+		pool->active--;
+		pthread_cond_broadcast(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+static void statement_workers_free(struct statement_workers* pool) {
+	if(!pool)
+		return;
+	pthread_mutex_lock(&pool->mutex);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->mutex);
+	for(int i = 0; i < pool->num_workers; i++) {
+		pthread_join(pool->workers[i].thread,NULL);
+		sqlite3_finalize(pool->workers[i].stmt);
+		sqlite3_close(pool->workers[i].db);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->mutex);
+	sqlite3_free(pool->filename);
+	sqlite3_free(pool);
+}
+
+// start the vtab's workers, or just the one for prefetching. those whose connection or thread can't be set up are left out,
+// and their share of the jobs done by the cursor
+static int statement_workers_start(struct statement_vtab* vtab, const char* filename) {
+	int num_workers = vtab->workers ? vtab->workers : 1;
+	struct statement_workers* pool = sqlite3_malloc64(sizeof(*pool) + sizeof(*pool->workers)*num_workers);
+	if(!pool)
+		return SQLITE_NOMEM;
+	memset(pool,0,sizeof(*pool));
+	if(filename && !(pool->filename = sqlite3_mprintf("%s",filename))) {
+		sqlite3_free(pool);
+		return SQLITE_NOMEM;
+	}
+	pthread_mutex_init(&pool->mutex,NULL);
+	pthread_cond_init(&pool->work,NULL);
+	pthread_cond_init(&pool->done,NULL);
+	pool->num_params = vtab->num_inputs;
+	pool->num_cols = vtab->num_outputs;
+
+	for(int i = 0; i < num_workers; i++) {
+		struct statement_worker* worker = &pool->workers[pool->num_workers];
+		memset(worker,0,sizeof(*worker));
+		worker->pool = pool;
+		int flags = (filename ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE) | SQLITE_OPEN_NOMUTEX;
+		if(sqlite3_open_v2(filename ? filename : ":memory:",&worker->db,flags,NULL) != SQLITE_OK) {
+			sqlite3_close(worker->db);
+			continue;
+		}
+#ifdef STATEMENT_VTAB_SNAPSHOTS
+		// the statement may itself read statement vtabs
+		if(filename)
+			sqlite3_statementvtab_init(worker->db,NULL,NULL);
+#endif
+		if(pthread_create(&worker->thread,NULL,statement_worker_main,worker)) {
+			sqlite3_close(worker->db);
+			continue;
+		}
+		pool->num_workers++;
+	}
+	vtab->pool = pool;
+	return SQLITE_OK;
+}
+
+// hand the cursor's jobs to the vtab's workers if they're free and can see the same data as the cursor, starting them if need be.
+// values bound to the cursor's statement beyond its own parameters are copied for the workers to bind as well
+static int statement_cursor_dispatch(struct statement_cursor* cur, struct statement_plan* plan, sqlite3_value** argv) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	struct statement_workers* pool = vtab->pool;
+	int ret;
+	if(pool && pool->owner)
+		return SQLITE_OK;
+
+	const char* filename = NULL;
+#ifdef STATEMENT_VTAB_SNAPSHOTS
+	sqlite3_snapshot* snapshot = NULL;
+	if(!vtab->deterministic) {
+		sqlite3_int64 schema_version;
+		if((ret = statement_decl_key(vtab,&filename,&schema_version)) != SQLITE_OK)
+			return ret;
+		if(!filename || sqlite3_get_autocommit(vtab->db) || sqlite3_snapshot_get(vtab->db,"main",&snapshot) != SQLITE_OK)
+			return SQLITE_OK;
+	}
+#endif
+	if(!pool && (ret = statement_workers_start(vtab,filename)) != SQLITE_OK)
+		goto error;
+	pool = vtab->pool;
+	ret = SQLITE_NOMEM;
+	int num_extra = plan->num_preds + (plan->limit_argv >= 0) + (plan->offset_argv >= 0);
+	if(!(pool->extra_params = sqlite3_malloc64(sizeof(*pool->extra_params)*(num_extra+1))) ||
+	   !(pool->extra_values = sqlite3_malloc64(sizeof(*pool->extra_values)*(num_extra+1))))
+		goto error;
+	for(pool->num_extra = 0; pool->num_extra < num_extra; pool->num_extra++) {
+		int i = pool->num_extra;
+		int argv_index = i < plan->num_preds ? plan->num_bound+i : i == plan->num_preds && plan->limit_argv >= 0 ? plan->limit_argv : plan->offset_argv;
+		pool->extra_params[i] = i < plan->num_preds ? vtab->num_inputs+1+i : argv_index == plan->limit_argv ? plan->limit_param : plan->offset_param;
+		if(!(pool->extra_values[i] = sqlite3_value_dup(argv[argv_index])))
+			goto error;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->owner = cur;
+	pool->sql = cur->variant->sql;
+#ifdef STATEMENT_VTAB_SNAPSHOTS
+	pool->snapshot = snapshot;
+#endif
+	pool->seq++;
+	pool->open = 1;
+	pool->responded = 0;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->mutex);
+	cur->dispatched = pool;
+	return SQLITE_OK;
+
+error:
+	if(pool) {
+		for(int i = 0; i < pool->num_extra; i++)
+			sqlite3_value_free(pool->extra_values[i]);
+		sqlite3_free(pool->extra_params);
+		sqlite3_free(pool->extra_values);
+		pool->extra_params = NULL;
+		pool->extra_values = NULL;
+		pool->num_extra = 0;
+	}
+#ifdef STATEMENT_VTAB_SNAPSHOTS
+	sqlite3_snapshot_free(snapshot);
+#endif
+	return ret;
+}
+
+// stop handing out the cursor's jobs and wait for the workers to finish the ones they've started,
+// interrupting them if the cursor is giving up on the results
+static void statement_cursor_undispatch(struct statement_cursor* cur, int interrupt) {
+	struct statement_workers* pool = cur->dispatched;
+	if(!pool)
+		return;
+	pthread_mutex_lock(&pool->mutex);
+	pool->open = 0;
+	pthread_cond_broadcast(&pool->done);
+	if(interrupt)
+		for(int i = 0; i < pool->num_workers; i++)
+			sqlite3_interrupt(pool->workers[i].db);
+	while(pool->active)
+		pthread_cond_wait(&pool->done,&pool->mutex);
+	pool->owner = NULL;
+	pthread_mutex_unlock(&pool->mutex);
+
+	for(int i = 0; i < pool->num_extra; i++)
+		sqlite3_value_free(pool->extra_values[i]);
+	sqlite3_free(pool->extra_params);
+	sqlite3_free(pool->extra_values);
+	pool->extra_params = NULL;
+	pool->extra_values = NULL;
+	pool->num_extra = 0;
+#ifdef STATEMENT_VTAB_SNAPSHOTS
+	sqlite3_snapshot_free(pool->snapshot);
+	pool->snapshot = NULL;
+#endif
+	cur->dispatched = NULL;
+}
+
+static void statement_cursor_free_jobs(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	statement_cursor_undispatch(cur,1);
+	if(cur->ring) {
+		for(int i = 0; i < cur->ring_count; i++)
+			for(int j = 0; j < vtab->num_outputs; j++)
+				sqlite3_value_free(cur->ring[(size_t)((cur->ring_head+i) % vtab->prefetch)*vtab->num_outputs+j]);
+		sqlite3_free(cur->ring);
+		cur->ring = NULL;
+		cur->ring_head = cur->ring_count = 0;
+	}
+	for(int i = 0; i < cur->num_jobs; i++) {
+		if(cur->jobs[i].params)
+			for(int j = 0; j < vtab->num_inputs; j++)
+				sqlite3_value_free(cur->jobs[i].params[j]);
+		sqlite3_free(cur->jobs[i].params);
+		statement_rows_clear(&cur->jobs[i].rows);
+		sqlite3_free(cur->jobs[i].err);
+	}
+	sqlite3_free(cur->jobs);
+	cur->jobs = NULL;
+	cur->num_jobs = 0;
+}
+
+// param_argv may point at the values of the job being replayed, so is cleared along with them
+static void statement_cursor_unjob(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	if(!cur->jobs)
+		return;
+	statement_cursor_free_jobs(cur);
+	memset(cur->param_argv,0,sizeof(*cur->param_argv)*vtab->num_inputs);
+}
+
+// wait for the job being replayed to complete, running it on the cursor's own statement if no worker has claimed it yet
+static int statement_cursor_await(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	struct statement_workers* pool = cur->dispatched;
+	struct statement_job* job = &cur->jobs[cur->job];
+	if(pool)
+		pthread_mutex_lock(&pool->mutex);
+	while(!job->done) {
+		if(cur->next_job == cur->job) {
+			cur->next_job++;
+			if(pool)
+				pthread_mutex_unlock(&pool->mutex);
+			statement_job_run(cur->stmt,job,vtab->num_inputs,vtab->num_outputs);
+			if(pool)
+				pthread_mutex_lock(&pool->mutex);
+			job->done = 1;
+		}
+		else
+			pthread_cond_wait(&pool->done,&pool->mutex);
+	}
+	if(pool)
+		pthread_mutex_unlock(&pool->mutex);
+	if(job->ret != SQLITE_DONE)
+		return job->err ? statement_cursor_error(cur,job->ret,job->err) : job->ret;
+	return SQLITE_OK;
+}
+
+// move on to the next row of the jobs' results, freeing those of each job once past them
+static int statement_cursor_replay_jobs(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	int ret;
+	for(; cur->job < cur->num_jobs; cur->job++, cur->job_row = 0) {
+		if((ret = statement_cursor_await(cur)) != SQLITE_OK)
+			return ret;
+		struct statement_job* job = &cur->jobs[cur->job];
+		if(cur->job_row < job->rows.num_rows) {
+			memcpy(cur->param_argv,job->params,sizeof(*cur->param_argv)*vtab->num_inputs);
+			cur->batch_index = cur->job;
+			return SQLITE_OK;
+		}
+		statement_rows_clear(&job->rows);
+	}
+	statement_cursor_undispatch(cur,0);
+	return SQLITE_OK;
+}
+
+// whether the cursor has enough bindings for running them on the workers to pay off, counting no further than that.
+// the IN lists or batch are then rewound to the first binding, so that fewer can still be run in turn as they're produced
+static int statement_cursor_enough_jobs(struct statement_cursor* cur, int* enough) {
+	int ret, n = 1;
+	if(cur->batching) {
+		// each row of the batch is a value of the tuple given by its first column, whose values follow one another
+		sqlite3_int64 tuple = 0;
+		n = 0;
+		for(ret = cur->batch_ret; ret == SQLITE_ROW; ret = sqlite3_step(cur->batch))
+			if(!n || sqlite3_column_int64(cur->batch,0) != tuple) {
+				tuple = sqlite3_column_int64(cur->batch,0);
+				if(++n >= STATEMENT_VTAB_WORKER_MIN_JOBS)
+					break;
+			}
+		if(ret != SQLITE_ROW && ret != SQLITE_DONE)
+			return ret;
+		sqlite3_reset(cur->batch);
+		cur->batch_ret = sqlite3_step(cur->batch);
+	}
+#if SQLITE_VERSION_NUMBER >= 3038000
+	else {
+		// every combination of values of the lists is a binding, and none of them are empty
+		for(int i = 0; i < cur->num_in && n < STATEMENT_VTAB_WORKER_MIN_JOBS; i++)
+			n *= cur->in_args[i].num_values;
+	}
+#endif
+	*enough = n >= STATEMENT_VTAB_WORKER_MIN_JOBS;
+	return SQLITE_OK;
+}
+
+// collect every binding the cursor would otherwise have run in turn as a job, starting from the one already bound.
+// only worth it with enough of them for the workers, who are given them if they're free
+static int statement_cursor_run_jobs(struct statement_cursor* cur, struct statement_plan* plan, sqlite3_value** argv) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	int ret = plan->batch ? statement_cursor_advance(cur) : SQLITE_ROW;
+	int alloc_jobs = 0;
+	cur->next_job = cur->job = 0;
+	cur->job_row = 0;
+	while(ret == SQLITE_ROW) {
+		ret = SQLITE_NOMEM;
+		if(cur->num_jobs == alloc_jobs) {
+			alloc_jobs = alloc_jobs ? alloc_jobs*2 : 16;
+			struct statement_job* jobs = sqlite3_realloc64(cur->jobs,sizeof(*jobs)*alloc_jobs);
+			if(!jobs)
+				goto error;
+			cur->jobs = jobs;
+		}
+		struct statement_job* job = &cur->jobs[cur->num_jobs];
+		memset(job,0,sizeof(*job));
+		if(!(job->params = sqlite3_malloc64(sizeof(*job->params)*vtab->num_inputs)))
+			goto error;
+		cur->num_jobs++;
+		memset(job->params,0,sizeof(*job->params)*vtab->num_inputs);
+		for(int i = 0; i < vtab->num_inputs; i++)
+			if(cur->param_argv[i] && !(job->params[i] = sqlite3_value_dup(cur->param_argv[i])))
+				goto error;
+		ret = statement_cursor_advance(cur);
+	}
+	if(ret != SQLITE_DONE)
+		goto error;
+
+	// the values of the last tuple were copied, so aren't needed anymore, though batch_index still is
+	if(cur->batching)
+		for(int i = 0; i < vtab->num_inputs; i++) {
+			sqlite3_value_free(cur->param_argv[i]);
+			cur->param_argv[i] = NULL;
+		}
+	sqlite3_reset(cur->stmt);
+	if(cur->num_jobs >= STATEMENT_VTAB_WORKER_MIN_JOBS && (ret = statement_cursor_dispatch(cur,plan,argv)) != SQLITE_OK)
+		return ret;
+	return statement_cursor_replay_jobs(cur);
+
+error:
+	// param_argv is cleared along with the jobs, so a tuple's values have to be freed first
+	statement_cursor_unbatch(cur);
+	return ret;
+}
+
+// wait for the prefetching worker to have the next row ready or to have finished, letting go of the workers once it has
+static int statement_cursor_prefetched(struct statement_cursor* cur) {
+	struct statement_workers* pool = cur->dispatched;
+	struct statement_job* job = &cur->jobs[0];
+	if(!pool)
+		return SQLITE_OK;
+	pthread_mutex_lock(&pool->mutex);
+	while(!cur->ring_count && !job->done)
+		pthread_cond_wait(&pool->done,&pool->mutex);
+	cur->prefetch_eof = !cur->ring_count;
+	pthread_mutex_unlock(&pool->mutex);
+	if(!cur->prefetch_eof)
+		return SQLITE_OK;
+	statement_cursor_undispatch(cur,0);
+	if(job->ret != SQLITE_DONE)
+		return job->err ? statement_cursor_error(cur,job->ret,job->err) : job->ret;
+	return SQLITE_OK;
+}
+
+static int statement_cursor_prefetch_next(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	struct statement_workers* pool = cur->dispatched;
+	sqlite3_value** row = cur->ring + (size_t)cur->ring_head*vtab->num_outputs;
+	for(int i = 0; i < vtab->num_outputs; i++)
+		sqlite3_value_free(row[i]);
+	pthread_mutex_lock(&pool->mutex);
+	cur->ring_head = (cur->ring_head + 1) % vtab->prefetch;
+	cur->ring_count--;
+	pthread_cond_broadcast(&pool->done);
+	pthread_mutex_unlock(&pool->mutex);
+	return statement_cursor_prefetched(cur);
+}
+
+// hand the cursor's binding to a worker to run ahead of it.
+// returns SQLITE_DONE if no worker takes it, in which case the cursor runs it as usual
+static int statement_cursor_prefetch(struct statement_cursor* cur, struct statement_plan* plan, sqlite3_value** argv) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	int ret = SQLITE_NOMEM;
+	if((vtab->pool && vtab->pool->owner) || !vtab->prefetch)
+		return SQLITE_DONE;
+
+	struct statement_job* job = sqlite3_malloc(sizeof(*job));
+	if(!job)
+		return SQLITE_NOMEM;
+	memset(job,0,sizeof(*job));
+	cur->jobs = job;
+	cur->num_jobs = 1;
+	cur->next_job = cur->job = 0;
+	if(!(job->params = sqlite3_malloc64(sizeof(*job->params)*vtab->num_inputs+1)) ||
+	   !(cur->ring = sqlite3_malloc64(sizeof(*cur->ring)*vtab->prefetch*vtab->num_outputs)))
+		goto error;
+	memset(job->params,0,sizeof(*job->params)*vtab->num_inputs);
+	for(int i = 0; i < vtab->num_inputs; i++)
+		if(cur->param_argv[i] && !(job->params[i] = sqlite3_value_dup(cur->param_argv[i])))
+			goto error;
+
+	if((ret = statement_cursor_dispatch(cur,plan,argv)) != SQLITE_OK)
+		goto error;
+	struct statement_workers* pool = cur->dispatched;
+	int claimed = 0;
+	if(pool) {
+		pthread_mutex_lock(&pool->mutex);
+		while(!cur->next_job && pool->responded < pool->num_workers)
+			pthread_cond_wait(&pool->done,&pool->mutex);
+		claimed = cur->next_job;
+		cur->next_job = 1;
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	if(!claimed) {
+		ret = SQLITE_DONE;
+		goto error;
+	}
+	return statement_cursor_prefetched(cur);
+
+error:
+	// param_argv is left as it was, for the cursor to run the statement itself
+	statement_cursor_free_jobs(cur);
+	return ret;
+}
+#endif
+
+static int statement_vtab_eof(sqlite3_vtab_cursor* cur) {
+	struct statement_cursor* stmtcur = (struct statement_cursor*)cur;
+	if(stmtcur->truncated)
+		return stmtcur->truncated == 2;
+#ifdef STATEMENT_VTAB_WORKERS
+	if(stmtcur->ring)
+		return stmtcur->prefetch_eof;
+	if(stmtcur->jobs)
+		return stmtcur->job >= stmtcur->num_jobs;
+#endif
+	if(stmtcur->mat)
+		return stmtcur->mat_row < 0 || stmtcur->mat_row >= stmtcur->mat->rows.num_rows;
+	if(stmtcur->replay)
+		return stmtcur->replay_row >= stmtcur->replay->rows.num_rows;
+	return !sqlite3_stmt_busy(stmtcur->stmt);
+}
+
+// count the row the cursor was just moved to, if any
+static int statement_cursor_produced(struct statement_cursor* cur, int ret) {
+#ifndef STATEMENT_VTAB_OMIT_STATS
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	if(ret == SQLITE_OK && !statement_vtab_eof(&cur->base)) {
+		STATEMENT_STAT(vtab,rows,1);
+		cur->produced++;
+	}
+#endif
+	return ret;
+}
+
+#ifndef STATEMENT_VTAB_OMIT_STATS
+// the clock is only read for vtabs timing their invocations, with start left 0 otherwise
+static sqlite3_int64 statement_cursor_clock(struct statement_cursor* cur) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	return cur->timing && (vtab->latency || vtab->slow_ns >= 0) ? statement_clock_ns() : 0;
+}
+
+// add the time since start to the cursor's invocation, counting it if that's the end of it
+static int statement_cursor_timed(struct statement_cursor* cur, sqlite3_int64 start, int ret) {
+	if(!cur->timing)
+		return ret;
+	if(start)
+		cur->elapsed_ns += statement_clock_ns() - start;
+	if(ret != SQLITE_OK || statement_vtab_eof(&cur->base))
+		statement_cursor_finish(cur);
+	return ret;
+}
+#endif
+
+static int statement_cursor_next(sqlite3_vtab_cursor* cur) {
+	struct statement_cursor* stmtcur = (struct statement_cursor*)cur;
+	int ret;
+	stmtcur->rowid++;
+	if(stmtcur->truncated) {
+		stmtcur->truncated = 2;
+		return SQLITE_OK;
+	}
+#ifdef STATEMENT_VTAB_WORKERS
+	if(stmtcur->ring)
+		return statement_cursor_produced(stmtcur,statement_cursor_prefetch_next(stmtcur));
+	if(stmtcur->jobs) {
+		stmtcur->job_row++;
+		return statement_cursor_produced(stmtcur,statement_cursor_replay_jobs(stmtcur));
+	}
+#endif
+	if(stmtcur->mat) {
+		struct statement_mat_index* index = stmtcur->mat_index;
+		if(!index)
+			stmtcur->mat_row++;
+		else
+			do
+				stmtcur->mat_row = index->next[stmtcur->mat_row];
+			while(stmtcur->mat_row >= 0 && index->hashes[stmtcur->mat_row] != stmtcur->mat_hash);
+		return statement_cursor_produced(stmtcur,SQLITE_OK);
+	}
+	if(stmtcur->replay) {
+		if(++stmtcur->replay_row < stmtcur->replay->rows.num_rows) {
+			stmtcur->num_rows++;
+			return statement_cursor_produced(stmtcur,SQLITE_OK);
+		}
+		statement_cursor_observe(stmtcur);
+		ret = SQLITE_DONE;
+	}
+	else if((ret = statement_cursor_step(stmtcur)) == SQLITE_ROW) {
+		stmtcur->num_rows++;
+		return statement_cursor_produced(stmtcur,SQLITE_OK);
+	}
+	else if(ret == SQLITE_DONE)
+		statement_cursor_observe(stmtcur);
+	return statement_cursor_produced(stmtcur,statement_cursor_run(stmtcur,ret));
+}
+
+static int statement_vtab_next(sqlite3_vtab_cursor* cur) {
+#ifndef STATEMENT_VTAB_OMIT_STATS
+	sqlite3_int64 start = statement_cursor_clock((struct statement_cursor*)cur);
+	return statement_cursor_timed((struct statement_cursor*)cur,start,statement_cursor_next(cur));
+#else
+	return statement_cursor_next(cur);
+#endif
+}
+
+static int statement_vtab_rowid(sqlite3_vtab_cursor* cur, sqlite_int64* pRowid) {
+	*pRowid = ((struct statement_cursor*)cur)->rowid;
+	return SQLITE_OK;
+}
+
+static int statement_vtab_column(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int i) {
+	struct statement_cursor* stmtcur = (struct statement_cursor*)cur;
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->pVtab;
+	int num_outputs = vtab->num_outputs;
+	int num_inputs = vtab->num_inputs;
+
+	sqlite3_value* v;
+	if(i < num_outputs) { // a result from the statement
+		if(stmtcur->truncated) // or none, for the row marking the invocation as cut short
+			v = NULL;
+		else
+#ifdef STATEMENT_VTAB_WORKERS
+		if(stmtcur->ring)
+			v = stmtcur->ring[(size_t)stmtcur->ring_head*num_outputs+i];
+		else if(stmtcur->jobs)
+			v = stmtcur->jobs[stmtcur->job].rows.values[stmtcur->job_row*num_outputs+i];
+		else
+#endif
+		if(stmtcur->mat)
+			v = stmtcur->mat->rows.values[stmtcur->mat_row*num_outputs+i];
+		else if(stmtcur->replay)
+			v = stmtcur->replay->rows.values[stmtcur->replay_row*num_outputs+i];
+		else
+			v = sqlite3_column_value(stmtcur->stmt,i);
+	}
+	else if(i-num_outputs < num_inputs) // one of the input parameters
+		v = stmtcur->param_argv[i-num_outputs];
+	else if(i-num_outputs-num_inputs < vtab->num_range_columns) // only ever constrained, so has no value of its own
+		v = NULL;
+	else if(vtab->batched && i-num_outputs-num_inputs-vtab->num_range_columns == 0) // __batch
+		v = NULL;
+	else if(vtab->batched && i-num_outputs-num_inputs-vtab->num_range_columns == 1) { // __batch_index
+		if(stmtcur->batching)
+			sqlite3_result_int64(ctx,stmtcur->batch_index);
+		return SQLITE_OK;
+	}
+	else if(i == vtab->truncated_column) {
+		sqlite3_result_int(ctx,stmtcur->truncated == 1);
+		return SQLITE_OK;
+	}
+	else
+		return SQLITE_RANGE;
+
+	if(v)
+		sqlite3_result_value(ctx,v);
+
+	return SQLITE_OK;
+}
+
+#ifndef STATEMENT_VTAB_OMIT_STATS
+static int statement_value_literal(sqlite3_value* v, char** literal);
+
+// an argument as an SQL literal, or what it is if it's too large to be worth writing out
+static int statement_str_value(sqlite3_str* str, sqlite3_value* v) {
+	char* literal;
+	int ret = statement_value_literal(v,&literal);
+	if(literal)
+		sqlite3_str_appendall(str,literal);
+	else if(ret == SQLITE_OK && sqlite3_value_type(v) == SQLITE_FLOAT)
+		sqlite3_str_appendf(str,"%!.17g",sqlite3_value_double(v));
+	else if(ret == SQLITE_OK)
+		sqlite3_str_appendf(str,"<%s of %d bytes>",sqlite3_value_type(v) == SQLITE_BLOB ? "blob" : "text",sqlite3_value_bytes(v));
+	sqlite3_free(literal);
+	return ret;
+}
+
+// write out the arguments of the cursor's invocation for the slow log, by the parameter each is bound to (or as the batch
+// they're drawn from). IN lists are written out whole, which leaves them to be iterated from the start again.
+// parameters are named by the statement as written, as other variants may have had some replaced by constants
+static int statement_cursor_describe(struct statement_cursor* cur, struct statement_plan* plan, sqlite3_value** argv) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	int ret = SQLITE_OK;
+	sqlite3_stmt* named = NULL;
+	if(!plan->batch && cur->variant != vtab->variants[0] &&
+	   (ret = statement_pool_checkout(vtab,vtab->variants[0],&named)) != SQLITE_OK)
+		return ret;
+	sqlite3_str* str = sqlite3_str_new(vtab->db);
+	if(plan->batch) {
+		sqlite3_str_appendall(str,"__batch=");
+		ret = statement_str_value(str,argv[0]);
+	}
+	for(int i = 0; !plan->batch && i < vtab->num_inputs && ret == SQLITE_OK; i++) {
+		if(!cur->param_argv[i])
+			continue;
+		const char* name = sqlite3_bind_parameter_name(named ? named : cur->stmt,i+1);
+		if(sqlite3_str_length(str))
+			sqlite3_str_appendall(str,", ");
+		if(name)
+			sqlite3_str_appendf(str,"%s=",name);
+		else
+			sqlite3_str_appendf(str,"?%d=",i+1);
+		int in = 0;
+		while(in < cur->num_in && cur->in_args[in].param_idx != i+1)
+			in++;
+		if(in == cur->num_in) {
+			ret = statement_str_value(str,cur->param_argv[i]);
+			continue;
+		}
+#if SQLITE_VERSION_NUMBER >= 3038000
+		sqlite3_str_appendall(str,"IN (");
+		for(int j = 0; j < cur->in_args[in].num_values && ret == SQLITE_OK; j++) {
+			if(j)
+				sqlite3_str_appendall(str,", ");
+			ret = statement_str_value(str,cur->in_args[in].values[j]);
+		}
+		sqlite3_str_appendall(str,")");
+#endif
+	}
+	statement_pool_return(vtab,vtab->variants[0],named);
+	if(ret == SQLITE_OK)
+		ret = sqlite3_str_errcode(str);
+	char* args = sqlite3_str_finish(str);
+	if(ret != SQLITE_OK) {
+		sqlite3_free(args);
+		return ret;
+	}
+	sqlite3_free(cur->slow_args);
+	cur->slow_args = args;
+	return SQLITE_OK;
+}
+#endif
+
+// serve the cursor from materialized results, through the index on a constrained output if the plan has one
+static int statement_cursor_materialized(struct statement_cursor* cur, struct statement_plan* plan, sqlite3_value** argv) {
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->base.pVtab;
+	int ret;
+	if((ret = statement_materialize(vtab,&cur->mat)) != SQLITE_OK)
+		return ret;
+	cur->mat->refs++;
+	cur->mat_row = 0;
+	if(!plan->mat_column)
+		return SQLITE_OK;
+
+	if((ret = statement_mat_index(vtab,cur->mat,plan->mat_column-1,&cur->mat_index)) != SQLITE_OK ||
+	   (ret = statement_mat_hash(argv[0],&cur->mat_hash)) != SQLITE_OK)
+		return ret;
+	cur->mat_row = -1;
+	if(cur->mat_hash)
+		for(sqlite3_int64 row = cur->mat_index->heads[cur->mat_hash & (cur->mat_index->num_buckets-1)]; row >= 0; row = cur->mat_index->next[row])
+			if(cur->mat_index->hashes[row] == cur->mat_hash) {
+				cur->mat_row = row;
+				break;
+			}
+	return SQLITE_OK;
+}
+
+// the number of xFilter args a plan was given argvIndexes for
+static int statement_plan_argc(const struct statement_plan* plan) {
+	if(plan->batch || plan->mat_column)
+		return 1;
+	return plan->num_bound + plan->num_preds + (plan->limit_argv >= 0) + (plan->offset_argv >= 0);
+}
+
+// xBestIndex needs to communicate which columns are constrained by the where clause to xFilter;
+// in terms of a statement table this translates to which parameters will be available to bind,
+// which the plan idxNum refers to records along with the order their values come in argv.
+static int statement_cursor_filter(sqlite3_vtab_cursor* cur, int idxNum, const char* idxStr, int argc, sqlite3_value** argv) {
+	struct statement_cursor* stmtcur = (struct statement_cursor*)cur;
+	struct statement_vtab* vtab = (struct statement_vtab*)cur->pVtab;
 
+	if(idxNum < 0 || idxNum >= vtab->num_plans || argc != statement_plan_argc(vtab->plans[idxNum]))
+		return statement_cursor_error(stmtcur,SQLITE_ERROR,"statement vtab called with arguments its plan doesn't expect");
+	struct statement_plan* plan = vtab->plans[idxNum];
 	int ret;
-	for(int i = 0; i < argc; i++) {
-		int param_idx = idxStr ? decode_param_idx(i,idxStr) : i+1;
-		if((ret = sqlite3_bind_value(stmt,param_idx,argv[i])) != SQLITE_OK)
+
+	stmtcur->rowid = 1;
+	statement_cursor_reset(stmtcur);
+#ifdef STATEMENT_VTAB_WORKERS
+	statement_cursor_unjob(stmtcur);
+#endif
+	statement_cursor_unbatch(stmtcur);
+	stmtcur->truncated = 0;
+	STATEMENT_STAT(vtab,filters,1);
+	// like cached results, materialized ones aren't built or used inside of write transactions.
+	// plans don't omit their constraints, so in that case running the statement as written is still correct
+	if(vtab->materialize && statement_cache_usable(vtab))
+		return statement_cursor_produced(stmtcur,statement_cursor_materialized(stmtcur,plan,argv));
+
+	struct statement_variant* variant = vtab->variants[plan->variant];
+	if(stmtcur->variant != variant) {
+		if(stmtcur->variant)
+			statement_pool_return(vtab,stmtcur->variant,stmtcur->stmt);
+		stmtcur->variant = NULL;
+		stmtcur->stmt = NULL;
+		if((ret = statement_pool_checkout(vtab,variant,&stmtcur->stmt)) != SQLITE_OK)
+			return ret;
+		stmtcur->variant = variant;
+	}
+	else // counters are told apart by invocation
+		statement_stats_collect(vtab,variant,stmtcur->stmt);
+	sqlite3_stmt* stmt = stmtcur->stmt;
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	stmtcur->budget_rows = 0;
+	stmtcur->budget_spent = 0;
+	stmtcur->budget_start_ns = vtab->max_ns ? statement_clock_ns() : 0;
+	stmtcur->budget_steps_base = sqlite3_stmt_status(stmt,SQLITE_STMTSTATUS_VM_STEP,0);
+	if(vtab->num_inputs)
+		memset(stmtcur->param_argv,0,sizeof(*stmtcur->param_argv)*vtab->num_inputs);
+
+	stmtcur->num_bound = plan->num_bound;
+	statement_cursor_unlist(stmtcur);
+
+	if(plan->batch) {
+#ifndef STATEMENT_VTAB_OMIT_STATS
+		if(vtab->slow_ns >= 0 && (ret = statement_cursor_describe(stmtcur,plan,argv)) != SQLITE_OK)
+			return ret;
+#endif
+		if(!stmtcur->batch && (ret = sqlite3_prepare_v3(vtab->db,
+			"SELECT a.key, b.key, b.value FROM json_each(?1) a "
+			"LEFT JOIN json_each(CASE WHEN a.type IN ('array','object') THEN a.value ELSE json_array(a.value) END) b",
+			-1,SQLITE_PREPARE_PERSISTENT,&stmtcur->batch,NULL)) != SQLITE_OK)
+			return statement_cursor_error(stmtcur,ret,sqlite3_errmsg(vtab->db));
+		sqlite3_reset(stmtcur->batch);
+		if((ret = sqlite3_bind_value(stmtcur->batch,1,argv[0])) != SQLITE_OK)
+			return ret;
+		stmtcur->batching = 1;
+		stmtcur->batch_ret = sqlite3_step(stmtcur->batch);
+#ifdef STATEMENT_VTAB_WORKERS
+		int enough = 0;
+		if(vtab->workers && statement_workers_usable(vtab) && (ret = statement_cursor_enough_jobs(stmtcur,&enough)) != SQLITE_OK)
 			return ret;
+		if(enough)
+			return statement_cursor_produced(stmtcur,statement_cursor_run_jobs(stmtcur,plan,argv));
+#endif
+		return statement_cursor_produced(stmtcur,statement_cursor_run(stmtcur,SQLITE_DONE));
+	}
+
+	const int* param_map = plan->param_map ? vtab->param_maps[plan->param_map-1]+1 : NULL;
+	for(int i = 0; i < plan->num_bound; i++) {
+		int param_idx = param_map ? param_map[i] : i+1;
 		// shallow copy args as these are explicitly retained in sqlite3WhereCodeOneLoopStart
 		stmtcur->param_argv[param_idx-1] = argv[i];
+#if SQLITE_VERSION_NUMBER >= 3038000
+		// IN lists handled all at once come to us as a single value to iterate over.
+		// they're drawn from an ephemeral index on the list, so are already in sorted order without duplicates.
+		if(i < STATEMENT_VTAB_MAX_IN && (plan->in_mask & (1ull << i))) {
+			if((ret = statement_cursor_copy_list(stmtcur,argv[i],param_idx)) != SQLITE_OK)
+				return ret;
+			if(!stmtcur->in_args[stmtcur->num_in-1].num_values)
+				return SQLITE_OK; // an empty list, so no results
+			stmtcur->param_argv[param_idx-1] = stmtcur->in_args[stmtcur->num_in-1].values[0];
+		}
+#endif
 	}
-	ret = sqlite3_step(stmt);
-	if(!(ret == SQLITE_ROW || ret == SQLITE_DONE))
+#ifndef STATEMENT_VTAB_OMIT_STATS
+	if(vtab->slow_ns >= 0 && (ret = statement_cursor_describe(stmtcur,plan,argv)) != SQLITE_OK)
+		return ret;
+#endif
+
+	for(int i = 0; i < vtab->num_inputs; i++)
+		if(stmtcur->param_argv[i] && (ret = statement_bind_value(stmt,i+1,stmtcur->param_argv[i])) != SQLITE_OK)
+			return ret;
+	for(int i = 0; i < plan->num_preds; i++)
+		if((ret = statement_bind_value(stmt,vtab->num_inputs+1+i,argv[plan->num_bound+i])) != SQLITE_OK)
+			return ret;
+	if(plan->limit_argv >= 0 && (ret = sqlite3_bind_value(stmt,plan->limit_param,argv[plan->limit_argv])) != SQLITE_OK)
+		return ret;
+	if(plan->offset_argv >= 0 && (ret = sqlite3_bind_value(stmt,plan->offset_param,argv[plan->offset_argv])) != SQLITE_OK)
+		return ret;
+
+#ifdef STATEMENT_VTAB_WORKERS
+	int enough = 0;
+	if(stmtcur->num_in && vtab->workers && statement_workers_usable(vtab) && (ret = statement_cursor_enough_jobs(stmtcur,&enough)) != SQLITE_OK)
 		return ret;
+	if(enough)
+		return statement_cursor_produced(stmtcur,statement_cursor_run_jobs(stmtcur,plan,argv));
+	if(!stmtcur->num_in && vtab->prefetch && statement_workers_usable(vtab) && (ret = statement_cursor_prefetch(stmtcur,plan,argv)) != SQLITE_DONE)
+		return statement_cursor_produced(stmtcur,ret);
+#endif
+	return statement_cursor_produced(stmtcur,statement_cursor_run(stmtcur,statement_cursor_invoke(stmtcur)));
+}
+
+static int statement_vtab_filter(sqlite3_vtab_cursor* cur, int idxNum, const char* idxStr, int argc, sqlite3_value** argv) {
+#ifndef STATEMENT_VTAB_OMIT_STATS
+	struct statement_cursor* stmtcur = (struct statement_cursor*)cur;
+	// sqlite moves on to the next invocation without necessarily having finished the last
+	statement_cursor_finish(stmtcur);
+	stmtcur->timing = 1;
+	stmtcur->elapsed_ns = 0;
+	stmtcur->produced = 0;
+	sqlite3_int64 start = statement_cursor_clock(stmtcur);
+	return statement_cursor_timed(stmtcur,start,statement_cursor_filter(cur,idxNum,idxStr,argc,argv));
+#else
+	return statement_cursor_filter(cur,idxNum,idxStr,argc,argv);
+#endif
+}
+
+// prefer what's been observed for plans binding as many parameters, otherwise scale the estimate from the inner query plan
+// (which assumes every parameter is bound) by how many of them this plan leaves unbound
+static void statement_vtab_estimate(struct statement_vtab* vtab, sqlite3_index_info* index_info, int num_bound) {
+	int bucket = num_bound < STATEMENT_VTAB_OBSERVED_BUCKETS ? num_bound : STATEMENT_VTAB_OBSERVED_BUCKETS-1;
+	double rows;
+	if(vtab->observed[bucket].count && vtab->rows_hint < 0)
+		rows = vtab->observed[bucket].rows;
+	else {
+		rows = vtab->est_rows;
+		for(int i = num_bound; i < vtab->num_inputs; i++)
+			rows *= STATEMENT_VTAB_UNBOUND_FACTOR;
+	}
+	index_info->estimatedRows = rows < 1 ? 1 : rows;
+	index_info->estimatedCost = vtab->filter_cost + rows;
+}
+
+// rather than have sqlite call xFilter once for each value of an IN list, ask for the entire list to be passed at once.
+// the argv positions of such constraints are flagged in the plan's in_mask.
+static void statement_vtab_best_in(struct statement_vtab* vtab, sqlite3_index_info* index_info, struct statement_plan* plan) {
+#if SQLITE_VERSION_NUMBER >= 3038000
+	if(sqlite3_libversion_number() < 3038000)
+		return;
+	for(int i = 0; i < index_info->nConstraint; i++) {
+		int argv_idx = index_info->aConstraintUsage[i].argvIndex-1;
+		if(index_info->aConstraint[i].iColumn >= vtab->num_outputs && argv_idx >= 0 && argv_idx < STATEMENT_VTAB_MAX_IN && sqlite3_vtab_in(index_info,i,-1)) {
+			sqlite3_vtab_in(index_info,i,1);
+			plan->in_mask |= 1ull << argv_idx;
+		}
+	}
+#endif
+}
+
+// columns from 63 on share colUsed's high bit
+static inline int statement_col_used(sqlite3_uint64 col_used, int col) {
+	return (col_used >> (col < 63 ? col : 63)) & 1;
+}
+
+// whether any of the statement's outputs go unused
+static int statement_vtab_pruned(struct statement_vtab* vtab, sqlite3_uint64 col_used) {
+	for(int i = 0; i < vtab->num_outputs; i++)
+		if(!statement_col_used(col_used,i))
+			return 1;
+	return 0;
+}
+
+// variants select from the statement as a CTE naming its columns c0..cN, so clauses can refer to them regardless of what they're called
+// outputs the query doesn't use are selected as NULL, so that the flattener can drop their expressions from the statement.
+// distinct variants compare outputs as binary, as the vtab's columns are declared without a collation
+static char* statement_vtab_variant_sql(struct statement_vtab* vtab, const char* inner, sqlite3_uint64 col_used, const char* where, const char* order, int distinct, int limit_param, int offset_param) {
+	sqlite3_str* sql = sqlite3_str_new(vtab->db);
+	sqlite3_str_appendall(sql,"WITH statement_vtab_inner(");
+	for(int i = 0; i < vtab->num_outputs; i++)
+		sqlite3_str_appendf(sql,"%sc%d",i?",":"",i);
+	sqlite3_str_appendf(sql,") AS (\n%s\n) SELECT %s",inner,distinct ? "DISTINCT " : "");
+	if(distinct || statement_vtab_pruned(vtab,col_used))
+		for(int i = 0; i < vtab->num_outputs; i++) {
+			if(statement_col_used(col_used,i))
+				sqlite3_str_appendf(sql,"%sc%d%s",i?",":"",i,distinct ? " COLLATE BINARY" : "");
+			else
+				sqlite3_str_appendf(sql,"%sNULL",i?",":"");
+		}
+	else
+		sqlite3_str_appendall(sql,"*");
+	sqlite3_str_appendall(sql," FROM statement_vtab_inner");
+	if(where && *where)
+		sqlite3_str_appendf(sql," WHERE %s",where);
+	if(order && *order)
+		sqlite3_str_appendf(sql," ORDER BY %s",order);
+	if(limit_param)
+		sqlite3_str_appendf(sql," LIMIT ?%d",limit_param);
+	else if(offset_param)
+		sqlite3_str_appendall(sql," LIMIT -1");
+	if(offset_param)
+		sqlite3_str_appendf(sql," OFFSET ?%d",offset_param);
+	return sqlite3_str_finish(sql);
+}
+
+// constraints on outputs can be checked inside the statement, where sqlite may be able to search an index with them
+// rather than the vtab producing every row to be filtered afterwards. the values compared against are passed to xFilter
+// after the inputs and bound to parameters following the statement's own.
+// outputs without a declared type may have a different affinity inside the statement (e.g. a CAST) than the vtab's column,
+// so comparisons on those are left to sqlite.
+// results in the terms of a WHERE clause for a variant, or NULL if there are none.
+static int statement_vtab_best_predicates(struct statement_vtab* vtab, sqlite3_index_info* index_info, struct statement_plan* plan, char** where, double* selectivity) {
+	sqlite3_str* str = sqlite3_str_new(vtab->db);
+	int argc = plan->num_bound, terms = 0;
+	*selectivity = 1;
+	for(int i = 0; i < index_info->nConstraint; i++) {
+		int col = index_info->aConstraint[i].iColumn;
+		if(!index_info->aConstraint[i].usable || col < 0 || col >= vtab->num_outputs)
+			continue;
+		const char* op;
+		int rhs = 1, compare = 1;
+		double sel = STATEMENT_VTAB_RANGE_SELECTIVITY;
+		switch(index_info->aConstraint[i].op) {
+			case SQLITE_INDEX_CONSTRAINT_EQ:        op = "=";  sel = STATEMENT_VTAB_EQ_SELECTIVITY; break;
+			case SQLITE_INDEX_CONSTRAINT_IS:        op = "IS"; sel = STATEMENT_VTAB_EQ_SELECTIVITY; break;
+			case SQLITE_INDEX_CONSTRAINT_GT:        op = ">";  break;
+			case SQLITE_INDEX_CONSTRAINT_GE:        op = ">="; break;
+			case SQLITE_INDEX_CONSTRAINT_LT:        op = "<";  break;
+			case SQLITE_INDEX_CONSTRAINT_LE:        op = "<="; break;
+			case SQLITE_INDEX_CONSTRAINT_NE:        op = "<>";     sel = 1; break;
+			case SQLITE_INDEX_CONSTRAINT_ISNOT:     op = "IS NOT"; sel = 1; break;
+			case SQLITE_INDEX_CONSTRAINT_LIKE:      op = "LIKE"; compare = 0; break;
+			case SQLITE_INDEX_CONSTRAINT_GLOB:      op = "GLOB"; compare = 0; break;
+			case SQLITE_INDEX_CONSTRAINT_ISNULL:    op = "IS NULL";     rhs = compare = 0; sel = STATEMENT_VTAB_EQ_SELECTIVITY; break;
+			case SQLITE_INDEX_CONSTRAINT_ISNOTNULL: op = "IS NOT NULL"; rhs = compare = 0; sel = 1; break;
+			default: continue;
+		}
+		if(compare && !vtab->output_typed[col])
+			continue;
+
+		sqlite3_str_appendf(str,"%sc%d",terms++?" AND ":"",col);
+		if(compare)
+			sqlite3_str_appendf(str," COLLATE \"%w\"",sqlite3_vtab_collation(index_info,i));
+		sqlite3_str_appendf(str," %s",op);
+		if(rhs) {
+			sqlite3_str_appendf(str," ?%d",vtab->num_inputs+1+plan->num_preds++);
+			index_info->aConstraintUsage[i].argvIndex = ++argc;
+		}
+		index_info->aConstraintUsage[i].omit = 1;
+		*selectivity *= sel;
+	}
+	int ret = sqlite3_str_errcode(str);
+	*where = sqlite3_str_finish(str);
+	return ret;
+}
+
+// give predicates back to sqlite if they can't be pushed into the statement after all
+static void statement_vtab_unpredicate(struct statement_vtab* vtab, sqlite3_index_info* index_info, struct statement_plan* plan) {
+	for(int i = 0; i < index_info->nConstraint; i++) {
+		int col = index_info->aConstraint[i].iColumn;
+		if(col >= 0 && col < vtab->num_outputs &&
+		   index_info->aConstraint[i].op != SQLITE_INDEX_CONSTRAINT_LIMIT && index_info->aConstraint[i].op != SQLITE_INDEX_CONSTRAINT_OFFSET) {
+			index_info->aConstraintUsage[i].argvIndex = 0;
+			index_info->aConstraintUsage[i].omit = 0;
+		}
+	}
+	plan->num_preds = 0;
+}
+
+// sqlite can skip sorting the vtab's rows if they come out of a single invocation in the order asked for.
+// input columns are the same for every row of an invocation so only orderings of outputs need to be passed on.
+// results in the terms of an ORDER BY clause for a variant (empty if none are needed) or NULL if the ordering can't be consumed.
+static char* statement_vtab_best_order(struct statement_vtab* vtab, sqlite3_index_info* index_info, struct statement_plan* plan) {
+	// the row marking a truncated invocation comes last whatever the order
+	if(!index_info->nOrderBy || plan->in_mask || vtab->truncate)
+		return NULL;
+	sqlite3_str* order = sqlite3_str_new(vtab->db);
+	int terms = 0;
+	for(int i = 0; i < index_info->nOrderBy; i++) {
+		int col = index_info->aOrderBy[i].iColumn;
+		if(col < 0) { // rowid
+			sqlite3_free(sqlite3_str_finish(order));
+			return NULL;
+		}
+		if(col >= vtab->num_outputs)
+			continue;
+		// vtab columns are declared without a collation so always order as binary, whatever the underlying column uses
+		sqlite3_str_appendf(order,"%sc%d COLLATE BINARY%s",terms++?",":"",col,index_info->aOrderBy[i].desc?" DESC":"");
+	}
+	if(!terms) {
+		sqlite3_free(sqlite3_str_finish(order));
+		return sqlite3_mprintf("");
+	}
+	return sqlite3_str_finish(order);
+}
+
+// for a DISTINCT query, sqlite only needs one row for each combination of the values it orders by (and with SQLite 3.38 or later
+// says so), which the statement can produce itself where a single invocation's rows are ordered and every output used is one of those.
+// results in 2 if they may come in any order, 3 if they must still be ordered, or 0 if the statement can't be made to produce them
+static int statement_vtab_best_distinct(struct statement_vtab* vtab, sqlite3_index_info* index_info, const char* order) {
+#if SQLITE_VERSION_NUMBER >= 3038000
+	if(sqlite3_libversion_number() < 3038000 || !order)
+		return 0;
+	int distinct = sqlite3_vtab_distinct(index_info);
+	if(distinct < 2)
+		return 0;
+	for(int i = 0; i < vtab->num_outputs; i++) {
+		int ordered = 0;
+		for(int j = 0; j < index_info->nOrderBy && !ordered; j++)
+			ordered = index_info->aOrderBy[j].iColumn == i;
+		if(!ordered && statement_col_used(index_info->colUsed,i))
+			return 0;
+	}
+	return distinct;
+#else
+	return 0;
+#endif
+}
+
+// when the vtab is the only thing being selected from, sqlite offers its LIMIT and OFFSET so that the inner statement can stop early.
+// these are bound to parameters following the statement's own in a variant, and passed to xFilter after its inputs.
+// results must come out of a single invocation in the order sqlite expects for this to apply.
+static void statement_vtab_best_limit(sqlite3_index_info* index_info, int ordered, int* limit, int* offset) {
+	*limit = *offset = -1;
+#if SQLITE_VERSION_NUMBER >= 3038000
+	if(sqlite3_libversion_number() < 3038000 || !ordered)
+		return;
+	for(int i = 0; i < index_info->nConstraint; i++) {
+		int op = index_info->aConstraint[i].op;
+		if(op == SQLITE_INDEX_CONSTRAINT_LIMIT || op == SQLITE_INDEX_CONSTRAINT_OFFSET) {
+			if(index_info->aConstraint[i].usable)
+				*(op == SQLITE_INDEX_CONSTRAINT_LIMIT ? limit : offset) = i;
+		}
+		// anything left for sqlite to check would have to be applied before limiting.
+		// IN lists run the statement once per value whether or not they're processed all at once
+		else if(!index_info->aConstraintUsage[i].omit || sqlite3_vtab_in(index_info,i,-1)) {
+			*limit = *offset = -1;
+			return;
+		}
+	}
+#endif
+}
+
+// a rough cost of sorting, for variants that need to do so where the statement as written doesn't
+static double statement_sort_cost(double rows) {
+	double log2 = 1;
+	for(double n = rows; n > 2; n /= 2)
+		log2++;
+	return rows * log2;
+}
+
+// record the plan chosen for xFilter and refer to it by index in idxNum.
+// orderings, limits, and offsets sqlite can leave to the vtab are applied in a variant of the statement wrapping it.
+// the base estimate for the number of parameters bound, adjusted for everything else the plan does
+static void statement_vtab_estimate_plan(struct statement_vtab* vtab, sqlite3_index_info* index_info, const struct statement_estimate* estimate) {
+	statement_vtab_estimate(vtab,index_info,estimate->num_bound);
+	index_info->estimatedRows *= estimate->tuples;
+	index_info->estimatedCost *= estimate->tuples;
+	if(estimate->selectivity < 1) {
+		double rows = index_info->estimatedRows * estimate->selectivity;
+		index_info->estimatedCost -= index_info->estimatedRows - rows;
+		index_info->estimatedRows = rows < 1 ? 1 : rows;
+	}
+	if(estimate->sorts)
+		index_info->estimatedCost += statement_sort_cost(index_info->estimatedRows);
+#if SQLITE_VERSION_NUMBER >= 3038000
+	sqlite3_value* v;
+	if(estimate->limit >= 0 && sqlite3_vtab_rhs_value(index_info,estimate->limit,&v) == SQLITE_OK && sqlite3_value_type(v) == SQLITE_INTEGER) {
+		sqlite3_int64 n = sqlite3_value_int64(v);
+		if(n >= 0 && n < index_info->estimatedRows) {
+			index_info->estimatedCost -= index_info->estimatedRows - n;
+			index_info->estimatedRows = n ? n : 1;
+		}
+	}
+#endif
+	if(estimate->unique) {
+		index_info->estimatedCost -= index_info->estimatedRows - 1;
+		index_info->estimatedRows = 1;
+	}
+}
+
+// whether plans are made around the values of constant arguments. statements that read no tables have nothing to plan,
+// and their results are cached by argument instead
+static int statement_vtab_specializes(struct statement_vtab* vtab) {
+	return !vtab->deterministic && sqlite3_libversion_number() >= 3038000;
+}
+
+// an SQL literal that reads back as the same value, or NULL for a value without one or that's too large to be worth writing out
+static int statement_value_literal(sqlite3_value* v, char** literal) {
+	*literal = NULL;
+	int type = sqlite3_value_type(v);
+	if((type == SQLITE_TEXT || type == SQLITE_BLOB) && sqlite3_value_bytes(v) > STATEMENT_VTAB_MAX_CONSTANT_SIZE)
+		return SQLITE_OK;
+	switch(type) {
+		case SQLITE_INTEGER:
+			*literal = sqlite3_mprintf("%lld",sqlite3_value_int64(v));
+			break;
+		case SQLITE_FLOAT: {
+			double r = sqlite3_value_double(v);
+			if(r - r != 0) // infinite or NaN
+				return SQLITE_OK;
+			*literal = sqlite3_mprintf("%!.17g",r);
+			break;
+		}
+		case SQLITE_TEXT: {
+			const char* text = (const char*)sqlite3_value_text(v);
+			if(!text)
+				return SQLITE_NOMEM;
+			if(strlen(text) != (size_t)sqlite3_value_bytes(v))
+				return SQLITE_OK;
+			*literal = sqlite3_mprintf("%Q",text);
+			break;
+		}
+		case SQLITE_BLOB: {
+			const unsigned char* blob = sqlite3_value_blob(v);
+			sqlite3_str* str = sqlite3_str_new(NULL);
+			sqlite3_str_appendall(str,"X'");
+			for(int i = 0; i < sqlite3_value_bytes(v); i++)
+				sqlite3_str_appendf(str,"%02x",blob[i]);
+			sqlite3_str_appendall(str,"'");
+			*literal = sqlite3_str_finish(str);
+			break;
+		}
+		default:
+			return SQLITE_OK;
+	}
+	return *literal ? SQLITE_OK : SQLITE_NOMEM;
+}
+
+// arguments known while planning, such as those of a table-valued function called with literals, are written into the statement
+// in place of their parameters so that sqlite can plan it around them, e.g. choosing a partial index or using LIKE with a constant
+// pattern. the values are still bound, to whatever parameters are left. results in the statement to wrap, or NULL to use it as written
+static int statement_vtab_best_constants(struct statement_vtab* vtab, sqlite3_index_info* index_info, const struct statement_plan* plan, char** inner) {
+	*inner = NULL;
+#if SQLITE_VERSION_NUMBER >= 3038000
+	if(!statement_vtab_specializes(vtab) || vtab->num_constant_variants >= STATEMENT_VTAB_MAX_CONSTANT_VARIANTS || !plan->num_bound)
+		return SQLITE_OK;
+	int ret = SQLITE_OK, found = 0;
+	char** literals = sqlite3_malloc64(sizeof(*literals)*vtab->num_inputs);
+	struct statement_token_span* values = sqlite3_malloc64(sizeof(*values)*vtab->num_inputs);
+	if(!literals || !values) {
+		sqlite3_free(literals);
+		sqlite3_free(values);
+		return SQLITE_NOMEM;
+	}
+	memset(literals,0,sizeof(*literals)*vtab->num_inputs);
+	memset(values,0,sizeof(*values)*vtab->num_inputs);
 
+	const int* param_map = plan->param_map ? vtab->param_maps[plan->param_map-1]+1 : NULL;
+	for(int i = 0; i < index_info->nConstraint; i++) {
+		int argv_idx = index_info->aConstraintUsage[i].argvIndex-1;
+		sqlite3_value* v;
+		if(argv_idx < 0 || argv_idx >= plan->num_bound || (argv_idx < STATEMENT_VTAB_MAX_IN && (plan->in_mask >> argv_idx & 1)) ||
+		   sqlite3_vtab_rhs_value(index_info,i,&v) != SQLITE_OK)
+			continue;
+		int param = param_map ? param_map[argv_idx] : argv_idx+1;
+		// a parameter given more than one value is bound the last of them, so leave it be
+		if(values[param-1].p) {
+			found = 0;
+			break;
+		}
+		if((ret = statement_value_literal(v,&literals[param-1])) != SQLITE_OK)
+			break;
+		if(literals[param-1]) {
+			values[param-1].p = literals[param-1];
+			values[param-1].len = (int)strlen(literals[param-1]);
+			found = 1;
+		}
+	}
+	if(found && ret == SQLITE_OK) {
+		sqlite3_str* out = sqlite3_str_new(vtab->db);
+		if((ret = statement_sql_substitute(out,vtab->sql,vtab->num_inputs,values,vtab->num_inputs,1)) == SQLITE_OK)
+			ret = sqlite3_str_errcode(out);
+		*inner = sqlite3_str_finish(out);
+		if(ret != SQLITE_OK) {
+			sqlite3_free(*inner);
+			*inner = NULL;
+			ret = ret == SQLITE_NOMEM ? ret : SQLITE_OK;
+		}
+	}
+	for(int i = 0; i < vtab->num_inputs; i++)
+		sqlite3_free(literals[i]);
+	sqlite3_free(literals);
+	sqlite3_free(values);
+	return ret;
+#else
 	return SQLITE_OK;
+#endif
 }
 
-static int statement_vtab_best_index(sqlite3_vtab* pVTab, sqlite3_index_info* index_info){
-	struct statement_vtab* vtab = (struct statement_vtab*)pVTab;
+static int statement_vtab_best_plan(struct statement_vtab* vtab, sqlite3_index_info* index_info, struct statement_plan* plan, struct statement_estimate* estimate) {
+	int ret;
+	statement_vtab_best_in(vtab,index_info,plan);
+	estimate->num_bound = plan->num_bound;
+
+	char* inner;
+	if((ret = statement_vtab_best_constants(vtab,index_info,plan,&inner)) != SQLITE_OK)
+		return ret;
+	char* where;
+	double selectivity;
+	if((ret = statement_vtab_best_predicates(vtab,index_info,plan,&where,&selectivity)) != SQLITE_OK) {
+		sqlite3_free(where);
+		sqlite3_free(inner);
+		return ret;
+	}
+	char* order = statement_vtab_best_order(vtab,index_info,plan);
+	// rows of a distinct variant needn't be ordered unless the query also asks for that
+	int distinct = statement_vtab_best_distinct(vtab,index_info,order);
+	if(distinct == 2)
+		*order = 0;
+	int limit, offset;
+	statement_vtab_best_limit(index_info,!index_info->nOrderBy || order,&limit,&offset);
+
+	index_info->orderByConsumed = !!order;
+	if(inner || where || (order && *order) || distinct || limit >= 0 || offset >= 0 || statement_vtab_pruned(vtab,index_info->colUsed)) {
+		int limit_param = 0, offset_param = 0, next_param = vtab->num_inputs+plan->num_preds+1;
+		if(limit >= 0)
+			limit_param = next_param++;
+		if(offset >= 0)
+			offset_param = next_param++;
+		int variant, num_variants = vtab->num_variants;
+		char* sql = statement_vtab_variant_sql(vtab,inner ? inner : vtab->sql,index_info->colUsed,where,order,!!distinct,limit_param,offset_param);
+		ret = statement_vtab_add_variant(vtab,sql,!where && !distinct && limit < 0 && offset < 0,&variant);
+		sqlite3_free(where);
+		if(ret == SQLITE_OK && inner && vtab->num_variants > num_variants)
+			vtab->num_constant_variants++;
+		sqlite3_free(inner);
+		if(ret == SQLITE_NOMEM) {
+			sqlite3_free(order);
+			return ret;
+		}
+		// otherwise if the statement can't be wrapped (e.g. it ends in a comment) leave all of this to sqlite
+		if(ret != SQLITE_OK) {
+			statement_vtab_unpredicate(vtab,index_info,plan);
+			index_info->orderByConsumed = 0;
+		}
+		else {
+			plan->variant = variant;
+			estimate->selectivity = selectivity;
+			// the variant's ordering comes for free if it matches the statement's own or can be read off an index
+			int base_sorts = vtab->variants[0]->num_sorts, sorts = vtab->variants[variant]->num_sorts;
+			estimate->sorts = ((order && *order) || distinct) && (base_sorts < 0 || sorts < 0 || sorts > base_sorts);
+
+			int argc = plan->num_bound+plan->num_preds;
+#if SQLITE_VERSION_NUMBER >= 3038000
+			if(limit >= 0) {
+				index_info->aConstraintUsage[limit].argvIndex = ++argc;
+				index_info->aConstraintUsage[limit].omit = 1;
+				plan->limit_argv = argc-1;
+				plan->limit_param = limit_param;
+				estimate->limit = limit;
+			}
+			if(offset >= 0) {
+				index_info->aConstraintUsage[offset].argvIndex = ++argc;
+				index_info->aConstraintUsage[offset].omit = 1;
+				plan->offset_argv = argc-1;
+				plan->offset_param = offset_param;
+			}
+#endif
+		}
+	}
+	sqlite3_free(order);
+
+	// sqlite can stop looking for further matches once it's seen the row a unique statement produces
+	if(vtab->unique && plan->num_bound == vtab->num_inputs && !plan->in_mask) {
+		index_info->idxFlags |= SQLITE_INDEX_SCAN_UNIQUE;
+		estimate->unique = 1;
+	}
+
+	statement_vtab_estimate_plan(vtab,index_info,estimate);
+	return statement_vtab_add_plan(vtab,plan,&index_info->idxNum);
+}
+
+// the parameter a constraint on a hidden column binds, or 0 if it can't be used
+static int statement_vtab_constraint_param(struct statement_vtab* vtab, int col, int op) {
+	if(op == SQLITE_INDEX_CONSTRAINT_EQ)
+		return col < vtab->num_outputs+vtab->num_inputs ? col-vtab->num_outputs+1 : 0;
+	int range_op;
+	switch(op) {
+		case SQLITE_INDEX_CONSTRAINT_GT: range_op = STATEMENT_RANGE_GT; break;
+		case SQLITE_INDEX_CONSTRAINT_GE: range_op = STATEMENT_RANGE_GE; break;
+		case SQLITE_INDEX_CONSTRAINT_LT: range_op = STATEMENT_RANGE_LT; break;
+		case SQLITE_INDEX_CONSTRAINT_LE: range_op = STATEMENT_RANGE_LE; break;
+		default: return 0;
+	}
+	for(int i = 0; i < vtab->num_ranges; i++)
+		if(vtab->ranges[i].column == col)
+			return vtab->ranges[i].params[range_op];
+	return 0;
+}
+
+// materialized results are scanned, or looked up by equality on one output using a hash index.
+// lookups find every row that could match but sqlite still checks the constraint, as affinities are applied to values it compares.
+static int statement_vtab_best_materialized(struct statement_vtab* vtab, sqlite3_index_info* index_info) {
+	struct statement_plan plan;
+	memset(&plan,0,sizeof(plan));
+	plan.limit_argv = plan.offset_argv = -1;
+	double rows = vtab->mat ? vtab->mat->rows.num_rows : vtab->est_rows;
+	for(int i = 0; i < index_info->nConstraint; i++) {
+		int col = index_info->aConstraint[i].iColumn;
+		if(index_info->aConstraint[i].usable && index_info->aConstraint[i].op == SQLITE_INDEX_CONSTRAINT_EQ &&
+		   col >= 0 && col < vtab->num_outputs && !sqlite3_stricmp(sqlite3_vtab_collation(index_info,i),"BINARY")) {
+			index_info->aConstraintUsage[i].argvIndex = 1;
+			plan.mat_column = col+1;
+			rows *= STATEMENT_VTAB_EQ_SELECTIVITY;
+			break;
+		}
+	}
+	index_info->estimatedRows = rows < 1 ? 1 : rows;
+	index_info->estimatedCost = 1 + rows;
+	return statement_vtab_add_plan(vtab,&plan,&index_info->idxNum);
+}
+
+// a batch runs the statement for each tuple in turn, leaving any other constraints for sqlite to check against the rows it produces
+// (including those on parameters, whose columns take the tuple's values). only pruning columns is pushed into the statement,
+// as anything else would apply to each tuple rather than to the batch as a whole
+static int statement_vtab_best_batch(struct statement_vtab* vtab, sqlite3_index_info* index_info, int constraint, struct statement_estimate* estimate) {
+	struct statement_plan plan;
+	memset(&plan,0,sizeof(plan));
+	plan.limit_argv = plan.offset_argv = -1;
+	plan.batch = 1;
+	plan.num_bound = vtab->num_inputs;
+	index_info->aConstraintUsage[constraint].argvIndex = 1;
+	index_info->aConstraintUsage[constraint].omit = 1;
+
+	estimate->num_bound = vtab->num_inputs;
+	estimate->tuples = STATEMENT_VTAB_BATCH_TUPLES;
+	statement_vtab_estimate_plan(vtab,index_info,estimate);
+
+	if(statement_vtab_pruned(vtab,index_info->colUsed)) {
+		int variant;
+		int ret = statement_vtab_add_variant(vtab,statement_vtab_variant_sql(vtab,vtab->sql,index_info->colUsed,NULL,NULL,0,0,0),1,&variant);
+		if(ret == SQLITE_NOMEM)
+			return ret;
+		if(ret == SQLITE_OK)
+			plan.variant = variant;
+	}
+	return statement_vtab_add_plan(vtab,&plan,&index_info->idxNum);
+}
+
+static int statement_vtab_plan_index(struct statement_vtab* vtab, sqlite3_index_info* index_info, struct statement_estimate* estimate) {
+	int batch_column = vtab->batched ? vtab->num_outputs+vtab->num_inputs+vtab->num_range_columns : -1;
+	for(int i = 0; i < index_info->nConstraint; i++)
+		if(index_info->aConstraint[i].iColumn == batch_column && index_info->aConstraint[i].op == SQLITE_INDEX_CONSTRAINT_EQ) {
+			if(!index_info->aConstraint[i].usable)
+				return SQLITE_CONSTRAINT;
+			return statement_vtab_best_batch(vtab,index_info,i,estimate);
+		}
+
 	int num_outputs = vtab->num_outputs;
 	int out_constraints = 0;
+	struct statement_plan plan;
+	memset(&plan,0,sizeof(plan));
+	plan.limit_argv = plan.offset_argv = -1;
 	index_info->orderByConsumed = 0;
-	index_info->estimatedCost = 1;
-	index_info->estimatedRows = 1;
 
 	// avoid searching for input columns to bind to parameters if colUsed indicates this query has none
 	// for tables with more than 63 columns the high bit indicates that one or more of these is set; in that case
 	// there still may be no params but we need to continue on to check the constraint array
 	if(!(index_info->colUsed >> (num_outputs < 63 ? num_outputs : 63)))
-		return SQLITE_OK;
+		return statement_vtab_best_plan(vtab,index_info,&plan,estimate);
 
 	int col_max = 0;
 	sqlite3_uint64 used_cols = 0;
 	for(int i = 0; i < index_info->nConstraint; i++) {
 		// skip if this is a limit/offset constraint or a constraint on one of our output columns
+		// __batch and __batch_index are NULL outside of a batch, so whatever sqlite makes of constraints on them is right, as for __truncated.
+		// (equality on __batch never gets this far, as it plans a batch)
 		if(index_info->aConstraint[i].op == SQLITE_INDEX_CONSTRAINT_LIMIT  ||
 		   index_info->aConstraint[i].op == SQLITE_INDEX_CONSTRAINT_OFFSET ||
-		   index_info->aConstraint[i].iColumn < num_outputs)
+		   index_info->aConstraint[i].iColumn < num_outputs ||
+		   index_info->aConstraint[i].iColumn == batch_column ||
+		   index_info->aConstraint[i].iColumn == batch_column+1 ||
+		   index_info->aConstraint[i].iColumn == vtab->truncated_column)
 			continue;
 		// only select query plans where the constrained columns have exact values to bind to statement parameters
 		// since the alternative requires scanning all possible results from the vtab
-		if(!index_info->aConstraint[i].usable || index_info->aConstraint[i].op != SQLITE_INDEX_CONSTRAINT_EQ)
+		int param_idx;
+		if(!index_info->aConstraint[i].usable || !(param_idx = statement_vtab_constraint_param(vtab,index_info->aConstraint[i].iColumn,index_info->aConstraint[i].op)))
 			return SQLITE_CONSTRAINT;
 
-		int col_index = index_info->aConstraint[i].iColumn - num_outputs;
+		int col_index = param_idx-1;
+		// a range parameter can only take the value of one constraint
+		if(index_info->aConstraint[i].op != SQLITE_INDEX_CONSTRAINT_EQ && col_index < 64 && (used_cols >> col_index & 1))
+			return SQLITE_CONSTRAINT;
 		index_info->aConstraintUsage[i].argvIndex = col_index+1;
 		index_info->aConstraintUsage[i].omit = 1;
 
@@ -281,6 +5322,8 @@ static int statement_vtab_best_index(sqlite3_vtab* pVTab, sqlite3_index_info* in
 	if(vtab->num_inputs < col_max)
 		return SQLITE_RANGE;
 
+	plan.num_bound = out_constraints;
+
 	// if the constrained columns are contiguous then we can just tell sqlite to order the arg vector provided to xFilter
 	// in the same order as our column bindings, so there's no need to map between these
 	// (this will always be the case when calling the vtab as a table-valued function)
@@ -288,40 +5331,211 @@ static int statement_vtab_best_index(sqlite3_vtab* pVTab, sqlite3_index_info* in
 	// as just allocating the mapping
 	sqlite_uint64 required_cols = (col_max < 64 ? 1ull << col_max : 0ull)-1;
 	if(!out_constraints || (col_max <= 64 && used_cols == required_cols && out_constraints == col_max))
-		return SQLITE_OK;
+		return statement_vtab_best_plan(vtab,index_info,&plan,estimate);
 
 	// otherwise map the constraint index as provided to xFilter to column index for bindings
 	// this will only be necessary when constraints are not contiguous e.g. where arg1 = x and arg3 = y
-	// in that case bound parameter indexes are encoded as a string in idxStr, in the order they appear in constriants
-	if((size_t)out_constraints > (SIZE_MAX-1)/param_idx_size) {
-		sqlite3_free(pVTab->zErrMsg);
-		if(!(pVTab->zErrMsg = sqlite3_mprintf("Too many constraints to index: %d",out_constraints)))
-			return SQLITE_NOMEM;
-		return SQLITE_ERROR;
-	}
-
-	if(!(index_info->idxStr = sqlite3_malloc64(out_constraints*param_idx_size+1)))
+	// in that case the plan refers to a map of bound parameter indexes, in the order they appear in constraints
+	int* param_map = sqlite3_malloc64(sizeof(*param_map)*(out_constraints+1));
+	if(!param_map)
 		return SQLITE_NOMEM;
-
-	index_info->needToFreeIdxStr = 1;
-
+	param_map[0] = out_constraints;
 	for(int i = 0, constraint_idx = 0; i < index_info->nConstraint; i++) {
 		if(!index_info->aConstraintUsage[i].argvIndex)
 			continue;
-		encode_param_idx(constraint_idx,index_info->idxStr,index_info->aConstraintUsage[i].argvIndex);
-		index_info->aConstraintUsage[i].argvIndex = ++constraint_idx;
+		param_map[++constraint_idx] = index_info->aConstraintUsage[i].argvIndex;
+		index_info->aConstraintUsage[i].argvIndex = constraint_idx;
 	}
+	int ret = statement_vtab_add_param_map(vtab,param_map,&plan.param_map);
+	if(ret != SQLITE_OK)
+		return ret;
+	plan.param_map++;
+
+	return statement_vtab_best_plan(vtab,index_info,&plan,estimate);
+}
 
-	index_info->idxStr[out_constraints*param_idx_size] = '\0';
+// serialize everything about an index_info that planning depends on, apart from the values of LIMIT constraints which only affect estimates
+static char* statement_memo_key(struct statement_vtab* vtab, sqlite3_index_info* index_info, int* len, sqlite3_uint64* hash) {
+	sqlite3_str* str = sqlite3_str_new(vtab->db);
+	int counts[3] = {index_info->nConstraint,index_info->nOrderBy,0};
+#if SQLITE_VERSION_NUMBER >= 3038000
+	if(sqlite3_libversion_number() >= 3038000)
+		counts[2] = sqlite3_vtab_distinct(index_info);
+#endif
+	sqlite3_str_append(str,(const char*)&index_info->colUsed,sizeof(index_info->colUsed));
+	sqlite3_str_append(str,(const char*)counts,sizeof(counts));
+	for(int i = 0; i < index_info->nConstraint; i++) {
+		int constraint[4] = {index_info->aConstraint[i].iColumn,index_info->aConstraint[i].op,index_info->aConstraint[i].usable,0};
+#if SQLITE_VERSION_NUMBER >= 3038000
+		if(sqlite3_libversion_number() >= 3038000)
+			constraint[3] = sqlite3_vtab_in(index_info,i,-1);
+#endif
+		sqlite3_str_append(str,(const char*)constraint,sizeof(constraint));
+#if SQLITE_VERSION_NUMBER >= 3038000
+		// and plans may be made around the values of constant arguments, which are preceded by their type where there's one
+		sqlite3_value* v;
+		if(constraint[0] >= vtab->num_outputs && statement_vtab_specializes(vtab)) {
+			if(constraint[2] && sqlite3_vtab_rhs_value(index_info,i,&v) == SQLITE_OK)
+				statement_serialize_value(str,v);
+			else
+				sqlite3_str_appendchar(str,1,0);
+		}
+#endif
+		// predicates pushed into the statement compare using the constraint's collation
+		if(constraint[0] >= 0 && constraint[0] < vtab->num_outputs) {
+			const char* collation = sqlite3_vtab_collation(index_info,i);
+			sqlite3_str_append(str,collation,(int)strlen(collation)+1);
+		}
+	}
+	for(int i = 0; i < index_info->nOrderBy; i++) {
+		int order[2] = {index_info->aOrderBy[i].iColumn,index_info->aOrderBy[i].desc};
+		sqlite3_str_append(str,(const char*)order,sizeof(order));
+	}
+	*len = sqlite3_str_length(str);
+	char* key = sqlite3_str_finish(str);
+	*hash = 0xcbf29ce484222325ull;
+	for(int i = 0; key && i < *len; i++)
+		*hash = (*hash ^ (unsigned char)key[i]) * 0x100000001b3ull;
+	return key;
+}
 
+static int statement_memo_replay(struct statement_vtab* vtab, sqlite3_index_info* index_info, const struct statement_memo* memo) {
+	if(memo->ret != SQLITE_OK)
+		return memo->ret;
+	for(int i = 0; i < memo->num_constraints; i++) {
+		index_info->aConstraintUsage[i].argvIndex = memo->usage[i].argv_index;
+		index_info->aConstraintUsage[i].omit = memo->usage[i].omit;
+#if SQLITE_VERSION_NUMBER >= 3038000
+		if(memo->usage[i].in)
+			sqlite3_vtab_in(index_info,i,1);
+#endif
+	}
+	index_info->idxNum = memo->idx_num;
+	index_info->orderByConsumed = memo->order_by_consumed;
+	index_info->idxFlags = memo->idx_flags;
+	statement_vtab_estimate_plan(vtab,index_info,&memo->estimate);
 	return SQLITE_OK;
 }
 
+// remember the outcome of planning, taking ownership of the key. failing to is no reason to fail the query
+static void statement_memo_store(struct statement_vtab* vtab, sqlite3_index_info* index_info, const struct statement_estimate* estimate, int ret, char* key, int key_len, sqlite3_uint64 hash) {
+	struct statement_memo* memo = sqlite3_malloc64(sizeof(*memo) + sizeof(*memo->usage)*index_info->nConstraint);
+	if(!memo) {
+		sqlite3_free(key);
+		return;
+	}
+	memo->hash = hash;
+	memo->key = key;
+	memo->key_len = key_len;
+	memo->ret = ret;
+	memo->idx_num = index_info->idxNum;
+	memo->order_by_consumed = index_info->orderByConsumed;
+	memo->idx_flags = index_info->idxFlags;
+	memo->estimate = *estimate;
+	memo->num_constraints = index_info->nConstraint;
+	sqlite3_uint64 in_mask = ret == SQLITE_OK ? vtab->plans[index_info->idxNum]->in_mask : 0;
+	for(int i = 0; i < index_info->nConstraint; i++) {
+		int argv_idx = index_info->aConstraintUsage[i].argvIndex-1;
+		memo->usage[i].argv_index = argv_idx+1;
+		memo->usage[i].omit = index_info->aConstraintUsage[i].omit;
+		memo->usage[i].in = argv_idx >= 0 && argv_idx < STATEMENT_VTAB_MAX_IN && (in_mask >> argv_idx & 1);
+	}
+
+	struct statement_memo** slot = &vtab->memos[vtab->next_memo];
+	vtab->next_memo = (vtab->next_memo + 1) % STATEMENT_VTAB_MEMO_SIZE;
+	if(*slot) {
+		sqlite3_free((*slot)->key);
+		sqlite3_free(*slot);
+	}
+	*slot = memo;
+}
+
+// sqlite plans each query on a vtab several times over, and statements using it again whenever they're prepared,
+// so what's chosen for an index_info is remembered rather than worked out again
+static int statement_vtab_best_index(sqlite3_vtab* pVTab, sqlite3_index_info* index_info){
+	struct statement_vtab* vtab = (struct statement_vtab*)pVTab;
+	// sqlite plans its statements again after a schema change, before running any of them
+	int changed, ret;
+	if(vtab->written && (ret = statement_vtab_reinline(vtab,&changed)) != SQLITE_OK)
+		return ret;
+	if(vtab->materialize)
+		return statement_vtab_best_materialized(vtab,index_info);
+
+	int key_len;
+	sqlite3_uint64 hash;
+	char* key = statement_memo_key(vtab,index_info,&key_len,&hash);
+	if(!key)
+		return SQLITE_NOMEM;
+	for(int i = 0; i < STATEMENT_VTAB_MEMO_SIZE; i++) {
+		struct statement_memo* memo = vtab->memos[i];
+		if(memo && memo->hash == hash && memo->key_len == key_len && !memcmp(memo->key,key,key_len)) {
+			sqlite3_free(key);
+			return statement_memo_replay(vtab,index_info,memo);
+		}
+	}
+
+	struct statement_estimate estimate = {0,1,1,0,-1,0};
+	ret = statement_vtab_plan_index(vtab,index_info,&estimate);
+	if(ret == SQLITE_OK || ret == SQLITE_CONSTRAINT)
+		statement_memo_store(vtab,index_info,&estimate,ret,key,key_len,hash);
+	else
+		sqlite3_free(key);
+	return ret;
+}
+
 static sqlite3_module statement_vtab_module = {
+	.iVersion    = 3,
 	.xCreate     = statement_vtab_create,
 	.xConnect    = statement_vtab_connect,
 	.xBestIndex  = statement_vtab_best_index,
 	.xDisconnect = statement_vtab_destroy,
+	.xDestroy    = statement_vtab_drop,
+	.xRename     = statement_vtab_rename,
+	.xShadowName = statement_vtab_shadow_name,
+	.xOpen       = statement_vtab_open,
+	.xClose      = statement_vtab_close,
+	.xFilter     = statement_vtab_filter,
+	.xNext       = statement_vtab_next,
+	.xEof        = statement_vtab_eof,
+	.xColumn     = statement_vtab_column,
+	.xRowid      = statement_vtab_rowid,
+};
+
+// a statement registered through sqlite3_statementvtab_register as an eponymous-only module of its own, which sqlite connects
+// the first time it's used on the connection, without anything written to the schema
+struct statement_registration {
+	struct statement_registry* registry;
+	int argc; // module arguments following the table name: the parenthesized statement and its options
+	char** argv;
+};
+
+static void statement_registration_free(void* p) {
+	struct statement_registration* registration = p;
+	if(registration->registry)
+		statement_registry_release(registration->registry);
+	for(int i = 0; i < registration->argc; i++)
+		sqlite3_free(registration->argv[i]);
+	sqlite3_free(registration->argv);
+	sqlite3_free(registration);
+}
+
+static int statement_registered_connect(sqlite3* db, void* pAux, int argc, const char* const* argv, sqlite3_vtab** ppVtab, char** pzErr) {
+	struct statement_registration* registration = pAux;
+	const char** args = sqlite3_malloc64(sizeof(*args)*(3+registration->argc));
+	if(!args)
+		return SQLITE_NOMEM;
+	memcpy(args,argv,sizeof(*args)*3);
+	memcpy(args+3,registration->argv,sizeof(*args)*registration->argc);
+	int ret = statement_vtab_init(db,registration->registry,3+registration->argc,args,ppVtab,pzErr,1);
+	sqlite3_free(args);
+	return ret;
+}
+
+static sqlite3_module statement_registered_module = {
+	.iVersion    = 3,
+	.xConnect    = statement_registered_connect,
+	.xBestIndex  = statement_vtab_best_index,
+	.xDisconnect = statement_vtab_destroy,
 	.xDestroy    = statement_vtab_destroy,
 	.xOpen       = statement_vtab_open,
 	.xClose      = statement_vtab_close,
@@ -332,6 +5546,491 @@ static sqlite3_module statement_vtab_module = {
 	.xRowid      = statement_vtab_rowid,
 };
 
+// statement_vtab_stats: an eponymous table listing each statement vtab on the connection along with its counters
+enum {
+	STATEMENT_STATS_SCHEMA,
+	STATEMENT_STATS_NAME,
+	STATEMENT_STATS_SQL,
+	STATEMENT_STATS_PREPARES,
+	STATEMENT_STATS_OPENS,
+	STATEMENT_STATS_FILTERS,
+	STATEMENT_STATS_ROWS,
+	STATEMENT_STATS_STEP_NS,
+	STATEMENT_STATS_CACHE_HITS,
+	STATEMENT_STATS_CACHE_MISSES,
+	STATEMENT_STATS_FULLSCAN_STEPS,
+	STATEMENT_STATS_SORTS,
+	STATEMENT_STATS_AUTOINDEXES,
+	STATEMENT_STATS_VM_STEPS,
+	STATEMENT_STATS_MEMUSED,
+	STATEMENT_STATS_LATENCY_HISTOGRAM,
+	STATEMENT_STATS_ROWS_HISTOGRAM,
+	STATEMENT_STATS_SLOW,
+	STATEMENT_STATS_AUTOINDEX_INVOCATIONS,
+	STATEMENT_STATS_FULLSCAN_INVOCATIONS,
+	STATEMENT_STATS_RECOMMENDATION,
+	STATEMENT_STATS_OVER_BUDGET,
+};
+
+struct statement_stats_vtab {
+	sqlite3_vtab base;
+	struct statement_registry* registry;
+};
+
+struct statement_stats_cursor {
+	sqlite3_vtab_cursor base;
+	struct statement_vtab* vtab;
+	sqlite3_int64 rowid;
+};
+
+static int statement_stats_connect(sqlite3* db, void* pAux, int argc, const char* const* argv, sqlite3_vtab** ppVtab, char** pzErr) {
+	int ret = sqlite3_declare_vtab(db,
+		"CREATE TABLE x(schema TEXT, name TEXT, sql TEXT, prepares INTEGER, opens INTEGER, filters INTEGER, rows INTEGER, step_ns INTEGER,"
+		" cache_hits INTEGER, cache_misses INTEGER, fullscan_steps INTEGER, sorts INTEGER, autoindexes INTEGER, vm_steps INTEGER, memused INTEGER,"
+		" latency_histogram TEXT, rows_histogram TEXT, slow TEXT, autoindex_invocations INTEGER, fullscan_invocations INTEGER, recommendation TEXT,"
+		" over_budget INTEGER)");
+	if(ret != SQLITE_OK)
+		return ret;
+	struct statement_stats_vtab* vtab = sqlite3_malloc64(sizeof(*vtab));
+	if(!vtab)
+		return SQLITE_NOMEM;
+	memset(vtab,0,sizeof(*vtab));
+	vtab->registry = pAux;
+	*ppVtab = &vtab->base;
+	return SQLITE_OK;
+}
+
+static int statement_stats_disconnect(sqlite3_vtab* pVTab) {
+	sqlite3_free(pVTab);
+	return SQLITE_OK;
+}
+
+static int statement_stats_best_index(sqlite3_vtab* pVTab, sqlite3_index_info* index_info) {
+	index_info->estimatedCost = 10;
+	index_info->estimatedRows = 10;
+	return SQLITE_OK;
+}
+
+static int statement_stats_open(sqlite3_vtab* pVTab, sqlite3_vtab_cursor** ppCursor) {
+	struct statement_stats_cursor* cur = sqlite3_malloc64(sizeof(*cur));
+	if(!cur)
+		return SQLITE_NOMEM;
+	memset(cur,0,sizeof(*cur));
+	*ppCursor = &cur->base;
+	return SQLITE_OK;
+}
+
+static int statement_stats_close(sqlite3_vtab_cursor* cur) {
+	sqlite3_free(cur);
+	return SQLITE_OK;
+}
+
+static int statement_stats_filter(sqlite3_vtab_cursor* cur, int idxNum, const char* idxStr, int argc, sqlite3_value** argv) {
+	struct statement_stats_cursor* statscur = (struct statement_stats_cursor*)cur;
+	statscur->vtab = ((struct statement_stats_vtab*)cur->pVtab)->registry->head;
+	statscur->rowid = 1;
+	return SQLITE_OK;
+}
+
+static int statement_stats_next(sqlite3_vtab_cursor* cur) {
+	struct statement_stats_cursor* statscur = (struct statement_stats_cursor*)cur;
+	statscur->vtab = statscur->vtab->registry_next;
+	statscur->rowid++;
+	return SQLITE_OK;
+}
+
+static int statement_stats_eof(sqlite3_vtab_cursor* cur) {
+	return !((struct statement_stats_cursor*)cur)->vtab;
+}
+
+static int statement_stats_rowid(sqlite3_vtab_cursor* cur, sqlite_int64* pRowid) {
+	*pRowid = ((struct statement_stats_cursor*)cur)->rowid;
+	return SQLITE_OK;
+}
+
+#ifndef STATEMENT_VTAB_OMIT_STATS
+// histograms are JSON arrays of counts, trimmed after the last non-zero one, and the slow log an array of the invocations it holds, latest first
+static int statement_stats_json(sqlite3_context* ctx, const struct statement_stats* stats, int column) {
+	sqlite3_str* str = sqlite3_str_new(sqlite3_context_db_handle(ctx));
+	sqlite3_str_appendall(str,"[");
+	if(column == STATEMENT_STATS_SLOW) {
+		sqlite3_int64 num_slow = stats->num_slow < STATEMENT_VTAB_SLOW_LOG_SIZE ? stats->num_slow : STATEMENT_VTAB_SLOW_LOG_SIZE;
+		for(sqlite3_int64 n = 0; n < num_slow; n++) {
+			int i = (stats->num_slow-1-n) % STATEMENT_VTAB_SLOW_LOG_SIZE;
+			sqlite3_str_appendf(str,"%s{\"elapsed_ns\":%lld,\"rows\":%lld,\"args\":\"",n ? "," : "",stats->slow[i].elapsed_ns,stats->slow[i].rows);
+			for(const char* c = stats->slow[i].args; c && *c; c++) {
+				if(*c == '"' || *c == '\\')
+					sqlite3_str_appendf(str,"\\%c",*c);
+				else if((unsigned char)*c < 0x20)
+					sqlite3_str_appendf(str,"\\u%04x",*c);
+				else
+					sqlite3_str_appendchar(str,1,*c);
+			}
+			sqlite3_str_appendall(str,"\"}");
+		}
+	}
+	else {
+		const sqlite3_int64* counts = column == STATEMENT_STATS_LATENCY_HISTOGRAM ? stats->latency_histogram : stats->rows_histogram;
+		int num_buckets = STATEMENT_VTAB_HISTOGRAM_BUCKETS;
+		while(num_buckets && !counts[num_buckets-1])
+			num_buckets--;
+		for(int i = 0; i < num_buckets; i++)
+			sqlite3_str_appendf(str,"%s%lld",i ? "," : "",counts[i]);
+	}
+	sqlite3_str_appendall(str,"]");
+	int ret = sqlite3_str_errcode(str);
+	char* json = sqlite3_str_finish(str);
+	if(ret == SQLITE_OK)
+		sqlite3_result_text(ctx,json,-1,sqlite3_free);
+	else
+		sqlite3_free(json);
+	return ret;
+}
+#endif
+
+static int statement_stats_column(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int i) {
+	struct statement_vtab* vtab = ((struct statement_stats_cursor*)cur)->vtab;
+	switch(i) {
+		case STATEMENT_STATS_SCHEMA: sqlite3_result_text(ctx,vtab->schema,-1,SQLITE_TRANSIENT); return SQLITE_OK;
+		case STATEMENT_STATS_NAME:   sqlite3_result_text(ctx,vtab->name,-1,SQLITE_TRANSIENT); return SQLITE_OK;
+		case STATEMENT_STATS_SQL:    sqlite3_result_text(ctx,vtab->sql,vtab->sql_len,SQLITE_TRANSIENT); return SQLITE_OK;
+		case STATEMENT_STATS_MEMUSED: {
+			// the memory held by statements currently in the pool
+			sqlite3_int64 memused = 0;
+			for(int v = 0; v < vtab->num_variants; v++)
+				for(int p = 0; p < vtab->variants[v]->pool_size; p++)
+					memused += sqlite3_stmt_status(vtab->variants[v]->pool[p],SQLITE_STMTSTATUS_MEMUSED,0);
+			sqlite3_result_int64(ctx,memused);
+			return SQLITE_OK;
+		}
+	}
+	// counters that were compiled out are reported as NULL
+#ifndef STATEMENT_VTAB_OMIT_STATS
+	const struct statement_stats* stats = &vtab->stats;
+	sqlite3_int64 value = 0;
+	switch(i) {
+		case STATEMENT_STATS_PREPARES:       value = stats->prepares; break;
+		case STATEMENT_STATS_OPENS:          value = stats->opens; break;
+		case STATEMENT_STATS_FILTERS:        value = stats->filters; break;
+		case STATEMENT_STATS_ROWS:           value = stats->rows; break;
+		case STATEMENT_STATS_STEP_NS:        value = stats->step_ns; break;
+		case STATEMENT_STATS_CACHE_HITS:     value = stats->cache_hits; break;
+		case STATEMENT_STATS_CACHE_MISSES:   value = stats->cache_misses; break;
+		case STATEMENT_STATS_FULLSCAN_STEPS: value = stats->fullscan_steps; break;
+		case STATEMENT_STATS_SORTS:          value = stats->sorts; break;
+		case STATEMENT_STATS_AUTOINDEXES:    value = stats->autoindexes; break;
+		case STATEMENT_STATS_VM_STEPS:       value = stats->vm_steps; break;
+		case STATEMENT_STATS_AUTOINDEX_INVOCATIONS: value = stats->autoindex_invocations; break;
+		case STATEMENT_STATS_FULLSCAN_INVOCATIONS:  value = stats->fullscan_invocations; break;
+		case STATEMENT_STATS_OVER_BUDGET:           value = stats->over_budget; break;
+		case STATEMENT_STATS_RECOMMENDATION:
+			if(stats->recommendation)
+				sqlite3_result_text(ctx,stats->recommendation,-1,SQLITE_TRANSIENT);
+			return SQLITE_OK;
+		case STATEMENT_STATS_LATENCY_HISTOGRAM:
+		case STATEMENT_STATS_ROWS_HISTOGRAM:
+		case STATEMENT_STATS_SLOW:
+			return statement_stats_json(ctx,stats,i);
+	}
+	sqlite3_result_int64(ctx,value);
+#endif
+	return SQLITE_OK;
+}
+
+// deleting a row resets its vtab's counters, which carry on counting from zero
+static int statement_stats_update(sqlite3_vtab* pVTab, int argc, sqlite3_value** argv, sqlite_int64* pRowid) {
+	if(argc != 1) {
+		sqlite3_free(pVTab->zErrMsg);
+		pVTab->zErrMsg = sqlite3_mprintf("statement_vtab_stats rows can only be deleted, which resets them");
+		return SQLITE_READONLY;
+	}
+#ifndef STATEMENT_VTAB_OMIT_STATS
+	sqlite3_int64 rowid = sqlite3_value_int64(argv[0]);
+	struct statement_vtab* vtab = ((struct statement_stats_vtab*)pVTab)->registry->head;
+	for(sqlite3_int64 i = 1; vtab && i < rowid; i++)
+		vtab = vtab->registry_next;
+	if(vtab)
+		statement_stats_clear(&vtab->stats);
+#endif
+	return SQLITE_OK;
+}
+
+static sqlite3_module statement_stats_module = {
+	.xConnect    = statement_stats_connect,
+	.xBestIndex  = statement_stats_best_index,
+	.xDisconnect = statement_stats_disconnect,
+	.xOpen       = statement_stats_open,
+	.xClose      = statement_stats_close,
+	.xFilter     = statement_stats_filter,
+	.xNext       = statement_stats_next,
+	.xEof        = statement_stats_eof,
+	.xColumn     = statement_stats_column,
+	.xRowid      = statement_stats_rowid,
+	.xUpdate     = statement_stats_update,
+};
+
+// statement_vtab_plan lists the query plan of the inner statement for each plan a vtab has chosen, numbered as in the
+// INDEX n of the outer query's plan, along with what profile counted for each loop of it.
+// given constraints, it lists only the plan chosen for a query selecting from the vtab with those
+enum {
+	STATEMENT_PLAN_SCHEMA,
+	STATEMENT_PLAN_NAME,
+	STATEMENT_PLAN_PLAN,
+	STATEMENT_PLAN_VARIANT,
+	STATEMENT_PLAN_SQL,
+	STATEMENT_PLAN_ID,
+	STATEMENT_PLAN_PARENT,
+	STATEMENT_PLAN_DETAIL,
+	STATEMENT_PLAN_LOOPS,
+	STATEMENT_PLAN_ROWS,
+	STATEMENT_PLAN_CYCLES,
+	STATEMENT_PLAN_TABLENAME,
+	STATEMENT_PLAN_CONSTRAINTS,
+};
+
+struct statement_plan_cursor {
+	sqlite3_vtab_cursor base;
+	char* tablename;   // only vtabs of this name are listed, if set
+	char* constraints; // clauses following SELECT * FROM the vtab, whose plan is the only one listed, if set
+	struct statement_vtab* vtab;
+	int plan;              // -1 for a vtab that hasn't planned anything yet, which lists the statement as written
+	struct statement_variant* variant;
+	sqlite3_stmt* eqp;
+	sqlite3_int64 rowid;
+};
+
+static int statement_plan_connect(sqlite3* db, void* pAux, int argc, const char* const* argv, sqlite3_vtab** ppVtab, char** pzErr) {
+	int ret = sqlite3_declare_vtab(db,
+		"CREATE TABLE x(schema TEXT, name TEXT, plan INTEGER, variant INTEGER, sql TEXT, id INTEGER, parent INTEGER, detail TEXT,"
+		" loops INTEGER, rows INTEGER, cycles INTEGER, tablename HIDDEN, constraints HIDDEN)");
+	if(ret != SQLITE_OK)
+		return ret;
+	struct statement_stats_vtab* vtab = sqlite3_malloc64(sizeof(*vtab));
+	if(!vtab)
+		return SQLITE_NOMEM;
+	memset(vtab,0,sizeof(*vtab));
+	vtab->registry = pAux;
+	*ppVtab = &vtab->base;
+	return SQLITE_OK;
+}
+
+static int statement_plan_best_index(sqlite3_vtab* pVTab, sqlite3_index_info* index_info) {
+	index_info->estimatedCost = 100;
+	index_info->estimatedRows = 100;
+	// idxNum has bit 0 set if the tablename is in argv, and bit 1 if constraints follow it
+	int tablename = -1, constraints = -1;
+	for(int i = 0; i < index_info->nConstraint; i++)
+		if(index_info->aConstraint[i].usable && index_info->aConstraint[i].op == SQLITE_INDEX_CONSTRAINT_EQ) {
+			if(index_info->aConstraint[i].iColumn == STATEMENT_PLAN_TABLENAME && tablename < 0)
+				tablename = i;
+			else if(index_info->aConstraint[i].iColumn == STATEMENT_PLAN_CONSTRAINTS && constraints < 0)
+				constraints = i;
+		}
+	int argc = 0;
+	if(tablename >= 0) {
+		index_info->aConstraintUsage[tablename].argvIndex = ++argc;
+		index_info->aConstraintUsage[tablename].omit = 1;
+		index_info->idxNum |= 1;
+		index_info->estimatedCost = 10;
+		index_info->estimatedRows = 10;
+	}
+	if(constraints >= 0) {
+		index_info->aConstraintUsage[constraints].argvIndex = ++argc;
+		index_info->aConstraintUsage[constraints].omit = 1;
+		index_info->idxNum |= 2;
+	}
+	return SQLITE_OK;
+}
+
+static int statement_plan_open(sqlite3_vtab* pVTab, sqlite3_vtab_cursor** ppCursor) {
+	struct statement_plan_cursor* cur = sqlite3_malloc64(sizeof(*cur));
+	if(!cur)
+		return SQLITE_NOMEM;
+	memset(cur,0,sizeof(*cur));
+	*ppCursor = &cur->base;
+	return SQLITE_OK;
+}
+
+static int statement_plan_close(sqlite3_vtab_cursor* cur) {
+	sqlite3_finalize(((struct statement_plan_cursor*)cur)->eqp);
+	sqlite3_free(((struct statement_plan_cursor*)cur)->tablename);
+	sqlite3_free(((struct statement_plan_cursor*)cur)->constraints);
+	sqlite3_free(cur);
+	return SQLITE_OK;
+}
+
+// find the plan chosen for a query with the given constraints from the outer query's plan, where its INDEX n is the plan's index.
+// preparing the query plans it if it hasn't been already. results in -1 if the query doesn't select from the vtab at all
+static int statement_plan_chosen(struct statement_vtab* vtab, const char* constraints, int* plan) {
+	*plan = -1;
+	char* sql = sqlite3_mprintf("EXPLAIN QUERY PLAN SELECT * FROM \"%w\".\"%w\" %s",vtab->schema,vtab->name,constraints);
+	if(!sql)
+		return SQLITE_NOMEM;
+	sqlite3_stmt* eqp;
+	const char* tail;
+	int ret = sqlite3_prepare_v2(vtab->db,sql,-1,&eqp,&tail);
+	if(ret == SQLITE_OK && tail[strspn(tail," \t\r\n;")]) {
+		sqlite3_finalize(eqp);
+		sqlite3_free(sql);
+		return SQLITE_MISUSE;
+	}
+	sqlite3_free(sql);
+	if(ret != SQLITE_OK)
+		return ret;
+	while((ret = sqlite3_step(eqp)) == SQLITE_ROW) {
+		const char* detail = (const char*)sqlite3_column_text(eqp,3);
+		const char* index = detail ? strstr(detail," VIRTUAL TABLE INDEX ") : NULL;
+		if(index) {
+			*plan = atoi(index+strlen(" VIRTUAL TABLE INDEX "));
+			break;
+		}
+	}
+	sqlite3_finalize(eqp);
+	if(*plan >= vtab->num_plans)
+		*plan = -1;
+	return ret == SQLITE_ROW || ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+// step to the next row of the current plan, moving on to the next plan or vtab once it runs out
+static int statement_plan_step(struct statement_plan_cursor* cur) {
+	for(;;) {
+		if(cur->eqp) {
+			int ret = sqlite3_step(cur->eqp);
+			if(ret == SQLITE_ROW)
+				return SQLITE_OK;
+			sqlite3_finalize(cur->eqp);
+			cur->eqp = NULL;
+			if(ret != SQLITE_DONE)
+				return ret;
+			if(cur->constraints || ++cur->plan >= cur->vtab->num_plans) {
+				cur->vtab = cur->vtab->registry_next;
+				cur->plan = -1;
+			}
+		}
+
+		while(cur->vtab && cur->tablename && sqlite3_stricmp(cur->vtab->name,cur->tablename))
+			cur->vtab = cur->vtab->registry_next;
+		if(!cur->vtab)
+			return SQLITE_OK;
+		if(cur->constraints) {
+			int ret = statement_plan_chosen(cur->vtab,cur->constraints,&cur->plan);
+			if(ret != SQLITE_OK)
+				return ret;
+			if(cur->plan < 0) {
+				cur->vtab = cur->vtab->registry_next;
+				continue;
+			}
+		}
+		else if(cur->plan < 0)
+			cur->plan = cur->vtab->num_plans ? 0 : -1;
+		cur->variant = cur->vtab->variants[cur->plan < 0 ? 0 : cur->vtab->plans[cur->plan]->variant];
+
+		char* sql = sqlite3_mprintf("EXPLAIN QUERY PLAN %s",cur->variant->sql);
+		if(!sql)
+			return SQLITE_NOMEM;
+		int ret = sqlite3_prepare_v2(cur->vtab->db,sql,-1,&cur->eqp,NULL);
+		sqlite3_free(sql);
+		if(ret != SQLITE_OK)
+			return ret;
+	}
+}
+
+static int statement_plan_next(sqlite3_vtab_cursor* cur) {
+	struct statement_plan_cursor* plancur = (struct statement_plan_cursor*)cur;
+	plancur->rowid += !!plancur->eqp;
+	int ret = statement_plan_step(plancur);
+	if(ret != SQLITE_OK) {
+		sqlite3_free(cur->pVtab->zErrMsg);
+		if(ret == SQLITE_MISUSE) {
+			ret = SQLITE_ERROR;
+			cur->pVtab->zErrMsg = sqlite3_mprintf("constraints for %s must be clauses of a single statement",plancur->vtab->name);
+		}
+		else
+			cur->pVtab->zErrMsg = sqlite3_mprintf("%s",sqlite3_errmsg(plancur->vtab->db));
+		if(!cur->pVtab->zErrMsg)
+			ret = SQLITE_NOMEM;
+	}
+	return ret;
+}
+
+static int statement_plan_filter(sqlite3_vtab_cursor* cur, int idxNum, const char* idxStr, int argc, sqlite3_value** argv) {
+	struct statement_plan_cursor* plancur = (struct statement_plan_cursor*)cur;
+	sqlite3_finalize(plancur->eqp);
+	plancur->eqp = NULL;
+	sqlite3_free(plancur->tablename);
+	plancur->tablename = NULL;
+	sqlite3_free(plancur->constraints);
+	plancur->constraints = NULL;
+	plancur->vtab = ((struct statement_stats_vtab*)cur->pVtab)->registry->head;
+	plancur->plan = -1;
+	plancur->rowid = 1;
+	sqlite3_value* tablename = idxNum & 1 ? argv[0] : NULL;
+	sqlite3_value* constraints = idxNum & 2 ? argv[argc-1] : NULL;
+	if((tablename && sqlite3_value_type(tablename) == SQLITE_NULL) || (constraints && sqlite3_value_type(constraints) == SQLITE_NULL))
+		plancur->vtab = NULL;
+	else if((tablename && !(plancur->tablename = sqlite3_mprintf("%s",sqlite3_value_text(tablename)))) ||
+	        (constraints && !(plancur->constraints = sqlite3_mprintf("%s",sqlite3_value_text(constraints)))))
+		return SQLITE_NOMEM;
+	return statement_plan_next(cur);
+}
+
+static int statement_plan_eof(sqlite3_vtab_cursor* cur) {
+	return !((struct statement_plan_cursor*)cur)->vtab;
+}
+
+static int statement_plan_rowid(sqlite3_vtab_cursor* cur, sqlite_int64* pRowid) {
+	*pRowid = ((struct statement_plan_cursor*)cur)->rowid;
+	return SQLITE_OK;
+}
+
+static int statement_plan_column(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int i) {
+	struct statement_plan_cursor* plancur = (struct statement_plan_cursor*)cur;
+	switch(i) {
+		case STATEMENT_PLAN_SCHEMA:    sqlite3_result_text(ctx,plancur->vtab->schema,-1,SQLITE_TRANSIENT); break;
+		case STATEMENT_PLAN_NAME:      sqlite3_result_text(ctx,plancur->vtab->name,-1,SQLITE_TRANSIENT); break;
+		case STATEMENT_PLAN_PLAN:      if(plancur->plan >= 0) sqlite3_result_int(ctx,plancur->plan); break;
+		case STATEMENT_PLAN_VARIANT:   sqlite3_result_int(ctx,plancur->variant->index); break;
+		case STATEMENT_PLAN_SQL:       sqlite3_result_text(ctx,plancur->variant->sql,-1,SQLITE_TRANSIENT); break;
+		case STATEMENT_PLAN_ID:        sqlite3_result_value(ctx,sqlite3_column_value(plancur->eqp,0)); break;
+		case STATEMENT_PLAN_PARENT:    sqlite3_result_value(ctx,sqlite3_column_value(plancur->eqp,1)); break;
+		case STATEMENT_PLAN_DETAIL:    sqlite3_result_value(ctx,sqlite3_column_value(plancur->eqp,3)); break;
+		case STATEMENT_PLAN_TABLENAME: if(plancur->tablename) sqlite3_result_text(ctx,plancur->tablename,-1,SQLITE_TRANSIENT); break;
+		case STATEMENT_PLAN_CONSTRAINTS: if(plancur->constraints) sqlite3_result_text(ctx,plancur->constraints,-1,SQLITE_TRANSIENT); break;
+#ifdef STATEMENT_VTAB_SCANSTATUS
+		// loops are matched up with the plan by their description. anything not profiled is NULL
+		default: {
+			const char* detail = (const char*)sqlite3_column_text(plancur->eqp,3);
+			for(int p = 0; detail && p < plancur->variant->num_profiled; p++) {
+				const struct statement_profile* profiled = &plancur->variant->profiled[p];
+				if(strcmp(profiled->detail,detail))
+					continue;
+				if(i == STATEMENT_PLAN_LOOPS)
+					sqlite3_result_int64(ctx,profiled->loops);
+				else if(i == STATEMENT_PLAN_ROWS)
+					sqlite3_result_int64(ctx,profiled->rows);
+				else if(profiled->cycles >= 0)
+					sqlite3_result_int64(ctx,profiled->cycles);
+				break;
+			}
+		}
+#endif
+	}
+	return SQLITE_OK;
+}
+
+static sqlite3_module statement_plan_module = {
+	.xConnect    = statement_plan_connect,
+	.xBestIndex  = statement_plan_best_index,
+	.xDisconnect = statement_stats_disconnect,
+	.xOpen       = statement_plan_open,
+	.xClose      = statement_plan_close,
+	.xFilter     = statement_plan_filter,
+	.xNext       = statement_plan_next,
+	.xEof        = statement_plan_eof,
+	.xColumn     = statement_plan_column,
+	.xRowid      = statement_plan_rowid,
+};
+
 #ifdef SQLITE_CORE
 #define statement_vtab_entry_point sqlite3_statementvtab_init
 #else
@@ -351,5 +6050,150 @@ int statement_vtab_entry_point(sqlite3* db, char** pzErrMsg, const sqlite3_api_r
 		return SQLITE_ERROR;
 	}
 
-	return sqlite3_create_module(db, "statement", &statement_vtab_module, NULL);
+	struct statement_registry* registry = sqlite3_malloc(sizeof(*registry));
+	if(!registry)
+		return SQLITE_NOMEM;
+	memset(registry,0,sizeof(*registry));
+	registry->db = db;
+	registry->refs = 1;
+	sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MAIN);
+	sqlite3_mutex_enter(mutex);
+	statement_num_registries++;
+	registry->next = statement_registries;
+	statement_registries = registry;
+	sqlite3_mutex_leave(mutex);
+	int ret = sqlite3_create_module_v2(db, "statement", &statement_vtab_module, registry, statement_registry_free);
+	if(ret != SQLITE_OK)
+		return ret;
+	if((ret = sqlite3_create_module(db, "statement_vtab_stats", &statement_stats_module, registry)) != SQLITE_OK ||
+	   (ret = sqlite3_create_module(db, "statement_vtab_plan", &statement_plan_module, registry)) != SQLITE_OK)
+		return ret;
+	statement_scalar_scan(registry,db);
+	return SQLITE_OK;
+}
+
+// register a statement as an eponymous table-valued function on the connection, as if by CREATE VIRTUAL TABLE name USING
+// statement((sql), options...) except that nothing is written to the schema. the extension is set up on the connection if it isn't yet
+#ifdef _WIN32
+__declspec(dllexport)
+#endif
+int sqlite3_statementvtab_register(sqlite3* db, const char* name, const char* sql, int num_options, const char* const* options, char** pzErrMsg) {
+	int ret;
+	char* err = NULL;
+	if(pzErrMsg)
+		*pzErrMsg = NULL;
+	if(!name || !sql || num_options < 0 || (num_options && !options))
+		return SQLITE_MISUSE;
+
+	struct statement_registration* registration = sqlite3_malloc64(sizeof(*registration));
+	if(!registration)
+		return SQLITE_NOMEM;
+	memset(registration,0,sizeof(*registration));
+	if(!(registration->argv = sqlite3_malloc64(sizeof(*registration->argv)*(1+num_options)))) {
+		ret = SQLITE_NOMEM;
+		goto error;
+	}
+	if(!(registration->argv[registration->argc++] = sqlite3_mprintf("(%s)",sql))) {
+		ret = SQLITE_NOMEM;
+		goto error;
+	}
+	for(int i = 0; i < num_options; i++)
+		if(!(registration->argv[registration->argc++] = sqlite3_mprintf("%s",options[i]))) {
+			ret = SQLITE_NOMEM;
+			goto error;
+		}
+
+	// options are checked up front rather than the first time the statement is used
+	struct statement_vtab scratch;
+	memset(&scratch,0,sizeof(scratch));
+	const char** args = sqlite3_malloc64(sizeof(*args)*(3+registration->argc));
+	if(!args) {
+		ret = SQLITE_NOMEM;
+		goto error;
+	}
+	memcpy(args+3,registration->argv,sizeof(*args)*registration->argc);
+	ret = statement_vtab_parse_options(&scratch,3+registration->argc,args,&err);
+	sqlite3_free(args);
+	if(ret != SQLITE_OK)
+		goto error;
+	// persistent results are kept in a table created along with the vtab
+	if(scratch.persist) {
+		ret = SQLITE_MISUSE;
+		if(!(err = sqlite3_mprintf("persist can't be used with a registered statement")))
+			ret = SQLITE_NOMEM;
+		goto error;
+	}
+
+	if(!(registration->registry = statement_registry_find(db))) {
+#ifdef SQLITE_CORE
+		ret = statement_vtab_entry_point(db,&err,NULL);
+#else
+		ret = statement_vtab_entry_point(db,&err,sqlite3_api);
+#endif
+		if(ret != SQLITE_OK)
+			goto error;
+		if(!(registration->registry = statement_registry_find(db))) {
+			ret = SQLITE_ERROR;
+			goto error;
+		}
+	}
+
+	// sqlite frees the registration if this fails
+	if((ret = sqlite3_create_module_v2(db,name,&statement_registered_module,registration,statement_registration_free)) != SQLITE_OK || !scratch.scalar)
+		return ret;
+
+	// connecting straight away checks the statement is one the scalar option can be used with, and defines its function
+	sqlite3_stmt* connect = NULL;
+	char* sql_connect = sqlite3_mprintf("SELECT 1 FROM \"%w\"",name);
+	if(!sql_connect)
+		ret = SQLITE_NOMEM;
+	else if((ret = sqlite3_prepare_v2(db,sql_connect,-1,&connect,NULL)) != SQLITE_OK && !(err = sqlite3_mprintf("%s",sqlite3_errmsg(db))))
+		ret = SQLITE_NOMEM;
+	sqlite3_free(sql_connect);
+	sqlite3_finalize(connect);
+	if(ret != SQLITE_OK) {
+		sqlite3_create_module_v2(db,name,NULL,NULL,NULL);
+		if(pzErrMsg)
+			*pzErrMsg = err;
+		else
+			sqlite3_free(err);
+	}
+	return ret;
+
+error:
+	statement_registration_free(registration);
+	if(pzErrMsg)
+		*pzErrMsg = err;
+	else
+		sqlite3_free(err);
+	return ret;
+}
+
+// set the connection's progress handler as sqlite3_progress_handler would, where vtabs with a max_steps or max_ms budget
+// install their own while their statements run, which calls through to it. the extension is set up on the connection if it isn't yet
+#ifdef _WIN32
+__declspec(dllexport)
+#endif
+int sqlite3_statementvtab_progress_handler(sqlite3* db, int n, int (*progress)(void*), void* arg) {
+	struct statement_registry* registry = statement_registry_find(db);
+	if(!registry) {
+#ifdef SQLITE_CORE
+		int ret = statement_vtab_entry_point(db,NULL,NULL);
+#else
+		int ret = statement_vtab_entry_point(db,NULL,sqlite3_api);
+#endif
+		if(ret != SQLITE_OK)
+			return ret;
+		if(!(registry = statement_registry_find(db)))
+			return SQLITE_ERROR;
+	}
+	registry->progress = n > 0 ? progress : NULL;
+	registry->progress_arg = arg;
+	registry->progress_ops = n;
+	registry->progress_count = 0;
+	// one set while a budgeted statement runs takes effect once it's done
+	if(!registry->budgeted)
+		statement_budget_restore(registry);
+	statement_registry_release(registry);
+	return SQLITE_OK;
 }
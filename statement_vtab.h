@@ -0,0 +1,35 @@
+/*
+ * SQLite module to define virtual tables and table-valued functions natively using SQL.
+ * In the interest of compatibility with SQLite's own license (or rather lack thereof),
+ * the author disclaims copyright to this source code.
+ */
+
+// declarations for applications linking the extension in (built with SQLITE_CORE), or calling into it once loaded
+#ifndef STATEMENT_VTAB_H
+#define STATEMENT_VTAB_H
+
+#include <sqlite3.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// sets up the statement module along with statement_vtab_stats and statement_vtab_plan on a connection,
+// for instance through sqlite3_auto_extension
+int sqlite3_statementvtab_init(sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* pApi);
+
+// registers sql as an eponymous table-valued function called name on the connection, like
+// CREATE VIRTUAL TABLE name USING statement((sql), options...) but without writing to the schema.
+// options are given as they would be to the module, e.g. "cache=4M". on error an English message may be returned in
+// *pzErrMsg, which is to be freed with sqlite3_free
+int sqlite3_statementvtab_register(sqlite3* db, const char* name, const char* sql, int num_options, const char* const* options, char** pzErrMsg);
+
+// sets the connection's progress handler like sqlite3_progress_handler. vtabs with a max_steps or max_ms budget replace the
+// progress handler while their statements run, calling through to one set this way, and restore it afterwards
+int sqlite3_statementvtab_progress_handler(sqlite3* db, int n, int (*progress)(void*), void* arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+-- columns, parameters, range params, constant arguments and nesting
+.load ./statement_vtab
+create virtual table abc using statement((select 1 as a, 2 as b, 3 as c));
+select * from abc;
+create virtual table arguments using statement((select ? as a, ? as b, ? as c));
+select * from arguments('x', 'y', 'z');
+select * from arguments where [1] = 'x' and [2] = 'y' and [3] = 'z';
+create virtual table sumdiff using statement((select ? + ? as sum, ?1 - ?2 as difference));
+select * from sumdiff(1, 3);
+create virtual table hypot using statement((select :x * :x + :y * :y as squared));
+select x, y, * from hypot where x = 3 and y = 4;
+select * from hypot(5);
+create table events(id integer primary key, ts, name);
+insert into events values (1, 50, 'a'), (2, 100, 'b'), (3, 150, 'c'), (4, 200, 'd'), (5, 250, 'e');
+create virtual table events_between using statement((
+	select id, name from events where ts > coalesce(:ts_gt, -1e999) and ts <= coalesce(:ts_le, 1e999)
+));
+select * from events_between where ts > 100 and ts <= 200;
+select count(*) from events_between;
+create virtual table events_within using statement((select id from events where ts between :ts_ge and :ts_le));
+select * from events_within where ts between 100 and 150;
+-- range params of the same kind may only be given once
+select * from events_between where ts > 100 and ts > 150;
+-- literals are written into the statement, and nested vtabs are spliced in
+create virtual table events_after using statement((select id from events_between(:after, 1e999) where id > 1));
+select * from events_after(150);
+select * from events_after(:p);
+select sql like '%AS events_between%' from statement_vtab_stats where name = 'events_after';
+-- statements that don't select
+create virtual table bad using statement((delete from events));
+create virtual table bad using statement((select 1), nonsense);
+-- splicing is done over once the vtab spliced in is replaced
+create virtual table plus_one using statement((select :x + 1 as y));
+create virtual table nested using statement((select y from plus_one(:v)));
+create virtual table nested_scalar using statement((select y from plus_one(:v)), scalar);
+select * from nested(1);
+select nested_scalar(1);
+drop table plus_one;
+create virtual table plus_one using statement((select :x * 100 as y));
+select * from nested(1);
+select nested_scalar(2);
+select sql from statement_vtab_stats where name = 'nested';
+-- IN lists of values too large to be bound without copying, visited all at once
+create virtual table pair using statement((select substr(:a, 1, 1) || substr(:b, 1, 1) as k, length(:a) + length(:b) as n));
+select k, n from pair where a in (printf('%.5000c', 'x'), printf('%.6000c', 'y')) and b in (printf('%.7000c', 'p'), null, printf('%.8000c', 'q'));
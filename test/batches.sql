@@ -0,0 +1,24 @@
+-- __batch runs one invocation per tuple; other constraints on the hidden columns are left to sqlite
+.load ./statement_vtab
+create virtual table hypot using statement((select :x * :x + :y * :y as squared));
+select __batch_index, x, y, squared from hypot where __batch = '[[3,4],[5,12],{"y":8,"x":6}]';
+select __batch_index, squared from hypot where __batch = '[2, [1], {"x":3,"y":1}]';
+select __batch_index, squared from hypot where __batch = '[[3,4],[5,12]]' and __batch_index > 0;
+select __batch_index, squared from hypot where __batch = '[[3,4],[5,12]]' and x = 5;
+select count(*) from hypot where __batch = '[]';
+-- non-equality constraints on __batch are checked against the rows produced
+select count(*) from hypot(3, 4) where __batch > 'a';
+select count(*) from hypot(3, 4) where __batch is not null;
+select squared from hypot(3, 4) where __batch is null;
+select count(*) from hypot(3, 4) where __batch_index > 0;
+select squared from hypot(3, 4) where __batch_index < 1;
+-- malformed batches
+select * from hypot where __batch = 'nope';
+select * from hypot where __batch = '[[1,2,3]]';
+select * from hypot where __batch = '[{"z":1}]';
+-- statements with a column or parameter of the same name don't get the batch columns
+create virtual table named using statement((select :__batch + :y as s));
+select * from named(1, 2);
+select __batch, s from named where __batch = 3 and y = 4;
+create virtual table output using statement((select :x as __batch_index, :x * 2 as d));
+select * from output where x = 6 and __batch_index = 6;
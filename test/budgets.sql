@@ -0,0 +1,25 @@
+-- max_rows, max_steps and max_ms: running out fails the query, or with truncate ends it with a __truncated row
+.load ./statement_vtab
+create table t(a, b);
+with recursive n(i) as (select 1 union all select i + 1 from n where i < 2000) insert into t select i, i % 10 from n;
+create virtual table first3 using statement((select a from t where b = :b order by a), max_rows=3);
+create virtual table first3t using statement((select a from t where b = :b order by a), max_rows=3, truncate);
+create virtual table counted using statement((select count(*) as n from t where b = :b), max_steps=500, truncate);
+create virtual table counted_err using statement((select count(*) as n from t where b = :b), max_steps=500);
+create virtual table roomy using statement((select count(*) as n from t where b = :b), max_steps=1000000, max_ms=100000);
+select count(*) from first3(3);
+select a, __truncated from first3t(3);
+select a, __truncated from first3t(3) where not __truncated;
+select n, __truncated from counted(3);
+select n from counted_err(3);
+select n from roomy(3);
+select name, over_budget from statement_vtab_stats order by name;
+-- steps are counted while the statement runs, so one that never produces a row is still stopped
+create virtual table endless using statement((with recursive n(i) as (select 1 union all select i + 1 from n) select i from n where i < :lo), max_steps=100000, truncate);
+create virtual table endless_err using statement((with recursive n(i) as (select 1 union all select i + 1 from n) select i from n where i < :lo), max_steps=100000);
+select i, __truncated from endless(0);
+select i from endless_err(0);
+select i, __truncated from endless(3) limit 2;
+create virtual table bad using statement((select 1), truncate);
+create virtual table bad using statement((select 1), max_rows=3, materialize);
+create virtual table bad using statement((select 1), max_rows=x);
@@ -0,0 +1,25 @@
+-- cache: repeated bindings are replayed until the data changes, and never inside write transactions
+.load ./statement_vtab
+create table t(a, b);
+insert into t values (1, 'x'), (2, 'y'), (1, 'z');
+create virtual table by_a using statement((select b from t where a = :a order by b), cache);
+create virtual table by_a_off using statement((select b from t where a = :a order by b), cache=0);
+create virtual table pure using statement((select :x * 2 as y));
+create virtual table pure_off using statement((select :x * 2 as y), cache=off);
+select group_concat(b) from by_a(1);
+select group_concat(b) from by_a(1);
+select group_concat(b) from by_a_off(1);
+select group_concat(b) from by_a_off(1);
+select y from pure(2) union all select y from pure(2) union all select y from pure_off(2) union all select y from pure_off(2);
+select name, cache_hits, cache_misses from statement_vtab_stats order by name;
+insert into t values (1, 'w');
+select group_concat(b) from by_a(1);
+begin;
+insert into t values (1, 'v');
+select group_concat(b) from by_a(1);
+select group_concat(b) from by_a(1);
+rollback;
+select group_concat(b) from by_a(1);
+select name, cache_hits, cache_misses from statement_vtab_stats where name = 'by_a';
+create virtual table bad using statement((select 1), cache='lots');
+create virtual table bad using statement((select 1), cache=12Q);
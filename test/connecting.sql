@@ -0,0 +1,39 @@
+-- declarations are shared between connections to a file only where the statement's names mean the same
+.load ./statement_vtab
+.open --new test/connecting.db
+.load ./statement_vtab
+attach 'test/connecting_aux.db' as aux;
+create table aux.u(x, y);
+insert into aux.u values (1, 2);
+create table t(a);
+insert into t values (10);
+create virtual table from_aux using statement((select x, y from u));
+create virtual table from_main using statement((select a from t));
+select * from from_aux;
+select * from from_main;
+.open test/connecting.db
+.load ./statement_vtab
+select * from from_main;
+select * from from_aux;
+.open test/connecting.db
+.load ./statement_vtab
+attach 'test/connecting_aux.db' as aux;
+select * from from_aux;
+select name, prepares from statement_vtab_stats order by name;
+-- a temp table of the same name changes what the statement reads
+create temp table t(a);
+insert into temp.t values (20);
+select * from from_main;
+-- a schema change in an attached database isn't hidden by a shared declaration
+create virtual table main.over_aux using statement((select * from aux.u));
+select * from over_aux;
+.open test/connecting.db
+.load ./statement_vtab
+attach 'test/connecting_aux.db' as aux;
+select * from over_aux;
+alter table aux.u add column z;
+update aux.u set z = 3;
+.open test/connecting.db
+.load ./statement_vtab
+attach 'test/connecting_aux.db' as aux;
+select * from over_aux;
@@ -0,0 +1,15 @@
+-- rows, cost and unique hints, and SELECT DISTINCT pushed into the statement
+.load ./statement_vtab
+create table kinds(k, v);
+insert into kinds values ('a', 1), ('b', 2), ('a', 3), ('c', 4), ('b', 5);
+create virtual table lookup using statement((select v from kinds where k = :k), rows=1, cost=5000, unique=off);
+create virtual table one using statement((select v from kinds where rowid = :id), unique);
+select group_concat(v) from lookup('a');
+select v from one(3);
+select kinds.k, lookup.v from kinds join lookup using (k) order by 2;
+create virtual table all_kinds using statement((select k, v from kinds));
+select distinct k from all_kinds order by k;
+select distinct plan, variant, sql from statement_vtab_plan('all_kinds');
+create virtual table bad using statement((select 1), rows=-3);
+create virtual table bad using statement((select 1), cost=x);
+create virtual table bad using statement((select 1), unique=maybe);
@@ -0,0 +1,18 @@
+-- materialize: a statement without parameters runs once, and again once the data changes
+.load ./statement_vtab
+create table sales(category, amount);
+insert into sales values ('a', 1), ('b', 2), ('a', 3), ('c', 4);
+create table items(id, category);
+insert into items values (1, 'a'), (2, 'b'), (3, 'c'), (4, 'a'), (5, 'd');
+create virtual table totals using statement((select category, sum(amount) as total from sales group by category), materialize);
+select id, total from items join totals using (category) order by id;
+select total from totals where category = 'c';
+select name, filters, cache_hits, cache_misses from statement_vtab_stats;
+insert into sales values ('d', 5);
+select id, total from items join totals using (category) order by id;
+begin;
+insert into sales values ('d', 5);
+select total from totals where category = 'd';
+rollback;
+select total from totals where category = 'd';
+create virtual table bad using statement((select :x), materialize);
@@ -0,0 +1,29 @@
+-- persist: results are stored in a shadow table shared between connections, but not from inside transactions
+-- or on defensive connections, which the shell's are by default
+.load ./statement_vtab
+.open --new test/persist.db
+.load ./statement_vtab
+create virtual table twice using statement((select :x * 2 as y, :x || 'a' as t), persist);
+select * from twice(1);
+select count(*) from twice_cache;
+.dbconfig defensive off
+select * from twice(2);
+select count(*) from twice_cache;
+begin;
+select * from twice(3);
+commit;
+select count(*) from twice_cache;
+.open test/persist.db
+.load ./statement_vtab
+.dbconfig defensive off
+select * from twice(2);
+select name, cache_hits, cache_misses from statement_vtab_stats where name = 'twice';
+select * from twice(3);
+select count(*) from twice_cache;
+-- only for statements whose results can't change
+create virtual table bad using statement((select random() + :x), persist);
+create table t(a);
+create virtual table bad using statement((select count(*) from t where a = :a), persist);
+create virtual table bad using statement((select :x), persist, cache=0);
+drop table twice;
+select name from sqlite_master;
@@ -0,0 +1,17 @@
+-- statement_vtab_plan lists the plans chosen so far, or those of a given constraint set
+.load ./statement_vtab
+create table events(id integer primary key, ts, name);
+create index events_ts on events(ts);
+create virtual table events_between using statement((
+	select id, name from events where ts > coalesce(:ts_gt, -1e999) and ts <= coalesce(:ts_le, 1e999)
+), profile);
+-- before it's queried, only the statement as written
+select plan, variant, detail from statement_vtab_plan('events_between');
+select * from events_between where ts > 1 and ts <= 2;
+select plan, variant, detail, loops, rows, cycles from statement_vtab_plan('events_between');
+select name, count(*) from statement_vtab_plan group by name;
+select plan, detail from statement_vtab_plan('events_between', 'WHERE ts > ? AND ts <= ? ORDER BY name');
+select plan, detail from statement_vtab_plan('events_between', 'WHERE ts > ?');
+-- constraints that aren't a query's
+select * from statement_vtab_plan('events_between', 'GROUP BY');
+select * from statement_vtab_plan('nonesuch');
@@ -0,0 +1,26 @@
+-- scalar: the function is defined once per connection and looks its vtab up by name
+.load ./statement_vtab
+.open --new test/scalar.db
+.load ./statement_vtab
+create table lines(order_id, price, qty);
+insert into lines values (1, 2.5, 2), (1, 1, 3), (2, 10, 1);
+create virtual table order_total using statement((select sum(price * qty) from lines where order_id = :id), scalar);
+select order_total(1), order_total(2), order_total(3);
+-- calls with the wrong number of arguments fail
+select order_total(1, 2);
+-- only single column statements
+create virtual table two using statement((select 1 as a, 2 as b), scalar);
+-- dropping and creating the vtab again keeps the function, running the new statement
+drop table order_total;
+select order_total(1);
+create virtual table order_total using statement((select count(*) from lines where order_id = :id), scalar);
+select order_total(1), order_total(2);
+-- a fresh connection defines the function for vtabs already in the schema, before they're touched
+.open test/scalar.db
+.load ./statement_vtab
+select order_total(1);
+-- vtabs created later define it as they're created
+create virtual table temp.doubled using statement((select :x * 2), scalar);
+select doubled(21);
+drop table order_total;
+select order_total(1);
@@ -0,0 +1,20 @@
+-- statement_vtab_stats, with the slow log, latency histogram and missing index recommendations
+.load ./statement_vtab
+create table t(a, b);
+with recursive n(i) as (select 1 union all select i + 1 from n where i < 1000) insert into t select i, i % 10 from n;
+create virtual table by_b using statement((select a from t where b = :b), slow);
+create virtual table timed using statement((select a from t where b = :b), latency);
+create virtual table plain using statement((select a from t where b = :b));
+select count(*) from by_b(1);
+select count(*) from by_b where b in (2, 'x');
+select count(*) from timed(1) union all select count(*) from timed(2);
+select count(*) from plain(3);
+select name, prepares, opens, filters, rows, cache_hits, cache_misses from statement_vtab_stats order by name;
+select name, (select sum(value) from json_each(latency_histogram)), (select sum(value) from json_each(rows_histogram)) from statement_vtab_stats order by name;
+select json_extract(value, '$.rows'), json_extract(value, '$.args'), json_extract(value, '$.elapsed_ns') > 0 from statement_vtab_stats, json_each(slow) where name = 'by_b';
+-- scanning a table for every binding recommends an index
+with recursive n(i) as (select 0 union all select i + 1 from n where i < 20) select count(*) from n, plain(n.i);
+select fullscan_invocations >= 16, recommendation from statement_vtab_stats where name = 'plain';
+delete from statement_vtab_stats where name = 'by_b';
+select name, filters, rows, slow from statement_vtab_stats where name = 'by_b';
+create virtual table bad using statement((select 1), slow=-1);
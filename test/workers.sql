@@ -0,0 +1,16 @@
+-- workers and prefetch produce the same rows, in the same order, as running on the caller's thread
+.load ./statement_vtab
+create virtual table squares using statement((with recursive n(i) as (select 1 union all select i + 1 from n where i < :n) select i * i as sq from n), workers=2);
+select __batch_index, count(*), sum(sq) from squares where __batch = '[10, 20, 30, 40, 50, 60]' group by __batch_index;
+select __batch_index, sum(sq) from squares where __batch = '[3, 4]' group by __batch_index;
+select n, count(*) from squares where n in (5, 6, 7, 8) group by n;
+create virtual table walk using statement((with recursive n(i) as (select 1 union all select i + 1 from n where i < :n) select i from n), prefetch=16);
+select count(*), sum(i), max(i) from walk(1000);
+select group_concat(i) from walk(5);
+select i from walk(1000) limit 2;
+-- functions the worker connections don't have run on the caller's thread
+create virtual table funcs using statement((select group_concat(value) as v from json_each(:j)), workers=2);
+select v from funcs where __batch = '[["[1,2]"], ["[3]"], ["[]"], ["[4,5,6]"]]';
+create virtual table bad using statement((select :x), workers=many);
+create virtual table bad using statement((select :x), prefetch, cache);
+create virtual table bad using statement((select :x), prefetch, materialize);